@@ -0,0 +1,302 @@
+/*
+ * DriverBench.cpp
+ *
+ *  Created on: Apr 24, 2021
+ *      Author: Albert Guan
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+#include <new>
+#include <vector>
+#include "Diag.h"
+#include "GpioI2C.h"
+#include "GpioIn.h"
+#include "GpioOut.h"
+#include "MemSim.h"
+#include "PCA9685Ctrl.h"
+#include "WS2812BCtrl.h"
+
+/*
+ * DriverBench times the hot paths of the drivers against the simulated
+ * register blocks of MemSimBackend, it runs on any x86 Linux host.
+ *
+ * Each case runs twice. A counting pass traps every register access to get
+ * the MMIO reads and writes per op, and counts the heap allocations made by
+ * the op. A timing pass then runs the op with the registers mapped as plain
+ * memory.
+ *
+ * The cases which wait on the device (I2C) only get the counting pass. They
+ * need the write hooks of the model, the BSC status bits are write 1 to
+ * clear and a plain store of the clear mask leaves ERR set, while timing
+ * them with the hooks would measure the traps rather than the driver. Their
+ * ns_per_op is null.
+ *
+ * One JSON object per line goes to stdout, so a run can be diffed against a
+ * previous one:
+ *
+ *	{"bench":"GpioOut::Update(mask)","iterations":1000000,"ns_per_op":3.1,...}
+ *
+ * Build (x86 host, wiringPi.h on the include path):
+ *
+ *	g++ -std=gnu++14 -O2 -pthread -Iinc bench/DriverBench.cpp gpio/Gpio*.cpp \
+ *		gpio/MemBase.cpp gpio/MemSim.cpp src/DMA.cpp src/DMAMem.cpp \
+ *		src/Diag.cpp src/PCA9685Ctrl.cpp \
+ *		src/WS2812BCtrl.cpp -o DriverBench
+ *
+ *	./DriverBench [iterations]
+ */
+
+static const uint32_t BENCH_DEFAULT_ITERATIONS = 100000;
+static const uint32_t BENCH_MAX_COUNTED = 1000;				//Ops per counting pass
+static const uint32_t BENCH_WARMUP = 100;
+static const int8_t BENCH_PCA9685_ADDR = 0x40;
+
+//
+// Heap allocations of this thread, counted by the replaced operator new.
+//
+
+static thread_local uint64_t s_Allocations = 0;
+
+void *
+operator new (
+	size_t Size
+	)
+{
+	void *Ptr;
+
+	s_Allocations += 1;
+	Ptr = malloc((0 != Size) ? Size : 1);
+	if (NULL == Ptr) {
+		throw std::bad_alloc();
+	}
+
+	return Ptr;
+}
+
+void *
+operator new[] (
+	size_t Size
+	)
+{
+	return operator new(Size);
+}
+
+void
+operator delete (
+	void *Ptr
+	) noexcept
+{
+	free(Ptr);
+}
+
+void
+operator delete[] (
+	void *Ptr
+	) noexcept
+{
+	free(Ptr);
+}
+
+void
+operator delete (
+	void *Ptr,
+	size_t Size
+	) noexcept
+{
+	(void)Size;
+	free(Ptr);
+}
+
+void
+operator delete[] (
+	void *Ptr,
+	size_t Size
+	) noexcept
+{
+	(void)Size;
+	free(Ptr);
+}
+
+typedef struct _BenchCase_ {
+	const char *Name;
+	bool Timed;							//False if the op waits on a model
+	std::function<void(uint32_t Iteration)> Op;
+} BenchCase;
+
+static
+void
+RunCase (
+	_In_ MemSimBackend &Sim,
+	_In_ const BenchCase &Case,
+	_In_ uint32_t Iterations
+	)
+
+/*
+ Routine Description:
+
+	This routine runs the counting pass and, if the case is timed, the timing
+	pass of one case and prints its line.
+
+ Parameters:
+
+ 	Sim - Supplies the backend.
+
+ 	Case - Supplies the case.
+
+ 	Iterations - Supplies the number of ops of the timing pass.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Allocations;
+	uint32_t Counted = (Iterations < BENCH_MAX_COUNTED) ? Iterations : BENCH_MAX_COUNTED;
+	char NsPerOp[32];
+	uint64_t Reads;
+	uint64_t Start;
+	uint64_t Writes;
+
+	Sim.SetTrapMode(MEMSIM_TRAP_ALL);
+	for (uint32_t i = 0; i < BENCH_WARMUP; i++) {
+		Case.Op(i);
+	}
+
+	Reads = Sim.GetReadCount();
+	Writes = Sim.GetWriteCount();
+	Allocations = s_Allocations;
+	for (uint32_t i = 0; i < Counted; i++) {
+		Case.Op(i);
+	}
+
+	Allocations = s_Allocations - Allocations;
+	Reads = Sim.GetReadCount() - Reads;
+	Writes = Sim.GetWriteCount() - Writes;
+
+	snprintf(NsPerOp, sizeof(NsPerOp), "null");
+	if (Case.Timed) {
+		Sim.SetTrapMode(MEMSIM_TRAP_NONE);
+		Start = RpiGetTimeNs();
+		for (uint32_t i = 0; i < Iterations; i++) {
+			Case.Op(i);
+		}
+
+		snprintf(NsPerOp,
+				 sizeof(NsPerOp),
+				 "%.1f",
+				 static_cast<double>(RpiGetTimeNs() - Start) / Iterations);
+	}
+
+	printf("{\"bench\":\"%s\",\"iterations\":%u,\"ns_per_op\":%s,"
+		   "\"mmio_reads_per_op\":%.2f,\"mmio_writes_per_op\":%.2f,"
+		   "\"allocs_per_op\":%.2f}\n",
+		   Case.Name,
+		   Case.Timed ? Iterations : 0,
+		   NsPerOp,
+		   static_cast<double>(Reads) / Counted,
+		   static_cast<double>(Writes) / Counted,
+		   static_cast<double>(Allocations) / Counted);
+
+	fflush(stdout);
+	return;
+}
+
+int
+main (
+	_In_ int Argc,
+	_In_ char *Argv[]
+)
+
+/*
+ Routine Description:
+
+	This routine is the entry point of the benchmark.
+
+ Parameters:
+
+ 	Argc - Supplies count of arguments.
+
+ 	Argv - Supplies argument values, the optional iteration count.
+
+ Return Value:
+
+	int - 0 on success, 1 if the simulation can't be set up.
+
+ */
+
+{
+
+	uint32_t Iterations = BENCH_DEFAULT_ITERATIONS;
+	MemSimBackend Sim;
+
+	if ((Argc > 1) && (atoi(Argv[1]) > 0)) {
+		Iterations = atoi(Argv[1]);
+	}
+
+	if (ERROR_SUCCESS != Sim.AddDefaultModels()) {
+		return 1;
+	}
+
+	MemBase::SetBackend(&Sim);
+
+	{
+		const std::vector<uint32_t> SetPins = {5, 6};
+		const std::vector<uint32_t> ClearPins = {12, 13};
+		const std::vector<int32_t> InPins = {16, 17, 19, 20, 21};
+		const std::vector<int8_t> I2CData = {0x06, 0x00, 0x00, 0x00, 0x08};
+		std::vector<int32_t> Levels;
+		uint32_t Frame[10] = {0};
+		GpioOut Out0(5);
+		GpioOut Out1(6);
+		GpioOut Out2(12);
+		GpioOut Out3(13);
+		GpioI2C I2C(2, 3);
+		PCA9685Ctrl Pwm(I2C, BENCH_PCA9685_ADDR);
+		WS2812BCtrl Led(0.5);
+
+		const BenchCase Cases[] = {
+			{"GpioOut::Update(vector)", true, [&](uint32_t) {
+				GpioOut::Update(SetPins, ClearPins);
+			}},
+			{"GpioOut::Update(mask)", true, [&](uint32_t) {
+				GpioOut::Update(PinSet<5, 6>::MASK, PinSet<12, 13>::MASK);
+			}},
+			{"GpioOut::Write<PinSet>", true, [&](uint32_t) {
+				GpioOut::Write<PinSet<5, 6>, PinSet<12, 13>>();
+			}},
+			{"GpioIn::checkPinLevels", true, [&](uint32_t) {
+				Levels.clear();
+				GpioIn::checkPinLevels(InPins, Levels);
+			}},
+			{"WS2812BCtrl::setSerializedRGB", true, [&](uint32_t i) {
+				Led.setSerializedRGB(Frame, i & 0x3, {static_cast<uint8_t>(i), 0x80, 0x40});
+			}},
+			{"GpioI2C::write", false, [&](uint32_t) {
+				I2C.write(BENCH_PCA9685_ADDR, I2CData);
+			}},
+			{"PCA9685Ctrl::SetPWMDutyCycle", false, [&](uint32_t i) {
+				Pwm.SetPWMDutyCycle(0, (0 != (i & 0x1)) ? 0.25 : 0.75);
+			}},
+		};
+
+		//
+		// The traps are live once the first driver opened the backend.
+		//
+
+		for (auto &Case : Cases) {
+			RunCase(Sim, Case, Iterations);
+		}
+
+		Sim.SetTrapMode(MEMSIM_TRAP_WRITES);
+	}
+
+	MemBase::SetBackend(NULL);
+	return 0;
+}
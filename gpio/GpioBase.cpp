@@ -15,13 +15,15 @@
 #include <bitset>
 #include <string>
 #include "GpioBase.h"
+#include "GpioConfigBatch.h"
 
 volatile GpioBase::PGPIORegisters GpioBase::GPIORegs = NULL;
 int32_t GpioBase::num_of_gpio_inst = 0;
 
 GpioBase::GpioBase (
 	const std::vector<int32_t> &Pins,
-	GPIO_FUN_SELECT PinSelect
+	GPIO_FUN_SELECT PinSelect,
+	_In_opt_ GpioConfigBatch *Batch
 ) : m_Pins(Pins),
 	m_PinSelection(PinSelect)
 
@@ -37,6 +39,8 @@ GpioBase::GpioBase (
 
  	PinSelect - Supplies which ALT to set for Pins.
 
+ 	Batch - Supplies an optional batch to record the pin selection into.
+
  Return Value:
 
 	None.
@@ -52,10 +56,18 @@ GpioBase::GpioBase (
 	Init();
 
 	//
-	// Set pin selection registers.
+	// Set pin selection registers, or leave it to the batch.
 	//
 
-	SetPinSelection();
+	if (NULL != Batch) {
+		for (auto pin : m_Pins) {
+			Batch->SetFunction(pin, m_PinSelection);
+		}
+
+	} else {
+		SetPinSelection();
+	}
+
 	return;
 }
 
@@ -111,37 +123,136 @@ GpioBase::SetPinSelection(
 
 {
 
-	uint32_t Before;
 	uint32_t BitOffset;
-	uint32_t Current;
+	uint32_t Masks[GPIO_FSEL_WORD_COUNT] = {0};
+	uint32_t Values[GPIO_FSEL_WORD_COUNT] = {0};
 	uint32_t WordOffset;
 
+	//
+	// Fold all pins into per word masks first, so each GPFSELn word is
+	// read-modified-written once however many pins live in it.
+	//
+
 	for (auto pin : m_Pins) {
 
 		//
 		//Each GPIO selection word contains 10 pins.
 		//
 
-		WordOffset = pin / 10;
+		WordOffset = pin / GPIO_PINS_PER_FSEL_WORD;
 
 		//
 		//Each pin takes 3 bits in GPIO selection word.
 		//
 
-		BitOffset = pin % 10 * 3;
+		BitOffset = pin % GPIO_PINS_PER_FSEL_WORD * GPIO_FSEL_BITS;
+		Masks[WordOffset] |= GPIO_FSEL_FIELD_MASK << BitOffset;
+		Values[WordOffset] |= (m_PinSelection & GPIO_FSEL_FIELD_MASK) << BitOffset;
+	}
+
+	UpdateFsel(Masks, Values);
+	return;
+}
+
+void
+GpioBase::UpdateFsel (
+	_In_ const uint32_t *Masks,
+	_In_ const uint32_t *Values
+	)
+
+/*
+ Routine Description:
+
+	This routine applies per word masks to the GPIO pin selection registers,
+	words with an empty mask are skipped.
+
+ Parameters:
+
+ 	Masks - Supplies GPIO_FSEL_WORD_COUNT masks of the bits to clear.
+
+ 	Values - Supplies GPIO_FSEL_WORD_COUNT values to OR in after clearing.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Before;
+	uint32_t Current;
+
+	for (uint32_t Word = 0; Word < GPIO_FSEL_WORD_COUNT; Word += 1) {
+		if (0 == Masks[Word]) {
+			continue;
+		}
 
 		//
 		// Snap the current value.
 		//
 
-		Current = GPIORegs->GPFSELn[WordOffset];
+		Current = GPIORegs->GPFSELn[Word];
 		Before = Current;
-		Current &= ~(0x7 << BitOffset);
-		Current |= m_PinSelection << BitOffset;
-		GPIORegs->GPFSELn[WordOffset] = Current;
-		RPI_PRINT_EX(InfoLevelDebug, "Before: 0x%08x, After: 0x%08x", Before, Current);
+		Current &= ~Masks[Word];
+		Current |= Values[Word];
+		GPIORegs->GPFSELn[Word] = Current;
+		RPI_PRINT_EX(InfoLevelDebug, "GPFSEL%u Before: 0x%08x, After: 0x%08x", Word, Before, Current);
+	}
+
+	return;
+}
+
+void
+GpioBase::ProgramPull (
+	_In_ GPIO_PULL Pull,
+	_In_ uint64_t Mask
+	)
+
+/*
+ Routine Description:
+
+	This routine programs the pull up/down control of many pins at once. The
+	control signal is set in GPPUD, then clocked into all pins of both
+	GPPUDCLKn words together, as in Chapter 6.1 of BCM2837-ARM-Peripherals.
+
+ Parameters:
+
+ 	Pull - Supplies the pull mode.
+
+ 	Mask - Supplies the pins to program, bit n being GPIO n.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Word0;
+	uint32_t Word1;
+
+	Word0 = static_cast<uint32_t>(Mask);
+	Word1 = static_cast<uint32_t>(Mask >> 32);
+	if ((0 == Word0) && (0 == Word1)) {
+		return;
 	}
 
+	GPIORegs->GPPUD = Pull;
+	usleep(PULL_SETUP_TIME_US);
+	GPIORegs->GPPUDCLKn[0] = Word0;
+	GPIORegs->GPPUDCLKn[1] = Word1;
+	usleep(PULL_SETUP_TIME_US);
+
+	//
+	// Remove the control signal and the clock.
+	//
+
+	GPIORegs->GPPUD = PULL_DISABLE;
+	GPIORegs->GPPUDCLKn[0] = 0;
+	GPIORegs->GPPUDCLKn[1] = 0;
+	RPI_PRINT_EX(InfoLevelDebug, "Pull %u: 0x%08x 0x%08x", Pull, Word1, Word0);
 	return;
 }
 
@@ -173,36 +284,23 @@ GpioBase::Init (
 
 	if (0 == num_of_gpio_inst)
 	{
-		//
-		//Check whether the "/dev/mem" has been opened or not
-		//
+		try
+		{
+			GPIORegs = (GPIORegisters *) MapRegisters(GPIO_BASE_PHY_ADDR, sizeof(GPIORegisters));
 
-		if (mem_fd != 0) {
-			try
-			{
-				GPIORegs = (GPIORegisters *) mmap(NULL,
-												  sizeof(GPIORegisters),
-												  (PROT_READ | PROT_WRITE),
-												  MAP_SHARED,
-												  mem_fd,
-												  GPIO_BASE_PHY_ADDR);
-
-				if (MAP_FAILED == GPIORegs) {
-					throw "Failed to mmap GPIORegs";
-				}
-
-			} catch (const std::string &err) {
-				std::cout << __func__ << " with exception: " << err << std::endl;
-				return -1;
-
-			} catch (...) {
-				std::cout << __func__ << " with unknown exception" << std::endl;
-				std::cout << "Please try to run with sudo" << std::endl;
-				return -2;
+			if (MAP_FAILED == GPIORegs) {
+				GPIORegs = NULL;
+				throw "Failed to mmap GPIORegs";
 			}
 
-		} else {
-			return -3;
+		} catch (const std::string &err) {
+			std::cout << __func__ << " with exception: " << err << std::endl;
+			return -1;
+
+		} catch (...) {
+			std::cout << __func__ << " with unknown exception" << std::endl;
+			std::cout << "Please try to run with sudo" << std::endl;
+			return -2;
 		}
 	}
 
@@ -243,8 +341,7 @@ GpioBase::Uninit (
 		//Only const_cast can add/remove the "volatile" keyword
 		//
 
-		munmap(static_cast<void *>(const_cast<GPIORegisters *>(GPIORegs)),
-			   sizeof(GPIORegisters));
+		UnmapRegisters(GPIORegs, sizeof(GPIORegisters));
 
 		GPIORegs = NULL;
 	}
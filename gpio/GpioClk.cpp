@@ -70,8 +70,8 @@ GpioClk::GpioClk(
 	// Init clk control and freq registers
 	//
 
-	CM_GP_CTL = ADDRESS_TO_VOLATILE_POINTER((uint32_t)ClkRegisters + CM_GPxCTL_OFFSET[m_channel]);
-	CM_GP_DIV = ADDRESS_TO_VOLATILE_POINTER((uint32_t)ClkRegisters + CM_GPxDIV_OFFSET[m_channel]);
+	CM_GP_CTL = ADDRESS_TO_VOLATILE_POINTER((uintptr_t)ClkRegisters + CM_GPxCTL_OFFSET[m_channel]);
+	CM_GP_DIV = ADDRESS_TO_VOLATILE_POINTER((uintptr_t)ClkRegisters + CM_GPxDIV_OFFSET[m_channel]);
 	SetFreq(Freq);
 	return;
 }
@@ -288,12 +288,7 @@ GpioClk::Init (
 	if (0 == NumOfClkInstances) {
 		try {
 			ClkRegisters = const_cast<volatile uint32_t *>(static_cast<uint32_t *>(
-							mmap(NULL,
-								 BLOCK_SIZE,
-								 PROT_READ | PROT_WRITE,
-								 MAP_SHARED,
-								 mem_fd,
-								 GPIO_CLK_PHY_ADDR)));
+							MapRegisters(GPIO_CLK_PHY_ADDR, BLOCK_SIZE)));
 
 			if (MAP_FAILED == ClkRegisters) {
 				throw "Failed to mmap ClkRegisters";
@@ -337,7 +332,7 @@ GpioClk::Uninit (
 
 	NumOfClkInstances -= 1;
 	if ((0 == NumOfClkInstances) && (NULL != ClkRegisters)) {
-		munmap(static_cast<void *>(const_cast<uint32_t *>(ClkRegisters)), BLOCK_SIZE);
+		UnmapRegisters(ClkRegisters, BLOCK_SIZE);
 		ClkRegisters = NULL;
 	}
 
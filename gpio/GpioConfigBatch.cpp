@@ -0,0 +1,374 @@
+/*
+ * GpioConfigBatch.cpp
+ *
+ *  Created on: Mar 13, 2021
+ *      Author: Albert Guan
+ */
+
+#include <unistd.h>
+#include "GpioConfigBatch.h"
+
+GpioConfigBatch::GpioConfigBatch (
+	void
+) : GpioBase(std::vector<int32_t>{}, FSEL_INPUT)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioConfigBatch. The GPIO registers are
+	mapped by GpioBase, the batch starts empty.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Clear();
+	return;
+}
+
+GpioConfigBatch::~GpioConfigBatch (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioConfigBatch, settings not applied
+	yet are dropped.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	return;
+}
+
+void
+GpioConfigBatch::Clear (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine drops all recorded settings.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	for (uint32_t Word = 0; Word < GPIO_FSEL_WORD_COUNT; Word += 1) {
+		m_FselMasks[Word] = 0;
+		m_FselValues[Word] = 0;
+	}
+
+	for (uint32_t Pull = 0; Pull < NUM_OF_PULLS; Pull += 1) {
+		m_PullMasks[Pull] = 0;
+	}
+
+	m_EventDisable = 0;
+	for (uint32_t Reg = 0; Reg < NUM_OF_EVENT_REGS; Reg += 1) {
+		m_EventEnable[Reg] = 0;
+	}
+
+	m_Pins = 0;
+	return;
+}
+
+void
+GpioConfigBatch::SetFunction (
+	_In_ int32_t Pin,
+	_In_ GPIO_FUN_SELECT PinSelect
+	)
+
+/*
+ Routine Description:
+
+	This routine records the function select of a pin, the last call for a
+	pin wins.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	PinSelect - Supplies the function of the pin.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t BitOffset;
+	uint32_t Word;
+
+	if ((Pin < 0) || (Pin >= GPIO_PIN_COUNT)) {
+		RPI_PRINT_EX(InfoLevelError, "Invalid GPIO pin %d", Pin);
+		return;
+	}
+
+	Word = Pin / GPIO_PINS_PER_FSEL_WORD;
+	BitOffset = Pin % GPIO_PINS_PER_FSEL_WORD * GPIO_FSEL_BITS;
+	m_FselMasks[Word] |= GPIO_FSEL_FIELD_MASK << BitOffset;
+	m_FselValues[Word] &= ~(GPIO_FSEL_FIELD_MASK << BitOffset);
+	m_FselValues[Word] |= (PinSelect & GPIO_FSEL_FIELD_MASK) << BitOffset;
+	m_Pins |= 1ull << Pin;
+	return;
+}
+
+void
+GpioConfigBatch::SetPull (
+	_In_ int32_t Pin,
+	_In_ GPIO_PULL Pull
+	)
+
+/*
+ Routine Description:
+
+	This routine records the pull up/down mode of a pin, the last call for a
+	pin wins.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	Pull - Supplies the pull mode.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Mask;
+
+	if ((Pin < 0) || (Pin >= GPIO_PIN_COUNT) || (Pull >= NUM_OF_PULLS)) {
+		RPI_PRINT_EX(InfoLevelError, "Invalid GPIO pin %d or pull %d", Pin, Pull);
+		return;
+	}
+
+	Mask = 1ull << Pin;
+	for (uint32_t Mode = 0; Mode < NUM_OF_PULLS; Mode += 1) {
+		m_PullMasks[Mode] &= ~Mask;
+	}
+
+	m_PullMasks[Pull] |= Mask;
+	m_Pins |= Mask;
+	return;
+}
+
+void
+GpioConfigBatch::SetEvent (
+	_In_ int32_t Pin,
+	_In_ GPIO_EVENT Event
+	)
+
+/*
+ Routine Description:
+
+	This routine records the event detection of a pin, the last call for a
+	pin wins.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	Event - Supplies the event to detect, EVENT_NONE disables detection.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Mask;
+
+	if ((Pin < 0) || (Pin >= GPIO_PIN_COUNT) || (Event > NUM_OF_EVENT_REGS)) {
+		RPI_PRINT_EX(InfoLevelError, "Invalid GPIO pin %d or event %d", Pin, Event);
+		return;
+	}
+
+	Mask = 1ull << Pin;
+	m_EventDisable |= Mask;
+	for (uint32_t Reg = 0; Reg < NUM_OF_EVENT_REGS; Reg += 1) {
+		m_EventEnable[Reg] &= ~Mask;
+	}
+
+	if (EVENT_NONE != Event) {
+		m_EventEnable[Event - 1] |= Mask;
+	}
+
+	m_Pins |= Mask;
+	return;
+}
+
+void
+GpioConfigBatch::AddEvent (
+	_In_ int32_t Pin,
+	_In_ GPIO_EVENT Event
+	)
+
+/*
+ Routine Description:
+
+	This routine records one more event detection of a pin.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	Event - Supplies the event to detect.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Mask;
+
+	if ((Pin < 0) || (Pin >= GPIO_PIN_COUNT) || (EVENT_NONE == Event) || (Event > NUM_OF_EVENT_REGS)) {
+		RPI_PRINT_EX(InfoLevelError, "Invalid GPIO pin %d or event %d", Pin, Event);
+		return;
+	}
+
+	Mask = 1ull << Pin;
+	m_EventDisable |= Mask;
+	m_EventEnable[Event - 1] |= Mask;
+	m_Pins |= Mask;
+	return;
+}
+
+int32_t
+GpioConfigBatch::Apply (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine programs all recorded settings. Event detection is turned
+	off first so reconfiguring the pins can't trigger it, then the function
+	selects and pulls are programmed and the events are turned back on. After
+	a single settle delay the events latched meanwhile are cleared.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - Number of pins configured.
+
+*/
+
+{
+
+	uint32_t ClearBits;
+	uint32_t Current;
+	volatile uint32_t *EventRegs[NUM_OF_EVENT_REGS];
+	int32_t Pins;
+	uint32_t SetBits;
+
+	if (0 == m_Pins) {
+		return 0;
+	}
+
+	//
+	// In the GPIO_EVENT order.
+	//
+
+	EventRegs[EVENT_RISING - 1] = GPIORegs->GPRENn;
+	EventRegs[EVENT_FALLING - 1] = GPIORegs->GPFENn;
+	EventRegs[EVENT_HIGH - 1] = GPIORegs->GPHENn;
+	EventRegs[EVENT_LOW - 1] = GPIORegs->GPLENn;
+	EventRegs[EVENT_ASYNC_RISING - 1] = GPIORegs->GPARENn;
+	EventRegs[EVENT_ASYNC_FALLING - 1] = GPIORegs->GPAFENn;
+
+	//
+	// Disable event detection, one read-modify-write per register word.
+	//
+
+	for (uint32_t Word = 0; Word < 2; Word += 1) {
+		ClearBits = static_cast<uint32_t>(m_EventDisable >> (Word * 32));
+		if (0 == ClearBits) {
+			continue;
+		}
+
+		for (uint32_t Reg = 0; Reg < NUM_OF_EVENT_REGS; Reg += 1) {
+			Current = EventRegs[Reg][Word];
+			if (0 != (Current & ClearBits)) {
+				EventRegs[Reg][Word] = Current & ~ClearBits;
+			}
+		}
+	}
+
+	UpdateFsel(m_FselMasks, m_FselValues);
+
+	//
+	// One clock-in sequence per pull mode.
+	//
+
+	for (uint32_t Pull = 0; Pull < NUM_OF_PULLS; Pull += 1) {
+		ProgramPull(static_cast<GPIO_PULL>(Pull), m_PullMasks[Pull]);
+	}
+
+	for (uint32_t Word = 0; Word < 2; Word += 1) {
+		for (uint32_t Reg = 0; Reg < NUM_OF_EVENT_REGS; Reg += 1) {
+			SetBits = static_cast<uint32_t>(m_EventEnable[Reg] >> (Word * 32));
+			if (0 != SetBits) {
+				EventRegs[Reg][Word] |= SetBits;
+			}
+		}
+	}
+
+	//
+	// Let the pins settle once for the whole batch, then clear the events
+	// latched meanwhile. GPEDSn is write 1 to clear.
+	//
+
+	usleep(SETTLE_TIME_US);
+	for (uint32_t Word = 0; Word < 2; Word += 1) {
+		ClearBits = static_cast<uint32_t>(m_EventDisable >> (Word * 32));
+		if (0 != ClearBits) {
+			GPIORegs->GPEDSn[Word] = ClearBits;
+		}
+	}
+
+	Pins = __builtin_popcountll(m_Pins);
+	RPI_PRINT_EX(InfoLevelDebug, "Configured %d pins", Pins);
+	Clear();
+	return Pins;
+}
@@ -0,0 +1,661 @@
+/*
+ * GpioDmaPwm.cpp
+ *
+ *  Created on: Feb 13, 2021
+ *      Author: Albert Guan
+ */
+#include <iostream>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <assert.h>
+#include "GpioDmaPwm.h"
+#include "Diag.h"
+
+GpioDmaPwm::GpioDmaPwm (
+	_In_ const std::vector<uint32_t> &Pins,
+	_In_ uint32_t SlotUs,
+	_In_ uint32_t Slots,
+	_In_ int32_t Channel
+	) : m_Pins(Pins),
+		m_DutyCycles(Pins.size(), 0.0f),
+		m_SlotUs(SlotUs),
+		m_Slots(Slots),
+		m_Channel(Channel),
+		m_Active(0),
+		m_LastSwapUs(0),
+		m_PCMRegisters(NULL),
+		m_ClkRegisters(NULL)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioDmaPwm. It builds both waveforms
+	with all pins low, sets up the PCM as the pacing timer and starts the DMA
+	channel.
+
+ Parameters:
+
+ 	Pins - Supplies the output pins, 0-31.
+
+ 	SlotUs - Supplies the length of a slot in microseconds.
+
+ 	Slots - Supplies the number of slots per period, i.e. the resolution.
+
+ 	Channel - Supplies the DMA channel to use.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Size;
+
+	for (auto Pin : Pins) {
+		assert(Pin < 32);
+	}
+
+	assert(SlotUs * (PCM_CLK_FREQ / 1000000) - 1 <= PCM_MAX_FLEN);
+	assert(Slots >= 2);
+
+	if (DMACtrl::GeneralInit(Channel) < 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to init DMA channel %d", Channel);
+		exit(1);
+	}
+
+	Size = GetPadOffset() + sizeof(uint32_t);
+	for (uint32_t Idx = 0; Idx < 2; Idx++) {
+		m_Waveform[Idx] = DMAMemPool::Alloc(Size);
+		if (m_Waveform[Idx] == NULL) {
+			RPI_PRINT_EX(InfoLevelError, "Failed to allocate %u bytes of waveform", Size);
+			exit(1);
+		}
+
+		BuildWaveform(Idx);
+	}
+
+	try {
+		m_PCMRegisters = const_cast<volatile PCMRegisters *>(static_cast<PCMRegisters *>(
+								MapRegisters(GPIO_PCM_PHY_ADDR, sizeof(PCMRegisters))));
+
+		if (MAP_FAILED == m_PCMRegisters) {
+			throw "Failed to mmap PCMRegisters";
+		}
+
+		m_ClkRegisters = const_cast<volatile uint32_t *>(static_cast<uint32_t *>(
+								MapRegisters(GPIO_CLK_PHY_ADDR, BLOCK_SIZE)));
+
+		if (MAP_FAILED == m_ClkRegisters) {
+			throw "Failed to mmap ClkRegisters";
+		}
+
+	} catch (const char *exp) {
+		RPI_PRINT_EX(InfoLevelError, "%s, try to run with root", exp);
+		exit(1);
+	}
+
+	//
+	// Start the chain first, it blocks on the first DREQ until the PCM runs.
+	//
+
+	DMACtrl::dma_regs->enable |= 0x1 << m_Channel;
+	ResetChannel();
+	DMACtrl::dma_regs->ch[m_Channel].cbAddr = m_Waveform[m_Active]->GetBusAddr(GetCBOffset(0, 0));
+
+	DMACtrl::DMACtrlStaus_t CS;
+	CS.word = 0;
+	CS.priority = DMACtrl::DMA_PRIORITY;
+	CS.panic_priority = DMACtrl::DMA_PANIC_PRIORITY;
+	CS.wait_for_outstanding_wt = 1;
+	CS.active = 1;
+	DMACtrl::dma_regs->ch[m_Channel].cs.word = CS.word;
+
+	StartPCM();
+	m_LastSwapUs = RpiGetTimeUs();
+	return;
+}
+
+GpioDmaPwm::~GpioDmaPwm (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioDmaPwm. All pins are driven low
+	for a period before the channel and the PCM are stopped.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	SetDutyCycles(std::vector<float>(m_Pins.size(), 0.0f));
+	usleep(2 * m_SlotUs * m_Slots);
+
+	ResetChannel();
+	StopPCM();
+
+	if (m_PCMRegisters != NULL) {
+		UnmapRegisters(m_PCMRegisters, sizeof(PCMRegisters));
+		m_PCMRegisters = NULL;
+	}
+
+	if (m_ClkRegisters != NULL) {
+		UnmapRegisters(m_ClkRegisters, BLOCK_SIZE);
+		m_ClkRegisters = NULL;
+	}
+
+	for (uint32_t Idx = 0; Idx < 2; Idx++) {
+		DMAMemPool::Free(m_Waveform[Idx]);
+		m_Waveform[Idx] = NULL;
+	}
+
+	DMACtrl::GeneralUninit(m_Channel);
+	return;
+}
+
+uint32_t
+GpioDmaPwm::GetCBOffset (
+	_In_ uint32_t Slot,
+	_In_ uint32_t Idx
+	)
+{
+	return (Slot * CBS_PER_SLOT + Idx) * sizeof(DMACtrl::DMACtrlBlock_t);
+}
+
+uint32_t
+GpioDmaPwm::GetSetMaskOffset (
+	_In_ uint32_t Slot
+	)
+{
+	return GetCBOffset(m_Slots, 0) + Slot * 2 * sizeof(uint32_t);
+}
+
+uint32_t
+GpioDmaPwm::GetClrMaskOffset (
+	_In_ uint32_t Slot
+	)
+{
+	return GetSetMaskOffset(Slot) + sizeof(uint32_t);
+}
+
+uint32_t
+GpioDmaPwm::GetPadOffset (
+	void
+	)
+{
+	return GetSetMaskOffset(m_Slots);
+}
+
+void
+GpioDmaPwm::BuildWaveform (
+	_In_ uint32_t Idx
+	)
+
+/*
+ Routine Description:
+
+	This routine builds the CB chain of a waveform, it loops back to itself.
+	The CBs never change afterwards, only the masks do.
+
+ Parameters:
+
+ 	Idx - Supplies the waveform to build.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	DMABuffer *Waveform = m_Waveform[Idx];
+	volatile uint8_t *Base = static_cast<volatile uint8_t *>(Waveform->GetVirtAddr());
+	volatile DMACtrl::DMACtrlBlock_t *CB;
+	uint32_t Next;
+
+	for (uint32_t Slot = 0; Slot < m_Slots; Slot++) {
+		for (uint32_t i = 0; i < CBS_PER_SLOT; i++) {
+			CB = reinterpret_cast<volatile DMACtrl::DMACtrlBlock_t *>(Base + GetCBOffset(Slot, i));
+			CB->transInfo.word = 0;
+			CB->transInfo.no_wide_bursts = 1;
+			CB->transInfo.wait_resp = 1;
+			CB->transLen.word = sizeof(uint32_t);
+			CB->stride.word = 0;
+
+			switch (i) {
+			case 0:
+				CB->srcAddr = Waveform->GetBusAddr(GetSetMaskOffset(Slot));
+				CB->destAddr = GPSET0_BUS_ADDR;
+				break;
+
+			case 1:
+				CB->srcAddr = Waveform->GetBusAddr(GetClrMaskOffset(Slot));
+				CB->destAddr = GPCLR0_BUS_ADDR;
+				break;
+
+			default:
+
+				//
+				// Blocks until the PCM takes a word, once per slot.
+				//
+
+				CB->transInfo.dest_dreq = 1;
+				CB->transInfo.premap = DMACtrl::PCM_TX;
+				CB->srcAddr = Waveform->GetBusAddr(GetPadOffset());
+				CB->destAddr = PCM_FIFO_BUS_ADDR;
+				break;
+			}
+
+			Next = Slot * CBS_PER_SLOT + i + 1;
+			if (Next == m_Slots * CBS_PER_SLOT) {
+				Next = 0;
+			}
+
+			CB->nextCB = Waveform->GetBusAddr(Next * sizeof(DMACtrl::DMACtrlBlock_t));
+		}
+	}
+
+	*reinterpret_cast<volatile uint32_t *>(Base + GetPadOffset()) = 0;
+	BuildMasks(Idx);
+	return;
+}
+
+void
+GpioDmaPwm::BuildMasks (
+	_In_ uint32_t Idx
+	)
+
+/*
+ Routine Description:
+
+	This routine writes the set/clear masks of a waveform from the current
+	duty cycles. A pin is set in slot 0 and cleared in the slot its duty
+	cycle ends, 0% is never set and 100% is never cleared.
+
+ Parameters:
+
+ 	Idx - Supplies the waveform to update, the engine must not be running it.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	volatile uint8_t *Base = static_cast<volatile uint8_t *>(m_Waveform[Idx]->GetVirtAddr());
+	std::vector<uint32_t> SetMasks(m_Slots, 0);
+	std::vector<uint32_t> ClrMasks(m_Slots, 0);
+	uint32_t OffSlot;
+
+	for (uint32_t i = 0; i < m_Pins.size(); i++) {
+		OffSlot = static_cast<uint32_t>(m_DutyCycles[i] * m_Slots + 0.5f);
+		if (OffSlot > 0) {
+			SetMasks[0] |= 0x1 << m_Pins[i];
+		}
+
+		if (OffSlot < m_Slots) {
+			ClrMasks[OffSlot] |= 0x1 << m_Pins[i];
+		}
+	}
+
+	for (uint32_t Slot = 0; Slot < m_Slots; Slot++) {
+		*reinterpret_cast<volatile uint32_t *>(Base + GetSetMaskOffset(Slot)) = SetMasks[Slot];
+		*reinterpret_cast<volatile uint32_t *>(Base + GetClrMaskOffset(Slot)) = ClrMasks[Slot];
+	}
+
+	return;
+}
+
+int32_t
+GpioDmaPwm::IsRunning (
+	_In_ uint32_t Idx
+	)
+
+/*
+ Routine Description:
+
+	This routine tells whether the engine executes a CB of a waveform, from
+	the CB address of the channel (CONBLK_AD). The CBs may span pages, so the
+	address is looked up in the segments of the buffer.
+
+ Parameters:
+
+ 	Idx - Supplies the waveform.
+
+ Return Value:
+
+	int32_t - 1 if the current CB belongs to the waveform, 0 otherwise.
+
+*/
+
+{
+
+	uint32_t CBAddr = DMACtrl::dma_regs->ch[m_Channel].cbAddr;
+	uint32_t CBEnd = GetCBOffset(m_Slots, 0);
+
+	for (auto &Segment : m_Waveform[Idx]->GetSegments()) {
+		if ((CBAddr >= Segment.BusAddr) && (CBAddr - Segment.BusAddr < Segment.Len)) {
+			return (Segment.Offset + (CBAddr - Segment.BusAddr) < CBEnd) ? 1 : 0;
+		}
+	}
+
+	return 0;
+}
+
+int32_t
+GpioDmaPwm::SwapWaveform (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine rebuilds the idle waveform and links the running one to it.
+	The engine leaves the running waveform at the end of the current period.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if the engine doesn't reach the running
+		waveform, the change then goes out with the next swap.
+
+*/
+
+{
+
+	uint32_t Idle = 1 - m_Active;
+	uint64_t PeriodUs = m_SlotUs * m_Slots;
+	uint64_t Elapsed;
+	volatile uint8_t *Base;
+	volatile DMACtrl::DMACtrlBlock_t *Last;
+	uint32_t Periods;
+
+	//
+	// The idle waveform was the running one before the last swap, the engine
+	// normally left it within a period. But if it had already loaded the link
+	// of the last CB when the swap patched it, it runs the old waveform once
+	// more. So wait until the channel runs a CB of the active waveform, or
+	// doesn't run at all.
+	//
+
+	Elapsed = RpiGetTimeUs() - m_LastSwapUs;
+	if (Elapsed < PeriodUs) {
+		usleep(PeriodUs - Elapsed);
+	}
+
+	for (Periods = 0;
+		 DMACtrl::dma_regs->ch[m_Channel].cs.active && (0 == IsRunning(m_Active));
+		 Periods++) {
+
+		if (Periods == SWAP_MAX_PERIODS) {
+			RPI_PRINT_EX(InfoLevelError, "DMA channel %d doesn't reach the running waveform", m_Channel);
+			return -1;
+		}
+
+		usleep(PeriodUs);
+	}
+
+	//
+	// Close the loop of the idle waveform again, then rebuild its masks.
+	//
+
+	Base = static_cast<volatile uint8_t *>(m_Waveform[Idle]->GetVirtAddr());
+	Last = reinterpret_cast<volatile DMACtrl::DMACtrlBlock_t *>(
+				Base + GetCBOffset(m_Slots - 1, CBS_PER_SLOT - 1));
+
+	Last->nextCB = m_Waveform[Idle]->GetBusAddr(GetCBOffset(0, 0));
+	BuildMasks(Idle);
+
+	//
+	// One word switches the engine over.
+	//
+
+	Base = static_cast<volatile uint8_t *>(m_Waveform[m_Active]->GetVirtAddr());
+	Last = reinterpret_cast<volatile DMACtrl::DMACtrlBlock_t *>(
+				Base + GetCBOffset(m_Slots - 1, CBS_PER_SLOT - 1));
+
+	__sync_synchronize();
+	Last->nextCB = m_Waveform[Idle]->GetBusAddr(GetCBOffset(0, 0));
+
+	m_Active = Idle;
+	m_LastSwapUs = RpiGetTimeUs();
+	return 0;
+}
+
+int32_t
+GpioDmaPwm::SetDutyCycle (
+	_In_ uint32_t Pin,
+	_In_ float DutyCycle
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the duty cycle of a pin.
+
+ Parameters:
+
+ 	Pin - Supplies the pin.
+
+ 	DutyCycle - Supplies the duty cycle, 0.0 to 1.0.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if the pin isn't driven by this instance or the
+		swap failed.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_Lock);
+
+	assert(DutyCycle >= 0.0f && DutyCycle <= 1.0f);
+	for (uint32_t i = 0; i < m_Pins.size(); i++) {
+		if (m_Pins[i] == Pin) {
+			if (m_DutyCycles[i] != DutyCycle) {
+				m_DutyCycles[i] = DutyCycle;
+				return SwapWaveform();
+			}
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int32_t
+GpioDmaPwm::SetDutyCycles (
+	_In_ const std::vector<float> &DutyCycles
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the duty cycles of all pins with one swap.
+
+ Parameters:
+
+ 	DutyCycles - Supplies the duty cycles, in the order of the pins.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if the number of duty cycles is wrong or the
+		swap failed.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_Lock);
+
+	if (DutyCycles.size() != m_Pins.size()) {
+		return -1;
+	}
+
+	for (auto DutyCycle : DutyCycles) {
+		assert(DutyCycle >= 0.0f && DutyCycle <= 1.0f);
+	}
+
+	if (DutyCycles != m_DutyCycles) {
+		m_DutyCycles = DutyCycles;
+		return SwapWaveform();
+	}
+
+	return 0;
+}
+
+float
+GpioDmaPwm::GetFrequency (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the PWM frequency.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	float - Supplies the frequency in Hz.
+
+*/
+
+{
+
+	return 1000000.0f / (m_SlotUs * m_Slots);
+}
+
+void
+GpioDmaPwm::StartPCM (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine clocks the PCM at 10MHz and sets its frame to one slot, so
+	it takes one word from the TX FIFO, and raises DREQ, once per slot.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	volatile uint32_t *CM_PCMCTL = m_ClkRegisters + (CM_PCMCTL_OFFSET >> 2);
+	volatile uint32_t *CM_PCMDIV = m_ClkRegisters + (CM_PCMDIV_OFFSET >> 2);
+
+	m_PCMRegisters->CS = PCM_CS_EN;
+	usleep(100);
+
+	//
+	// Stop the clock and wait for !BUSY before changing the divisor, then
+	// run it from PLLD.
+	//
+
+	*CM_PCMCTL = BCM_PASSWORD | 0x06;
+	usleep(100);
+	while ((*CM_PCMCTL & 0x80) != 0) {
+		usleep(1);
+	}
+
+	*CM_PCMDIV = BCM_PASSWORD | ((RPI_PLLD_FREQ / PCM_CLK_FREQ) << 12);
+	*CM_PCMCTL = BCM_PASSWORD | 0x16;
+	usleep(100);
+
+	m_PCMRegisters->TXC = PCM_TXC_CH1EN;
+	m_PCMRegisters->MODE = (m_SlotUs * (PCM_CLK_FREQ / 1000000) - 1) << PCM_MODE_FLEN_SHIFT;
+	m_PCMRegisters->CS |= PCM_CS_TXCLR | PCM_CS_RXCLR;
+	usleep(100);
+
+	//
+	// TX DREQ when the FIFO has room, TX panic at the same level.
+	//
+
+	m_PCMRegisters->DREQ = (64 << 24) | (64 << 8);
+	m_PCMRegisters->CS |= PCM_CS_DMAEN;
+	usleep(100);
+	m_PCMRegisters->CS |= PCM_CS_TXON;
+	return;
+}
+
+void
+GpioDmaPwm::StopPCM (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine stops the PCM and its clock.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if ((m_PCMRegisters == NULL) || (m_ClkRegisters == NULL)) {
+		return;
+	}
+
+	m_PCMRegisters->CS = 0;
+	*(m_ClkRegisters + (CM_PCMCTL_OFFSET >> 2)) = BCM_PASSWORD | 0x06;
+	return;
+}
+
+void
+GpioDmaPwm::ResetChannel (
+	void
+	)
+{
+	DMACtrl::DMACtrlStaus_t CS;
+
+	CS.word = 0;
+	CS.abort = 1;
+	DMACtrl::dma_regs->ch[m_Channel].cs.word = CS.word;
+	CS.word = 0;
+	CS.reset = 1;
+	DMACtrl::dma_regs->ch[m_Channel].cs.word = CS.word;
+	DMACtrl::dma_regs->ch[m_Channel].debug.word = 0x7;
+	CS.word = 0;
+	CS.end = 1;
+	CS.int_status = 1;
+	DMACtrl::dma_regs->ch[m_Channel].cs.word = CS.word;
+}
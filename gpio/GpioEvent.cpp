@@ -0,0 +1,855 @@
+/*
+ * GpioEvent.cpp
+ *
+ *  Created on: Mar 20, 2021
+ *      Author: Albert Guan
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "Diag.h"
+#include "GpioEvent.h"
+
+GpioChipEventSource::GpioChipEventSource (
+	_In_ const char *Chip
+	)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioChipEventSource, it opens the GPIO
+	character device.
+
+ Parameters:
+
+ 	Chip - Supplies the path of the GPIO character device.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_ChipFd = open(Chip, O_RDONLY | O_CLOEXEC);
+	if (m_ChipFd < 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to open %s: %s", Chip, strerror(errno));
+	}
+
+	return;
+}
+
+GpioChipEventSource::~GpioChipEventSource (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioChipEventSource. Lines still
+	requested are released by their owners.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if (m_ChipFd >= 0) {
+		close(m_ChipFd);
+		m_ChipFd = -1;
+	}
+
+	return;
+}
+
+int32_t
+GpioChipEventSource::Request (
+	_In_ int32_t Pin,
+	_In_ GPIO_EDGE Edges
+	)
+
+/*
+ Routine Description:
+
+	This routine requests a line of the GPIO chip as an input with edge
+	detection. The kernel sets up the GPIO interrupt and queues a timestamped
+	event on the returned descriptor for each edge.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin, which is the line offset of gpiochip0.
+
+ 	Edges - Supplies the edges to detect.
+
+ Return Value:
+
+	int32_t - Line event descriptor, or -1 on failure.
+
+*/
+
+{
+
+	struct gpioevent_request Req;
+
+	if (m_ChipFd < 0) {
+		return -1;
+	}
+
+	memset(&Req, 0, sizeof(Req));
+	Req.lineoffset = Pin;
+	Req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	Req.eventflags = 0;
+	if (0 != (Edges & EDGE_RISING)) {
+		Req.eventflags |= GPIOEVENT_REQUEST_RISING_EDGE;
+	}
+
+	if (0 != (Edges & EDGE_FALLING)) {
+		Req.eventflags |= GPIOEVENT_REQUEST_FALLING_EDGE;
+	}
+
+	strncpy(Req.consumer_label, "AlphaBot", sizeof(Req.consumer_label) - 1);
+	if (ioctl(m_ChipFd, GPIO_GET_LINEEVENT_IOCTL, &Req) < 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to request GPIO %d events: %s", Pin, strerror(errno));
+		return -1;
+	}
+
+	//
+	// Non-blocking like the pipes of the fake source. After an unsubscribe,
+	// epoll may still report the number of the closed descriptor, reused by
+	// a new line, and a blocking read would stall the event thread with the
+	// lock held. A read without an event just fails (EAGAIN).
+	//
+
+	if (fcntl(Req.fd, F_SETFL, fcntl(Req.fd, F_GETFL) | O_NONBLOCK) < 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to make GPIO %d events non-blocking: %s", Pin, strerror(errno));
+		close(Req.fd);
+		return -1;
+	}
+
+	return Req.fd;
+}
+
+int32_t
+GpioChipEventSource::Read (
+	_In_ int32_t Fd,
+	_In_ int32_t Pin,
+	_Out_ GpioEventRecord &Event
+	)
+
+/*
+ Routine Description:
+
+	This routine reads one edge event of a line.
+
+ Parameters:
+
+ 	Fd - Supplies the line event descriptor.
+
+ 	Pin - Supplies the GPIO pin of the line.
+
+ 	Event - Supplies the record to fill.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS, or ERROR_SYSTEM_CALL if no event could be read,
+		including when none is pending.
+
+*/
+
+{
+
+	struct gpioevent_data Data;
+
+	if (sizeof(Data) != read(Fd, &Data, sizeof(Data))) {
+		return ERROR_SYSTEM_CALL;
+	}
+
+	Event.Pin = Pin;
+	Event.Edge = (GPIOEVENT_EVENT_RISING_EDGE == Data.id) ? EDGE_RISING : EDGE_FALLING;
+	Event.TimestampNs = Data.timestamp;
+	return ERROR_SUCCESS;
+}
+
+void
+GpioChipEventSource::Release (
+	_In_ int32_t Fd
+	)
+
+/*
+ Routine Description:
+
+	This routine releases a line, the kernel stops detecting its edges.
+
+ Parameters:
+
+ 	Fd - Supplies the line event descriptor.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	close(Fd);
+	return;
+}
+
+GpioFakeEventSource::GpioFakeEventSource (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioFakeEventSource.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	return;
+}
+
+GpioFakeEventSource::~GpioFakeEventSource (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioFakeEventSource, it closes the write
+	ends of the pipes. The read ends belong to whoever requested them.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	for (auto &Line : m_Lines) {
+		close(Line.second.WriteFd);
+	}
+
+	m_Lines.clear();
+	return;
+}
+
+int32_t
+GpioFakeEventSource::Request (
+	_In_ int32_t Pin,
+	_In_ GPIO_EDGE Edges
+	)
+
+/*
+ Routine Description:
+
+	This routine creates a pipe standing for the line of a pin.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	Edges - Supplies the edges Inject lets through.
+
+ Return Value:
+
+	int32_t - Read end of the pipe, or -1 on failure.
+
+*/
+
+{
+
+	int Fds[2];
+	std::lock_guard<std::mutex> Lock(m_Lock);
+
+	if (m_Lines.end() != m_Lines.find(Pin)) {
+		return -1;
+	}
+
+	if (pipe2(Fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+		return -1;
+	}
+
+	m_Lines[Pin] = FakeLine{Fds[0], Fds[1], Edges};
+	return Fds[0];
+}
+
+int32_t
+GpioFakeEventSource::Read (
+	_In_ int32_t Fd,
+	_In_ int32_t Pin,
+	_Out_ GpioEventRecord &Event
+	)
+
+/*
+ Routine Description:
+
+	This routine reads one injected edge.
+
+ Parameters:
+
+ 	Fd - Supplies the read end of the pipe.
+
+ 	Pin - Supplies the GPIO pin of the pipe.
+
+ 	Event - Supplies the record to fill.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS, or ERROR_SYSTEM_CALL if no edge could be read.
+
+*/
+
+{
+
+	if (sizeof(Event) != read(Fd, &Event, sizeof(Event))) {
+		return ERROR_SYSTEM_CALL;
+	}
+
+	Event.Pin = Pin;
+	return ERROR_SUCCESS;
+}
+
+void
+GpioFakeEventSource::Release (
+	_In_ int32_t Fd
+	)
+
+/*
+ Routine Description:
+
+	This routine closes the pipe of a line.
+
+ Parameters:
+
+ 	Fd - Supplies the read end of the pipe.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Lock(m_Lock);
+
+	for (auto Line = m_Lines.begin(); Line != m_Lines.end(); ++Line) {
+		if (Line->second.ReadFd == Fd) {
+			close(Line->second.WriteFd);
+			m_Lines.erase(Line);
+			break;
+		}
+	}
+
+	close(Fd);
+	return;
+}
+
+int32_t
+GpioFakeEventSource::Inject (
+	_In_ int32_t Pin,
+	_In_ GPIO_EDGE Edge,
+	_In_ uint64_t TimestampNs
+	)
+
+/*
+ Routine Description:
+
+	This routine queues an edge of a pin as if the hardware detected it.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	Edge - Supplies EDGE_RISING or EDGE_FALLING.
+
+ 	TimestampNs - Supplies the time of the edge, 0 for now.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS if queued, ERROR_PENDING if the pin doesn't detect
+		this edge, or an error.
+
+*/
+
+{
+
+	GpioEventRecord Event;
+	std::lock_guard<std::mutex> Lock(m_Lock);
+	auto Line = m_Lines.find(Pin);
+
+	if ((m_Lines.end() == Line) || ((EDGE_RISING != Edge) && (EDGE_FALLING != Edge))) {
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	if (0 == (Line->second.Edges & Edge)) {
+		return ERROR_PENDING;
+	}
+
+	Event.Pin = Pin;
+	Event.Edge = Edge;
+	Event.TimestampNs = (0 != TimestampNs) ? TimestampNs : RpiGetTimeNs();
+	Event.DispatchNs = 0;
+	if (sizeof(Event) != write(Line->second.WriteFd, &Event, sizeof(Event))) {
+		return ERROR_SYSTEM_CALL;
+	}
+
+	return ERROR_SUCCESS;
+}
+
+GpioEventEngine::GpioEventEngine (
+	_In_ GpioEventSource &Source
+	) : m_Source(Source),
+		m_MaxLatencyNs(0),
+		m_EventCount(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioEventEngine, it creates the epoll
+	instance and the stop eventfd.
+
+ Parameters:
+
+ 	Source - Supplies where the edges come from.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	struct epoll_event Ev;
+
+	m_EpollFd = epoll_create1(EPOLL_CLOEXEC);
+	m_StopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ((m_EpollFd < 0) || (m_StopFd < 0)) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to create epoll: %s", strerror(errno));
+		return;
+	}
+
+	memset(&Ev, 0, sizeof(Ev));
+	Ev.events = EPOLLIN;
+	Ev.data.fd = m_StopFd;
+	epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, m_StopFd, &Ev);
+	return;
+}
+
+GpioEventEngine::~GpioEventEngine (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioEventEngine, it stops the thread and
+	releases all lines.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Stop();
+	for (auto &Sub : m_Subscriptions) {
+		m_Source.Release(Sub.first);
+	}
+
+	m_Subscriptions.clear();
+	if (m_StopFd >= 0) {
+		close(m_StopFd);
+	}
+
+	if (m_EpollFd >= 0) {
+		close(m_EpollFd);
+	}
+
+	return;
+}
+
+int32_t
+GpioEventEngine::Subscribe (
+	_In_ int32_t Pin,
+	_In_ GPIO_EDGE Edges,
+	_In_ GpioEventHandler Handler
+	)
+
+/*
+ Routine Description:
+
+	This routine requests edge detection of a pin and adds it to the epoll
+	set.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ 	Edges - Supplies the edges to deliver.
+
+ 	Handler - Supplies the routine called for each edge.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS, or an error.
+
+*/
+
+{
+
+	struct epoll_event Ev;
+	int32_t Fd;
+	std::lock_guard<std::mutex> Lock(m_Lock);
+
+	if ((m_EpollFd < 0) || (0 == (Edges & EDGE_BOTH)) || !Handler) {
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	for (auto &Sub : m_Subscriptions) {
+		if (Sub.second.Pin == Pin) {
+			return ERROR_CHANNEL_OCCUPIED;
+		}
+	}
+
+	Fd = m_Source.Request(Pin, Edges);
+	if (Fd < 0) {
+		return ERROR_SYSTEM_CALL;
+	}
+
+	memset(&Ev, 0, sizeof(Ev));
+	Ev.events = EPOLLIN;
+	Ev.data.fd = Fd;
+	if (epoll_ctl(m_EpollFd, EPOLL_CTL_ADD, Fd, &Ev) < 0) {
+		m_Source.Release(Fd);
+		return ERROR_SYSTEM_CALL;
+	}
+
+	m_Subscriptions[Fd] = Subscription{Pin, Handler};
+	return ERROR_SUCCESS;
+}
+
+int32_t
+GpioEventEngine::Unsubscribe (
+	_In_ int32_t Pin
+	)
+
+/*
+ Routine Description:
+
+	This routine stops delivering the edges of a pin and releases its line.
+
+ Parameters:
+
+ 	Pin - Supplies the GPIO pin.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS, or ERROR_INVALID_PARAMETER if not subscribed.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Lock(m_Lock);
+
+	for (auto Sub = m_Subscriptions.begin(); Sub != m_Subscriptions.end(); ++Sub) {
+		if (Sub->second.Pin == Pin) {
+			epoll_ctl(m_EpollFd, EPOLL_CTL_DEL, Sub->first, NULL);
+			m_Source.Release(Sub->first);
+			m_Subscriptions.erase(Sub);
+			return ERROR_SUCCESS;
+		}
+	}
+
+	return ERROR_INVALID_PARAMETER;
+}
+
+int32_t
+GpioEventEngine::Start (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine starts the engine thread.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS, or ERROR_INVALID_PARAMETER if the engine isn't
+		usable or already runs.
+
+*/
+
+{
+
+	if ((m_EpollFd < 0) || (m_StopFd < 0) || m_Thread.joinable()) {
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	m_Thread = std::thread(&GpioEventEngine::EventThread, this);
+	return ERROR_SUCCESS;
+}
+
+void
+GpioEventEngine::Stop (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine wakes the engine thread up through the stop eventfd and
+	waits for it to exit. Subscriptions are kept, so the engine can be
+	started again.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t One = 1;
+	uint64_t Drain;
+
+	if (!m_Thread.joinable()) {
+		return;
+	}
+
+	if (sizeof(One) != write(m_StopFd, &One, sizeof(One))) {
+		RPI_PRINT(InfoLevelError, "Failed to signal the event thread");
+	}
+
+	m_Thread.join();
+	if (sizeof(Drain) != read(m_StopFd, &Drain, sizeof(Drain))) {
+		Drain = 0;
+	}
+
+	return;
+}
+
+uint64_t
+GpioEventEngine::GetMaxLatencyNs (
+	void
+)
+{
+	return m_MaxLatencyNs.load();
+}
+
+uint64_t
+GpioEventEngine::GetEventCount (
+	void
+)
+{
+	return m_EventCount.load();
+}
+
+void
+GpioEventEngine::EventThread (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the engine thread. It sleeps in epoll_wait until a line
+	has pending edges or Stop is called, then reads every pending edge and
+	calls the handler of its pin.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	struct epoll_event Events[MAX_EVENTS_PER_WAIT];
+	GpioEventRecord Event;
+	int32_t Fd;
+	uint64_t Latency;
+	int32_t Ready;
+
+	while (1) {
+		Ready = epoll_wait(m_EpollFd, Events, MAX_EVENTS_PER_WAIT, -1);
+		if (Ready < 0) {
+			if (EINTR == errno) {
+				continue;
+			}
+
+			RPI_PRINT_EX(InfoLevelError, "epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (int32_t i = 0; i < Ready; i++) {
+			Fd = Events[i].data.fd;
+			if (m_StopFd == Fd) {
+				return;
+			}
+
+			//
+			// The lock keeps the subscription alive while its handler runs.
+			// The line may have been unsubscribed after epoll_wait returned.
+			//
+
+			std::lock_guard<std::mutex> Lock(m_Lock);
+			auto Sub = m_Subscriptions.find(Fd);
+			if (m_Subscriptions.end() == Sub) {
+				continue;
+			}
+
+			if (ERROR_SUCCESS != m_Source.Read(Fd, Sub->second.Pin, Event)) {
+				continue;
+			}
+
+			Event.DispatchNs = RpiGetTimeNs();
+
+			//
+			// A timestamp ahead of the monotonic clock is CLOCK_REALTIME from
+			// an older kernel, there's no latency to get from it.
+			//
+
+			if (Event.TimestampNs <= Event.DispatchNs) {
+				Latency = Event.DispatchNs - Event.TimestampNs;
+				if (Latency > m_MaxLatencyNs.load()) {
+					m_MaxLatencyNs.store(Latency);
+				}
+			}
+
+			m_EventCount.fetch_add(1);
+			Sub->second.Handler(Event);
+		}
+	}
+
+	return;
+}
+
+void
+GpioEventDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine. It first drives the engine with fake edges to
+	check the dispatching, then reports the joystick buttons from the kernel
+	GPIO interrupts.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	const int32_t Buttons[] = {8, 9, 10, 11, 7};
+	const char *Names[] = {"Front", "Right", "Left", "Reverse", "Center"};
+	std::atomic<uint32_t> Delivered(0);
+
+	auto Print = [](const char *Name, const GpioEventRecord &Event) {
+		RPI_PRINT_EX(InfoLevelInfo,
+					 "%s %s, dispatched %llu ns after the edge",
+					 Name,
+					 (EDGE_FALLING == Event.Edge) ? "pressed" : "released",
+					 Event.DispatchNs - Event.TimestampNs);
+	};
+
+	{
+		GpioFakeEventSource Fake;
+		GpioEventEngine Engine(Fake);
+
+		Engine.Subscribe(Buttons[0], EDGE_FALLING, [&Delivered](const GpioEventRecord &) {
+			Delivered += 1;
+		});
+
+		Engine.Start();
+		for (uint32_t i = 0; i < 100; i++) {
+			Fake.Inject(Buttons[0], EDGE_FALLING);
+			Fake.Inject(Buttons[0], EDGE_RISING);		// Not requested, dropped
+		}
+
+		usleep(100000);
+		Engine.Stop();
+		RPI_PRINT_EX(InfoLevelInfo,
+					 "Fake source: %u of 100 edges delivered, max latency %llu ns",
+					 Delivered.load(),
+					 Engine.GetMaxLatencyNs());
+	}
+
+	GpioChipEventSource Chip;
+	GpioEventEngine Engine(Chip);
+
+	for (uint32_t i = 0; i < sizeof(Buttons) / sizeof(Buttons[0]); i++) {
+		const char *Name = Names[i];
+		Engine.Subscribe(Buttons[i], EDGE_BOTH, [Name, &Print](const GpioEventRecord &Event) {
+			Print(Name, Event);
+		});
+	}
+
+	Engine.Start();
+	while (1) {
+		sleep(1);
+	}
+
+	return;
+}
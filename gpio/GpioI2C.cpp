@@ -14,7 +14,9 @@
 #include <bitset>
 #include <assert.h>
 #include <exception>
+#include <time.h>
 #include "GpioI2C.h"
+#include "Diag.h"
 
 const uint32_t GpioI2C::GPIO_I2C_PHY_ADDR[2] = {
 	PERIPHERAL_PHY_BASE + GPIO_I2C0_OFFSET,
@@ -31,7 +33,9 @@ GpioI2C::GpioI2C (
 	_In_ int32_t PinSda,
 	_In_ int32_t PinScl
 ) : GpioBase({PinSda, PinScl},
-			 GetPinSelection(PinSda, PinScl))
+			 GetPinSelection(PinSda, PinScl)),
+	m_I2CRegisters(NULL),
+	m_StopWorker(false)
 
 /*
  Routine Description:
@@ -71,12 +75,7 @@ GpioI2C::GpioI2C (
 	try	{
 		m_I2CRegisters =
 			const_cast<volatile I2CRegisters *>(static_cast<I2CRegisters *>(
-						mmap(NULL,
-							 sizeof(I2CRegisters),
-							 (PROT_READ | PROT_WRITE),
-							 MAP_SHARED,
-							 mem_fd,
-							 GPIO_I2C_PHY_ADDR[m_I2CChannelId])));
+						MapRegisters(GPIO_I2C_PHY_ADDR[m_I2CChannelId], sizeof(I2CRegisters))));
 
 		if (MAP_FAILED == m_I2CRegisters)
 			throw "Failed to map m_I2CRegisters channel " + std::to_string(m_I2CChannelId);
@@ -126,6 +125,20 @@ GpioI2C::~GpioI2C (
 
 {
 
+	//
+	//Stop the async worker, pending transactions are failed
+	//
+
+	{
+		std::lock_guard<std::mutex> Guard(m_QueueLock);
+		m_StopWorker = true;
+	}
+
+	m_QueueCond.notify_all();
+	if (m_Worker.joinable()) {
+		m_Worker.join();
+	}
+
 	//
 	//Disable the I2C
 	//
@@ -139,7 +152,7 @@ GpioI2C::~GpioI2C (
 	ClearFIFO();
 
 	if (m_I2CRegisters) {
-		munmap(static_cast<void *>(const_cast<I2CRegisters *>(m_I2CRegisters)), sizeof(I2CRegisters));
+		UnmapRegisters(m_I2CRegisters, sizeof(I2CRegisters));
 		m_I2CRegisters = NULL;
 	}
 
@@ -379,7 +392,9 @@ GpioI2C::read (
 /*
  Routine Description:
 
-	This routine reads data from the channel.
+	This routine reads data from the channel. The register address is written
+	first, then Len bytes are read. It runs the same state machine as the
+	async path, so a NACK or a stuck bus fails it instead of hanging.
 
  Parameters:
 
@@ -389,44 +404,33 @@ GpioI2C::read (
 
  	Values - Supplies the value read from I2C slave.
 
- 	Len - ?
+ 	Len - Supplies the number of bytes to read.
 
  Return Value:
 
-	int32_t - Not used, always 0.
+	int16_t - Number of bytes read, -1 if the transaction failed.
 
 */
 
 {
 
-	int16_t BytesReceived = 0;
+	I2CTransaction Txn;
+	std::lock_guard<std::recursive_mutex> Guard(m_BusLock);
 
 	assert(Values != NULL);
 	assert(m_I2CRegisters != NULL);
 
-	RPI_PRINT_EX(InfoLevelDebug, "0x%p", m_I2CRegisters);
-
-	if (1 == write(Addr, Reg)) {
-
-		RPI_PRINT_EX(InfoLevelDebug, "Assign Address: %d\n", Addr);
-		m_I2CRegisters->A.ADDR = Addr;
-		RPI_PRINT_EX(InfoLevelDebug, "Assign Length: %d\n", Len);
-		m_I2CRegisters->DLEN.DLEN = Len;
-		UpdateReadCtrl();
-		UpdateStatus();
-
-		while (BytesReceived < Len) {
-			while (m_I2CRegisters->S.RXD && BytesReceived < Len) {
-				Values[BytesReceived] = m_I2CRegisters->FIFO;
-				BytesReceived += 1;
-			}
-		}
+	PrepareTransaction(Txn, Addr, {Reg}, Values, Len, 0);
+	StartTransaction(Txn);
+	while (0 == StepTransaction(Txn));
 
-		RPI_PRINT(InfoLevelDebug, "Got all\n");
-		while (0 == m_I2CRegisters->S.DONE);
+	if (ERROR_SUCCESS != Txn.m_Status) {
+		RPI_PRINT_EX(InfoLevelWarning, "I2C read from 0x%02x failed, 0x%08x", Addr, Txn.m_Status);
+		return -1;
 	}
 
-	return 0;
+	RPI_PRINT(InfoLevelDebug, "Got all\n");
+	return Txn.m_Received;
 }
 
 int16_t
@@ -491,7 +495,8 @@ GpioI2C::write (
 /*
  Routine Description:
 
-	This routine writes a vector of bytes to the channel.
+	This routine writes a vector of bytes to the channel. Like read, it's
+	bounded by a deadline and fails on NACK or clock stretch timeout.
 
  Parameters:
 
@@ -501,34 +506,28 @@ GpioI2C::write (
 
  Return Value:
 
-	int32_t - Number of bytes wrote to the channel.
+	int16_t - Number of bytes wrote to the channel, -1 if the transaction
+		failed.
 
 */
 
 {
 
-	int16_t Len = Values.size();
-	int16_t sent = 0;
-
-	m_I2CRegisters->A.ADDR = Addr;
-	m_I2CRegisters->DLEN.DLEN = Len;
-	RPI_PRINT_EX(InfoLevelDebug, "I2C write %d bytes to %0x08u", Len, Addr);
-	UpdateStatus();
-	UpdateWriteCtrl();
-	while (sent < Len) {
-		if (1 == m_I2CRegisters->S.TXD) {
-			m_I2CRegisters->FIFO = Values[sent];
-			sent += 1;
-		}
-	}
-
-	RPI_PRINT_EX(InfoLevelDebug, "%d bytes of data written to  FIFO", sent);
+	I2CTransaction Txn;
+	std::lock_guard<std::recursive_mutex> Guard(m_BusLock);
 
-	while (0 == m_I2CRegisters->S.DONE);
+	RPI_PRINT_EX(InfoLevelDebug, "I2C write %d bytes to 0x%02x", static_cast<int32_t>(Values.size()), Addr);
+	PrepareTransaction(Txn, Addr, Values, NULL, 0, 0);
+	StartTransaction(Txn);
+	while (0 == StepTransaction(Txn));
 
-	RPI_PRINT_EX(InfoLevelDebug, "I2C write finished,  %d bytes of data sent", sent);
+	if (ERROR_SUCCESS != Txn.m_Status) {
+		RPI_PRINT_EX(InfoLevelWarning, "I2C write to 0x%02x failed, 0x%08x", Addr, Txn.m_Status);
+		return -1;
+	}
 
-	return sent;
+	RPI_PRINT_EX(InfoLevelDebug, "I2C write finished,  %d bytes of data sent", Txn.m_Sent);
+	return Txn.m_Sent;
 }
 
 void
@@ -583,3 +582,789 @@ GpioI2C::ClearFIFO (
 	return;
 }
 
+
+int32_t
+GpioI2C::I2CTransaction::IsDone (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine checks if the transaction has finished, successfully or not.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 1 if done, 0 otherwise.
+
+*/
+
+{
+
+	return m_Done.load(std::memory_order_acquire);
+}
+
+int32_t
+GpioI2C::I2CTransaction::GetStatus (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the status of the transaction.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - ERROR_PENDING if it isn't done yet, ERROR_SUCCESS, or one of
+		ERROR_I2C_NACK, ERROR_I2C_CLOCK_STRETCH, ERROR_TIMEOUT, ERROR_ABORTED.
+
+*/
+
+{
+
+	return IsDone() ? m_Status : ERROR_PENDING;
+}
+
+int16_t
+GpioI2C::I2CTransaction::GetResult (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the number of bytes written (write) or read (read).
+	A failed transaction returns the bytes moved before the failure.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int16_t - Number of bytes, -1 if it isn't done yet.
+
+*/
+
+{
+
+	if (!IsDone()) {
+		return -1;
+	}
+
+	return (m_RxLen > 0) ? m_Received : m_Sent;
+}
+
+uint64_t
+GpioI2C::I2CTransaction::GetLatencyUs (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the time from the submission to the completion,
+	including the time spent in the queue.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint64_t - Latency in microseconds, 0 if it isn't done yet.
+
+*/
+
+{
+
+	return IsDone() ? (m_DoneUs - m_SubmitUs) : 0;
+}
+
+uint64_t
+GpioI2C::I2CTransaction::GetBusTimeUs (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the time the transaction owned the bus.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint64_t - Time in microseconds, 0 if it isn't done or never started.
+
+*/
+
+{
+
+	if (!IsDone() || (0 == m_StartUs)) {
+		return 0;
+	}
+
+	return m_DoneUs - m_StartUs;
+}
+
+void
+GpioI2C::PrepareTransaction (
+	_In_ I2CTransaction &Txn,
+	_In_ int8_t Addr,
+	_In_ const std::vector<int8_t> &TxData,
+	_In_ int8_t *RxData,
+	_In_ int16_t RxLen,
+	_In_ uint32_t DeadlineUs
+	)
+
+/*
+ Routine Description:
+
+	This routine initializes a transaction and computes its deadline. An
+	explicit deadline counts from now, the default one from the time the
+	transaction gets the bus (see StartTransaction), so waiting behind other
+	transactions doesn't eat into it.
+
+ Parameters:
+
+ 	Txn - Supplies the transaction.
+
+ 	Addr - Supplies the address of the I2C slave.
+
+ 	TxData - Supplies the bytes to write.
+
+ 	RxData - Supplies the buffer of the data read, NULL for writes.
+
+ 	RxLen - Supplies the number of bytes to read, 0 for writes.
+
+ 	DeadlineUs - Supplies the deadline relative to now, 0 to allow 4 times
+ 		the time on the wire plus I2C_TXN_BASE_TIMEOUT_US from the start.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Txn.m_Addr = Addr;
+	Txn.m_TxData = TxData;
+	Txn.m_RxData = RxData;
+	Txn.m_RxLen = RxLen;
+	Txn.m_Sent = 0;
+	Txn.m_Received = 0;
+	Txn.m_State = I2CTransaction::I2C_TXN_START_WRITE;
+	Txn.m_Status = ERROR_PENDING;
+	Txn.m_SubmitUs = RpiGetTimeUs();
+	Txn.m_StartUs = 0;
+	Txn.m_DoneUs = 0;
+	Txn.m_Done.store(0, std::memory_order_relaxed);
+
+	if (0 == DeadlineUs) {
+
+		//
+		// Address bytes of both phases are counted as well.
+		//
+
+		Txn.m_DeadlineUs = 0;
+		Txn.m_TimeoutUs = I2C_TXN_BASE_TIMEOUT_US +
+				4 * GetByteTimeUs() * (TxData.size() + RxLen + 2);
+
+	} else {
+		Txn.m_DeadlineUs = Txn.m_SubmitUs + DeadlineUs;
+		Txn.m_TimeoutUs = DeadlineUs;
+	}
+
+	return;
+}
+
+void
+GpioI2C::StartTransaction (
+	_In_ I2CTransaction &Txn
+	)
+
+/*
+ Routine Description:
+
+	This routine marks a transaction as started on the bus, the default
+	deadline starts counting now. The caller holds m_BusLock.
+
+ Parameters:
+
+ 	Txn - Supplies the transaction.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Txn.m_StartUs = RpiGetTimeUs();
+	if (0 == Txn.m_DeadlineUs) {
+		Txn.m_DeadlineUs = Txn.m_StartUs + Txn.m_TimeoutUs;
+	}
+
+	return;
+}
+
+GpioI2C::I2CHandle
+GpioI2C::SubmitWrite (
+	_In_ const int8_t Addr,
+	_In_ const std::vector<int8_t> &Values,
+	_In_ uint32_t DeadlineUs,
+	_In_ I2CCallback Callback
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a write transaction.
+
+ Parameters:
+
+ 	Addr - Supplies the address of the I2C slave.
+
+ 	Values - Supplies a vector of data to write.
+
+ 	DeadlineUs - Supplies the deadline relative to now, 0 for the default.
+
+ 	Callback - Supplies the routine called with the result, it's optional.
+
+ Return Value:
+
+	I2CHandle - Supplies the handle to poll.
+
+*/
+
+{
+
+	I2CHandle Txn = std::make_shared<I2CTransaction>();
+
+	PrepareTransaction(*Txn, Addr, Values, NULL, 0, DeadlineUs);
+	Txn->m_Callback = Callback;
+	return Submit(Txn);
+}
+
+GpioI2C::I2CHandle
+GpioI2C::SubmitRead (
+	_In_ int8_t Addr,
+	_In_ int8_t Reg,
+	_Out_ int8_t *Values,
+	_In_ const int16_t Len,
+	_In_ uint32_t DeadlineUs,
+	_In_ I2CCallback Callback
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a register read transaction: the register address is
+	written first, then Len bytes are read.
+
+ Parameters:
+
+ 	Addr - Supplies the address of the I2C slave.
+
+ 	Reg - Supplies the register of I2C slave to read.
+
+ 	Values - Supplies the buffer of the data read.
+
+ 	Len - Supplies the number of bytes to read.
+
+ 	DeadlineUs - Supplies the deadline relative to now, 0 for the default.
+
+ 	Callback - Supplies the routine called with the result, it's optional.
+
+ Return Value:
+
+	I2CHandle - Supplies the handle to poll.
+
+*/
+
+{
+
+	I2CHandle Txn = std::make_shared<I2CTransaction>();
+
+	assert(Values != NULL);
+	PrepareTransaction(*Txn, Addr, {Reg}, Values, Len, DeadlineUs);
+	Txn->m_Callback = Callback;
+	return Submit(Txn);
+}
+
+int32_t
+GpioI2C::Wait (
+	_In_ const I2CHandle &Handle,
+	_In_ uint32_t TimeoutUs
+	)
+
+/*
+ Routine Description:
+
+	This routine waits for a transaction to finish. The transaction keeps its
+	own deadline, so the wait is just how long the caller is willing to block.
+
+ Parameters:
+
+ 	Handle - Supplies the transaction.
+
+ 	TimeoutUs - Supplies the time to wait in microseconds.
+
+ Return Value:
+
+	int32_t - Status of the transaction, ERROR_PENDING if it's still running.
+
+*/
+
+{
+
+	uint64_t End = RpiGetTimeUs() + TimeoutUs;
+	uint32_t ByteTimeUs = GetByteTimeUs();
+
+	while (!Handle->IsDone()) {
+		if (RpiGetTimeUs() >= End) {
+			return ERROR_PENDING;
+		}
+
+		usleep(ByteTimeUs);
+	}
+
+	return Handle->GetStatus();
+}
+
+std::future<int16_t>
+GpioI2C::WriteAsync (
+	_In_ const int8_t Addr,
+	_In_ const std::vector<int8_t> &Values,
+	_In_ I2CCallback Callback
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a write transaction with the default deadline.
+
+ Parameters:
+
+ 	Addr - Supplies the address of the I2C slave.
+
+ 	Values - Supplies a vector of data to write.
+
+ 	Callback - Supplies the routine called with the result, it's optional.
+
+ Return Value:
+
+	std::future<int16_t> - Supplies the number of bytes written, -1 if the
+		transaction failed.
+
+*/
+
+{
+
+	I2CHandle Txn = std::make_shared<I2CTransaction>();
+	std::future<int16_t> Result = Txn->m_Promise.get_future();
+
+	PrepareTransaction(*Txn, Addr, Values, NULL, 0, 0);
+	Txn->m_Callback = Callback;
+	Submit(Txn);
+	return Result;
+}
+
+std::future<int16_t>
+GpioI2C::ReadAsync (
+	_In_ int8_t Addr,
+	_In_ int8_t Reg,
+	_Out_ int8_t *Values,
+	_In_ const int16_t Len,
+	_In_ I2CCallback Callback
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a register read transaction with the default deadline.
+
+ Parameters:
+
+ 	Addr - Supplies the address of the I2C slave.
+
+ 	Reg - Supplies the register of I2C slave to read.
+
+ 	Values - Supplies the buffer of the data read.
+
+ 	Len - Supplies the number of bytes to read.
+
+ 	Callback - Supplies the routine called with the result, it's optional.
+
+ Return Value:
+
+	std::future<int16_t> - Supplies the number of bytes read, -1 if the
+		transaction failed.
+
+*/
+
+{
+
+	I2CHandle Txn = std::make_shared<I2CTransaction>();
+	std::future<int16_t> Result = Txn->m_Promise.get_future();
+
+	assert(Values != NULL);
+	PrepareTransaction(*Txn, Addr, {Reg}, Values, Len, 0);
+	Txn->m_Callback = Callback;
+	Submit(Txn);
+	return Result;
+}
+
+GpioI2C::I2CHandle
+GpioI2C::Submit (
+	_In_ I2CHandle Txn
+	)
+
+/*
+ Routine Description:
+
+	This routine appends a transaction to the queue, the worker thread is
+	started by the first one.
+
+ Parameters:
+
+ 	Txn - Supplies the transaction.
+
+ Return Value:
+
+	I2CHandle - Supplies the transaction.
+
+*/
+
+{
+
+	{
+		std::lock_guard<std::mutex> Guard(m_QueueLock);
+		if (!m_Worker.joinable()) {
+			m_Worker = std::thread(&GpioI2C::AsyncWorker, this);
+		}
+
+		m_Pending.push_back(Txn);
+	}
+
+	m_QueueCond.notify_one();
+	return Txn;
+}
+
+void
+GpioI2C::FinishTransaction (
+	_In_ I2CTransaction &Txn,
+	_In_ int32_t Status
+	)
+
+/*
+ Routine Description:
+
+	This routine records the completion of a transaction. A failed one also
+	resets the controller, so the next transaction starts from a clean state.
+
+ Parameters:
+
+ 	Txn - Supplies the transaction.
+
+ 	Status - Supplies the status.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if ((ERROR_SUCCESS != Status) && (NULL != m_I2CRegisters)) {
+
+		//
+		// Drop I2CEN to abort the transfer, clear the FIFO and the W1C
+		// flags. The next transaction sets I2CEN again.
+		//
+
+		CTRL.word = 0;
+		CTRL.CLEAR = 1;
+		m_I2CRegisters->C.word = CTRL.word;
+		UpdateStatus();
+	}
+
+	Txn.m_Status = Status;
+	Txn.m_State = I2CTransaction::I2C_TXN_DONE;
+	Txn.m_DoneUs = RpiGetTimeUs();
+	return;
+}
+
+uint32_t
+GpioI2C::GetByteTimeUs (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the time to shift one byte (8 bits + ACK) out.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint32_t - Supplies the time in microseconds, at least 1.
+
+*/
+
+{
+
+	uint64_t Divider = m_I2CRegisters->DIV.CDIV;
+
+	//
+	// CDIV is rounded down to an even number, 0 means 32768.
+	//
+
+	if (0 == Divider) {
+		Divider = 32768;
+	}
+
+	uint64_t Us = 9 * Divider * 1000000ull / RPI_CORE_CLK_FREQ;
+	return (Us > 0) ? static_cast<uint32_t>(Us) : 1;
+}
+
+int32_t
+GpioI2C::StepTransaction (
+	_In_ I2CTransaction &Txn
+	)
+
+/*
+ Routine Description:
+
+	This routine advances a transaction as far as the controller allows
+	without waiting. The FIFO is topped up or drained in one batch. A NACK,
+	a clock stretch timeout or a missed deadline finishes the transaction
+	with an error. The deadline is only applied once the controller status
+	has been looked at, so a transfer which completed before a late poll
+	still succeeds.
+
+ Parameters:
+
+ 	Txn - Supplies the transaction.
+
+ Return Value:
+
+	int32_t - 1 if the transaction is done, 0 otherwise.
+
+*/
+
+{
+
+	bool Expired;
+	I2CStatusRegister Status;
+	int16_t Len;
+
+	Expired = (RpiGetTimeUs() > Txn.m_DeadlineUs);
+	if ((I2CTransaction::I2C_TXN_WRITING == Txn.m_State) ||
+		(I2CTransaction::I2C_TXN_READING == Txn.m_State)) {
+
+		Status.word = m_I2CRegisters->S.word;
+		if (Status.ERR) {
+			FinishTransaction(Txn, ERROR_I2C_NACK);
+			return 1;
+		}
+
+		if (Status.CLKT) {
+			FinishTransaction(Txn, ERROR_I2C_CLOCK_STRETCH);
+			return 1;
+		}
+	}
+
+	//
+	// Don't start another phase past the deadline.
+	//
+
+	if (Expired &&
+		((I2CTransaction::I2C_TXN_START_WRITE == Txn.m_State) ||
+		 (I2CTransaction::I2C_TXN_START_READ == Txn.m_State))) {
+
+		FinishTransaction(Txn, ERROR_TIMEOUT);
+		return 1;
+	}
+
+	switch (Txn.m_State) {
+	case I2CTransaction::I2C_TXN_START_WRITE:
+
+		//
+		// Pre-fill the FIFO before the start condition, so the first batch
+		// doesn't need another round trip.
+		//
+
+		Len = Txn.m_TxData.size();
+		m_I2CRegisters->A.ADDR = Txn.m_Addr;
+		m_I2CRegisters->DLEN.DLEN = Len;
+		UpdateStatus();
+		ClearFIFO();
+		while ((Txn.m_Sent < Len) && (Txn.m_Sent < I2C_FIFO_DEPTH)) {
+			m_I2CRegisters->FIFO = Txn.m_TxData[Txn.m_Sent];
+			Txn.m_Sent += 1;
+		}
+
+		CTRL.word = 0;
+		CTRL.I2CEN = 1;
+		CTRL.ST = 1;
+		m_I2CRegisters->C.word = CTRL.word;
+		Txn.m_State = I2CTransaction::I2C_TXN_WRITING;
+		break;
+
+	case I2CTransaction::I2C_TXN_WRITING:
+		Len = Txn.m_TxData.size();
+		while ((Txn.m_Sent < Len) && m_I2CRegisters->S.TXD) {
+			m_I2CRegisters->FIFO = Txn.m_TxData[Txn.m_Sent];
+			Txn.m_Sent += 1;
+		}
+
+		if ((Txn.m_Sent == Len) && m_I2CRegisters->S.DONE) {
+			if (Txn.m_RxLen > 0) {
+				Txn.m_State = I2CTransaction::I2C_TXN_START_READ;
+
+			} else {
+				FinishTransaction(Txn, ERROR_SUCCESS);
+			}
+		}
+
+		break;
+
+	case I2CTransaction::I2C_TXN_START_READ:
+		m_I2CRegisters->A.ADDR = Txn.m_Addr;
+		m_I2CRegisters->DLEN.DLEN = Txn.m_RxLen;
+		UpdateStatus();
+		UpdateReadCtrl();
+		Txn.m_State = I2CTransaction::I2C_TXN_READING;
+		break;
+
+	case I2CTransaction::I2C_TXN_READING:
+		while ((Txn.m_Received < Txn.m_RxLen) && m_I2CRegisters->S.RXD) {
+			Txn.m_RxData[Txn.m_Received] = m_I2CRegisters->FIFO;
+			Txn.m_Received += 1;
+		}
+
+		if ((Txn.m_Received == Txn.m_RxLen) && m_I2CRegisters->S.DONE) {
+			FinishTransaction(Txn, ERROR_SUCCESS);
+		}
+
+		break;
+
+	default:
+		break;
+	}
+
+	if (Expired && (I2CTransaction::I2C_TXN_DONE != Txn.m_State)) {
+		FinishTransaction(Txn, ERROR_TIMEOUT);
+	}
+
+	return (I2CTransaction::I2C_TXN_DONE == Txn.m_State) ? 1 : 0;
+}
+
+void
+GpioI2C::AsyncWorker (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the async worker thread. It executes queued transactions
+	in order and sleeps between FIFO batches.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	I2CHandle Txn;
+	uint32_t ByteTimeUs;
+	uint32_t InFlight;
+	int16_t Result;
+
+	while (1) {
+		{
+			std::unique_lock<std::mutex> Guard(m_QueueLock);
+			m_QueueCond.wait(Guard, [this] { return m_StopWorker || !m_Pending.empty(); });
+			if (m_StopWorker) {
+				break;
+			}
+
+			Txn = m_Pending.front();
+			m_Pending.pop_front();
+		}
+
+		{
+			std::lock_guard<std::recursive_mutex> Guard(m_BusLock);
+			ByteTimeUs = GetByteTimeUs();
+			StartTransaction(*Txn);
+			while (0 == StepTransaction(*Txn)) {
+
+				//
+				// DLEN reads back the bytes left in the current phase, sleep
+				// until about half of the FIFO is free (or filled).
+				//
+
+				InFlight = m_I2CRegisters->DLEN.DLEN;
+				if (InFlight > I2C_FIFO_DEPTH / 2) {
+					InFlight = I2C_FIFO_DEPTH / 2;
+				}
+
+				usleep(ByteTimeUs * ((InFlight > 0) ? InFlight : 1));
+			}
+		}
+
+		Txn->m_Done.store(1, std::memory_order_release);
+		Result = Txn->GetResult();
+		Txn->m_Promise.set_value((ERROR_SUCCESS == Txn->m_Status) ? Result : -1);
+		if (Txn->m_Callback) {
+			Txn->m_Callback(Result, Txn->m_Status);
+		}
+
+		Txn.reset();
+	}
+
+	//
+	// Abort whatever is left in the queue.
+	//
+
+	std::lock_guard<std::mutex> Guard(m_QueueLock);
+	for (auto &Left : m_Pending) {
+		Left->m_Status = ERROR_ABORTED;
+		Left->m_State = I2CTransaction::I2C_TXN_DONE;
+		Left->m_DoneUs = RpiGetTimeUs();
+		Left->m_Done.store(1, std::memory_order_release);
+		Left->m_Promise.set_value(-1);
+		if (Left->m_Callback) {
+			Left->m_Callback(Left->GetResult(), ERROR_ABORTED);
+		}
+	}
+
+	m_Pending.clear();
+	return;
+}
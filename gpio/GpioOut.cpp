@@ -6,8 +6,8 @@
  */
 #include "GpioOut.h"
 
-GpioOut::GpioOut(int32_t pin)
-	: GpioBase({pin}, FSEL_OUTPUT)
+GpioOut::GpioOut(int32_t pin, GpioConfigBatch *Batch)
+	: GpioBase({pin}, FSEL_OUTPUT, Batch)
 {
 }
 
@@ -17,21 +17,25 @@ GpioOut::~GpioOut()
 
 void GpioOut::Update(const std::vector<uint32_t> &set_pins, const std::vector<uint32_t> &clear_pins)
 {
-	uint32_t set[2] = {0, 0};
-	uint32_t clear[2] = {0, 0};
+	uint64_t set = 0;
+	uint64_t clear = 0;
 	for (auto pin : set_pins)
-		set[pin >> 5] |= 0x1u << (pin - (pin >> 5 << 5));
+		set |= PinMask(pin);
 	for (auto pin : clear_pins)
-		clear[pin >> 5] |= 0x1u << (pin - (pin >> 5 << 5));
+		clear |= PinMask(pin);
 
+	Update(set, clear);
+}
+
+void GpioOut::Update(uint64_t set_mask, uint64_t clear_mask)
+{
 	for (int i = 0; i < 2; ++i)
 	{
-		if (set[i] != 0)
-			GPIORegs->GPSETn[i] = set[i];
-		if (clear[i] != 0)
-			GPIORegs->GPCLRn[0] = clear[i];
+		uint32_t set = static_cast<uint32_t>(set_mask >> (i << 5));
+		uint32_t clear = static_cast<uint32_t>(clear_mask >> (i << 5));
+		if (set != 0)
+			GPIORegs->GPSETn[i] = set;
+		if (clear != 0)
+			GPIORegs->GPCLRn[i] = clear;
 	}
 }
-
-
-
@@ -0,0 +1,404 @@
+/*
+ * GpioOutQueue.cpp
+ *
+ *  Created on: Feb 27, 2021
+ *      Author: Albert Guan
+ */
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include "GpioOutQueue.h"
+#include "Diag.h"
+
+//
+// Max time the output thread sleeps before checking the rings again.
+//
+
+static const uint32_t GPIO_OUT_IDLE_TIMEOUT_US = 1000;
+
+GpioOutQueue::Producer::Producer (
+	_In_ GpioOutQueue *Queue,
+	_In_ uint32_t Capacity
+	) : m_Queue(Queue),
+		m_Ring(Capacity)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of a producer, it allocates its ring.
+
+ Parameters:
+
+ 	Queue - Supplies the queue the producer posts to.
+
+ 	Capacity - Supplies the min number of commands in the ring.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	return;
+}
+
+GpioOutQueue::Producer::~Producer (
+	void
+	)
+{
+}
+
+int32_t
+GpioOutQueue::Producer::Post (
+	_In_ uint64_t SetMask,
+	_In_ uint64_t ClearMask
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a pin change. Only the thread which registered the
+	producer may call it.
+
+ Parameters:
+
+ 	SetMask - Supplies the pins to set, bit n is GPIO n.
+
+ 	ClearMask - Supplies the pins to clear.
+
+ Return Value:
+
+	int32_t - 0 if queued, -1 if the ring is full.
+
+*/
+
+{
+
+	GpioOutCommand Command;
+
+	Command.SetMask = SetMask;
+	Command.ClearMask = ClearMask;
+	Command.EnqueueNs = RpiGetTimeNs();
+	if (0 != m_Ring.Push(Command)) {
+		return -1;
+	}
+
+	m_Queue->Wakeup();
+	return 0;
+}
+
+int32_t
+GpioOutQueue::Producer::Pop (
+	_Out_ GpioOutCommand &Command
+	)
+
+/*
+ Routine Description:
+
+	This routine takes the oldest command, only the output thread calls it.
+
+ Parameters:
+
+ 	Command - Supplies the command.
+
+ Return Value:
+
+	int32_t - 1 if a command was taken, 0 if the ring is empty.
+
+*/
+
+{
+
+	return m_Ring.Pop(Command);
+}
+
+GpioOutQueue::GpioOutQueue (
+	void
+	) : m_NumProducers(0),
+		m_Sleeping(0),
+		m_Stop(0),
+		m_Latency({0, 0, 0, 0})
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioOutQueue, it starts the output
+	thread.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	for (uint32_t i = 0; i < MAX_PRODUCERS; i++) {
+		m_Producers[i] = NULL;
+	}
+
+	m_Thread = std::thread(&GpioOutQueue::OutputThread, this);
+	return;
+}
+
+GpioOutQueue::~GpioOutQueue (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioOutQueue. Commands already posted
+	are written before the output thread exits.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_Stop.store(1);
+	m_SleepCond.notify_one();
+	if (m_Thread.joinable()) {
+		m_Thread.join();
+	}
+
+	for (uint32_t i = 0; i < m_NumProducers.load(); i++) {
+		delete m_Producers[i];
+		m_Producers[i] = NULL;
+	}
+
+	return;
+}
+
+GpioOutQueue::Producer *
+GpioOutQueue::RegisterProducer (
+	_In_ uint32_t Capacity
+	)
+
+/*
+ Routine Description:
+
+	This routine creates a producer. The producer is owned by the queue and
+	lives as long as it.
+
+ Parameters:
+
+ 	Capacity - Supplies the min number of commands in the ring.
+
+ Return Value:
+
+	Producer * - Supplies the producer, NULL if there are MAX_PRODUCERS of
+		them already.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_RegisterLock);
+	uint32_t Count = m_NumProducers.load(std::memory_order_relaxed);
+
+	if (Count == MAX_PRODUCERS) {
+		return NULL;
+	}
+
+	m_Producers[Count] = new Producer(this, Capacity);
+
+	//
+	// Publish the producer after it's fully built.
+	//
+
+	m_NumProducers.store(Count + 1, std::memory_order_release);
+	return m_Producers[Count];
+}
+
+GpioOutQueue::GpioOutLatency
+GpioOutQueue::GetLatency (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the post to write latency statistics.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	GpioOutLatency - Supplies the statistics.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_LatencyLock);
+	return m_Latency;
+}
+
+void
+GpioOutQueue::Wakeup (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine wakes up the output thread if it's asleep.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if (m_Sleeping.load(std::memory_order_acquire)) {
+		m_SleepCond.notify_one();
+	}
+
+	return;
+}
+
+void
+GpioOutQueue::OutputThread (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the output thread. It takes one command per producer per
+	round, so a busy producer can't starve the others.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Producer::GpioOutCommand Command;
+	uint64_t LatencyNs;
+	uint32_t Count;
+	uint32_t Written;
+
+	while (1) {
+		Written = 0;
+		Count = m_NumProducers.load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < Count; i++) {
+			if (m_Producers[i]->Pop(Command)) {
+				GpioOut::Update(Command.SetMask, Command.ClearMask);
+				LatencyNs = RpiGetTimeNs() - Command.EnqueueNs;
+				Written += 1;
+
+				std::lock_guard<std::mutex> Guard(m_LatencyLock);
+				m_Latency.Count += 1;
+				m_Latency.TotalNs += LatencyNs;
+				m_Latency.LastNs = LatencyNs;
+				if (LatencyNs > m_Latency.MaxNs) {
+					m_Latency.MaxNs = LatencyNs;
+				}
+			}
+		}
+
+		if (Written > 0) {
+			continue;
+		}
+
+		if (m_Stop.load()) {
+			break;
+		}
+
+		//
+		// All rings are empty, sleep. A post after m_Sleeping is set notifies,
+		// one in between is picked up by the timeout.
+		//
+
+		std::unique_lock<std::mutex> Guard(m_SleepLock);
+		m_Sleeping.store(1, std::memory_order_release);
+		m_SleepCond.wait_for(Guard, std::chrono::microseconds(GPIO_OUT_IDLE_TIMEOUT_US));
+		m_Sleeping.store(0, std::memory_order_release);
+	}
+
+	return;
+}
+
+void
+GpioOutQueueDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine, two threads blink their own pins through the
+	queue.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	const uint32_t PinA = 5;
+	const uint32_t PinB = 16;
+	GpioOut OutA(PinA);
+	GpioOut OutB(PinB);
+	GpioOutQueue Queue;
+	GpioOutQueue::GpioOutLatency Latency;
+
+	auto Blink = [&Queue](uint32_t Pin, uint32_t PeriodUs) {
+		GpioOutQueue::Producer *Out = Queue.RegisterProducer();
+		for (uint32_t i = 0; i < 1000; i++) {
+			Out->Post(GpioOut::PinMask(Pin), 0);
+			usleep(PeriodUs / 2);
+			Out->Post(0, GpioOut::PinMask(Pin));
+			usleep(PeriodUs / 2);
+		}
+	};
+
+	std::thread ThreadA(Blink, PinA, 2000);
+	std::thread ThreadB(Blink, PinB, 3000);
+	ThreadA.join();
+	ThreadB.join();
+
+	Latency = Queue.GetLatency();
+	RPI_PRINT_EX(InfoLevelInfo,
+				 "%llu commands, latency avg %llu ns, max %llu ns",
+				 Latency.Count,
+				 Latency.Count ? Latency.TotalNs / Latency.Count : 0,
+				 Latency.MaxNs);
+
+	return;
+}
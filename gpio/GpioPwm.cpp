@@ -196,12 +196,7 @@ GpioPwm::Init (
 
 	try {
 		PWMCtrlRegs = const_cast<volatile PWMCtrlRegisters *>(static_cast<PWMCtrlRegisters *>(
-								mmap(NULL,
-								 	 sizeof(PWMCtrlRegisters),
-									 PROT_READ | PROT_WRITE,
-									 MAP_SHARED,
-									 mem_fd,
-									 GPIO_PWM_PHY_ADDR)));
+								MapRegisters(GPIO_PWM_PHY_ADDR, sizeof(PWMCtrlRegisters))));
 
 		if (MAP_FAILED == PWMCtrlRegs) {
 			Error = ERROR_FAILED_MEM_MAP;
@@ -209,12 +204,7 @@ GpioPwm::Init (
 		}
 
 		ClkRegisters = const_cast<volatile uint32_t *>(static_cast<uint32_t *>(
-								mmap(NULL,
-									 BLOCK_SIZE,
-									 PROT_READ | PROT_WRITE,
-									 MAP_SHARED,
-									 mem_fd,
-									 GPIO_CLK_PHY_ADDR)));
+								MapRegisters(GPIO_CLK_PHY_ADDR, BLOCK_SIZE)));
 
 		if (MAP_FAILED == ClkRegisters) {
 			Error = ERROR_FAILED_MEM_MAP;
@@ -229,8 +219,8 @@ GpioPwm::Init (
 		RPI_PRINT(InfoLevelError, "got an unknown exception, try to run with root");
 	}
 
-	CM_PWMCTL = ADDRESS_TO_VOLATILE_POINTER((uint32_t) ClkRegisters + CM_PWMCTL_OFFSET);
-	CM_PWMDIV = ADDRESS_TO_VOLATILE_POINTER((uint32_t) ClkRegisters + CM_PWMDIV_OFFSET);
+	CM_PWMCTL = ADDRESS_TO_VOLATILE_POINTER((uintptr_t) ClkRegisters + CM_PWMCTL_OFFSET);
+	CM_PWMDIV = ADDRESS_TO_VOLATILE_POINTER((uintptr_t) ClkRegisters + CM_PWMDIV_OFFSET);
 
 InitEnd:
 	return Error;
@@ -259,14 +249,13 @@ GpioPwm::Uninit (
 {
 	if (0 == NumOfPWMInstances) {
 		if (PWMCtrlRegs != NULL) {
-			munmap(static_cast<void *>(const_cast<PWMCtrlRegisters *>(PWMCtrlRegs)),
-				   sizeof(PWMCtrlRegisters));
+			UnmapRegisters(PWMCtrlRegs, sizeof(PWMCtrlRegisters));
 
 			PWMCtrlRegs = NULL;
 		}
 
 		if (ClkRegisters != NULL) {
-			munmap(static_cast<void *>(const_cast<uint32_t *>(ClkRegisters)), BLOCK_SIZE);
+			UnmapRegisters(ClkRegisters, BLOCK_SIZE);
 			ClkRegisters = NULL;
 			CM_PWMCTL = NULL;
 			CM_PWMDIV = NULL;
@@ -783,3 +772,111 @@ GpioPwm::UpdatePWMFIFO (
 	}
 }
 
+uint32_t
+GpioPwm::FillPWMFIFO (
+	_In_ const uint32_t *vals,
+	_In_ uint32_t len
+	)
+
+/*
+ Routine Description:
+
+	This routine writes words to the PWM FIFO as long as it has room. The
+	caller keeps feeding the rest while the FIFO drains.
+
+ Parameters:
+
+ 	vals - Supplies the words.
+
+ 	len - Supplies the number of words.
+
+ Return Value:
+
+	uint32_t - Number of words written.
+
+*/
+
+{
+
+	uint32_t i;
+
+	for (i = 0; (i < len) && (PWMCtrlRegs->STA.FULL1 == 0); ++i) {
+		PWMCtrlRegs->FIF1 = vals[i];
+	}
+
+	return i;
+}
+
+
+void
+GpioPwm::SetDMA (
+	_In_ int32_t Enable,
+	_In_ uint32_t Dreq,
+	_In_ uint32_t Panic
+	)
+
+/*
+ Routine Description:
+
+	This routine enables/disables the DMA request of the PWM FIFO. When it's
+	enabled, the PWM asserts DREQ once the FIFO level drops below Dreq, so a
+	DMA channel paced by the PWM peripheral keeps the FIFO filled.
+
+ Parameters:
+
+ 	Enable - Supplies turning the DMA request on/off.
+
+ 	Dreq - Supplies the FIFO threshold of the DREQ signal.
+
+ 	Panic - Supplies the FIFO threshold of the PANIC signal.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	PWMRegDMAC DMAC;
+
+	assert(PWMCtrlRegs != NULL);
+	if (m_UsingFIFO == 0) {
+		RPI_PRINT_EX(InfoLevelWarning,
+					 "Channle %d is NOT in FIFO mode!",
+					 m_PWMChannelId);
+	}
+
+	DMAC.word = 0;
+	DMAC.DREQ = Dreq;
+	DMAC.PANIC = Panic;
+	DMAC.ENAB = (Enable != 0) ? 1 : 0;
+	PWMCtrlRegs->DMAC.word = DMAC.word;
+	return;
+}
+
+uint32_t
+GpioPwm::GetFIFOBusAddr (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the bus address of the PWM FIFO, which is the
+	destination of DMA transfers.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint32_t - Supplies the bus address of FIF1.
+
+*/
+
+{
+
+	return PWM_FIFO_BUS_ADDR;
+}
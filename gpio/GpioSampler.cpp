@@ -0,0 +1,386 @@
+/*
+ * GpioSampler.cpp
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Albert Guan
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include "GpioSampler.h"
+#include "Diag.h"
+#include "GpioIn.h"
+
+GpioSampler::GpioSampler (
+	_In_ uint32_t RateHz,
+	_In_ uint32_t Capacity
+	) : GpioBase(std::vector<int32_t>{}, FSEL_INPUT),
+		m_Ring(Capacity),
+		m_Overruns(0),
+		m_Stop(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of GpioSampler, it allocates the ring. The
+	pins are left as they are, configure them with GpioIn or a batch.
+
+ Parameters:
+
+ 	RateHz - Supplies the sampling rate.
+
+ 	Capacity - Supplies the min number of samples in the ring.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_PeriodNs = 1000000000ull / ((0 != RateHz) ? RateHz : 1);
+	return;
+}
+
+GpioSampler::~GpioSampler (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of GpioSampler, it stops the sample thread
+	and frees the ring.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Stop();
+	return;
+}
+
+int32_t
+GpioSampler::Start (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine starts the sample thread.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 if started, -1 if it already runs.
+
+*/
+
+{
+
+	if (m_Thread.joinable()) {
+		return -1;
+	}
+
+	m_Stop.store(0);
+	m_Thread = std::thread(&GpioSampler::SampleThread, this);
+	return 0;
+}
+
+void
+GpioSampler::Stop (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine stops the sample thread, samples in the ring can still be
+	read.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if (m_Thread.joinable()) {
+		m_Stop.store(1);
+		m_Thread.join();
+	}
+
+	return;
+}
+
+uint32_t
+GpioSampler::Read (
+	_Out_ GpioSample *Samples,
+	_In_ uint32_t MaxSamples
+	)
+
+/*
+ Routine Description:
+
+	This routine pops the oldest samples, only one consumer thread may call
+	it.
+
+ Parameters:
+
+ 	Samples - Supplies the array to fill.
+
+ 	MaxSamples - Supplies the size of the array.
+
+ Return Value:
+
+	uint32_t - Number of samples popped.
+
+*/
+
+{
+
+	return m_Ring.Pop(Samples, MaxSamples);
+}
+
+uint64_t
+GpioSampler::GetOverruns (
+	void
+)
+{
+	return m_Overruns.load();
+}
+
+uint32_t
+GpioSampler::DecodeEdges (
+	_In_ const GpioSample *Samples,
+	_In_ uint32_t Count,
+	_In_ uint64_t PinMask,
+	_Inout_ uint64_t &LastLevels,
+	_Out_ GpioSampleEdge *Edges,
+	_In_ uint32_t MaxEdges,
+	_Out_ uint32_t &Consumed
+	)
+
+/*
+ Routine Description:
+
+	This routine turns level samples into edges of the watched pins. An edge
+	is stamped with the first sample showing the new level. If Edges fills up
+	within a sample, LastLevels takes the new levels of the pins whose edges
+	were stored, so that sample yields only the rest when decoded again.
+
+ Parameters:
+
+ 	Samples - Supplies the samples, oldest first.
+
+ 	Count - Supplies the number of samples.
+
+ 	PinMask - Supplies the pins to watch, bit n is GPIO n.
+
+ 	LastLevels - Supplies the levels before the first sample, receives the
+ 		levels of the last sample decoded.
+
+ 	Edges - Supplies the array to fill.
+
+ 	MaxEdges - Supplies the size of the array.
+
+ 	Consumed - Receives the number of samples fully decoded, Count unless
+ 		Edges filled up.
+
+ Return Value:
+
+	uint32_t - Number of edges stored.
+
+*/
+
+{
+
+	uint64_t Changed;
+	uint32_t NumEdges = 0;
+	int32_t Pin;
+
+	for (uint32_t i = 0; i < Count; i++) {
+		Changed = (Samples[i].Levels ^ LastLevels) & PinMask;
+		while (0 != Changed) {
+			if (NumEdges == MaxEdges) {
+				Consumed = i;
+				return NumEdges;
+			}
+
+			Pin = __builtin_ctzll(Changed);
+			Changed &= Changed - 1;
+			LastLevels ^= 1ull << Pin;
+			Edges[NumEdges].TimestampNs = Samples[i].TimestampNs;
+			Edges[NumEdges].Pin = Pin;
+			Edges[NumEdges].Level = (Samples[i].Levels >> Pin) & 0x1;
+			NumEdges += 1;
+		}
+
+		LastLevels = Samples[i].Levels;
+	}
+
+	Consumed = Count;
+	return NumEdges;
+}
+
+void
+GpioSampler::SampleThread (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the sample thread. It tries to run as SCHED_FIFO so it
+	isn't preempted by normal threads, then reads GPLEV0/GPLEV1 on every
+	deadline.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Deadline;
+	bool Spin;
+	struct sched_param Param;
+	GpioSample Sample;
+
+	memset(&Param, 0, sizeof(Param));
+	Param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	if (0 != pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param)) {
+		RPI_PRINT(InfoLevelWarning, "Sampling without SCHED_FIFO, run as root for a steady rate");
+	}
+
+	Spin = (m_PeriodNs < 1000000000ull / SPIN_THRESHOLD_HZ);
+	Deadline = RpiGetTimeNs();
+	while (0 == m_Stop.load(std::memory_order_relaxed)) {
+		if (Spin) {
+			while (RpiGetTimeNs() < Deadline) {
+			}
+
+		} else {
+			RpiSleepUntilNs(Deadline);
+		}
+
+		Sample.TimestampNs = RpiGetTimeNs();
+		Sample.Levels = GpioIn::readLevels();
+		if (0 != m_Ring.Push(Sample)) {
+			m_Overruns.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		Deadline += m_PeriodNs;
+	}
+
+	return;
+}
+
+void
+GpioSamplerDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine, it samples the proximity sensors at 100 kHz and
+	prints the width of every pulse they output.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	const int32_t Left = 16;
+	const int32_t Right = 19;
+	const uint32_t BatchSize = 1024;
+	GpioIn LeftIn(Left);
+	GpioIn RightIn(Right);
+	GpioSampler Sampler(100000);
+	GpioSample Samples[BatchSize];
+	GpioSampleEdge Edges[BatchSize];
+	uint64_t FallNs[2] = {0, 0};
+	uint32_t Consumed;
+	uint32_t Decoded;
+	uint64_t LastLevels;
+	uint32_t NumEdges;
+	uint32_t NumSamples;
+
+	LastLevels = GpioIn::readLevels();
+	Sampler.Start();
+	while (1) {
+		NumSamples = Sampler.Read(Samples, BatchSize);
+
+		//
+		// Edges may fill up before the samples run out, resume where the
+		// decoding stopped.
+		//
+
+		for (Decoded = 0; Decoded < NumSamples; Decoded += Consumed) {
+			NumEdges = GpioSampler::DecodeEdges(Samples + Decoded,
+												NumSamples - Decoded,
+												PinSet<Left, Right>::MASK,
+												LastLevels,
+												Edges,
+												BatchSize,
+												Consumed);
+
+			//
+			// The sensors pull low when an obstacle is seen.
+			//
+
+			for (uint32_t i = 0; i < NumEdges; i++) {
+				uint32_t Side = (Left == Edges[i].Pin) ? 0 : 1;
+
+				if (0 == Edges[i].Level) {
+					FallNs[Side] = Edges[i].TimestampNs;
+
+				} else if (0 != FallNs[Side]) {
+					RPI_PRINT_EX(InfoLevelInfo,
+								 "%s obstacle for %llu us",
+								 (0 == Side) ? "Left" : "Right",
+								 (Edges[i].TimestampNs - FallNs[Side]) / 1000);
+				}
+			}
+		}
+
+		if (0 == NumSamples) {
+			usleep(10000);
+		}
+	}
+
+	return;
+}
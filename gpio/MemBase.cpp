@@ -15,8 +15,67 @@
 #include <string>
 #include "MemBase.h"
 
-int32_t MemBase::mem_fd = -1;
 int32_t MemBase::num_of_mem_inst = 0;
+DevMemBackend MemBase::dev_mem;
+MemBackend *MemBase::backend = &MemBase::dev_mem;
+
+DevMemBackend::DevMemBackend()
+	: m_fd(-1)
+{
+}
+
+DevMemBackend::~DevMemBackend()
+{
+	Close();
+}
+
+int32_t DevMemBackend::Open()
+{
+	//Check whether the "/dev/mem" has been opened or not
+	if (m_fd >= 0)
+		return 0;
+
+	try
+	{
+		m_fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
+		if (m_fd < 0)
+			throw std::string("Failed to open /dev/mem");
+	}
+	catch (const std::string &err)
+	{
+		std::cout << __func__ << " with exception: " << err << std::endl;
+		return -1;
+	}
+	catch (...)
+	{
+		std::cout << __func__ << " with unknown exception" << std::endl;
+		return -2;
+	}
+
+	return 0;
+}
+
+void DevMemBackend::Close()
+{
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+}
+
+void *DevMemBackend::Map(uint32_t phy_addr, size_t len)
+{
+	if (m_fd < 0)
+		return MAP_FAILED;
+
+	return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, phy_addr);
+}
+
+void DevMemBackend::Unmap(void *virt, size_t len)
+{
+	munmap(virt, len);
+}
 
 MemBase::MemBase()
 {
@@ -31,39 +90,43 @@ MemBase::~MemBase()
 	Uninit();
 }
 
-int32_t MemBase::Init()
+void MemBase::SetBackend(MemBackend *new_backend)
 {
-	if (0 == num_of_mem_inst)
+	if (0 != num_of_mem_inst)
 	{
-		//Check whether the "/dev/mem" has been opened or not
-		if (mem_fd != 0)
-		{
-			try
-			{
-				mem_fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
-				if (mem_fd < 0)
-					throw "Failed to open /dev/mem";
-			}
-			catch (const std::string &err)
-			{
-				std::cout << __func__ << " with exception: " << err << std::endl;
-				return -1;
-			}
-			catch (...)
-			{
-				std::cout << __func__ << " with unknown exception" << std::endl;
-				return -2;
-			}
-		}
+		std::cout << __func__ << " ignored, drivers are still alive" << std::endl;
+		return;
 	}
+
+	backend = (NULL != new_backend) ? new_backend : &dev_mem;
+}
+
+MemBackend *MemBase::GetBackend()
+{
+	return backend;
+}
+
+int32_t MemBase::Init()
+{
+	if (0 == num_of_mem_inst)
+		return backend->Open();
+
 	return 0;
 }
 
 void MemBase::Uninit()
 {
 	if (0 == num_of_mem_inst)
-	{
-		close(mem_fd);
-		mem_fd = -1;
-	}
+		backend->Close();
+}
+
+void *MemBase::MapRegisters(uint32_t phy_addr, size_t len)
+{
+	return backend->Map(phy_addr, len);
+}
+
+void MemBase::UnmapRegisters(volatile void *virt, size_t len)
+{
+	if ((NULL != virt) && (MAP_FAILED != virt))
+		backend->Unmap(const_cast<void *>(virt), len);
 }
@@ -0,0 +1,1166 @@
+/*
+ * MemSim.cpp
+ *
+ *  Created on: Apr 17, 2021
+ *      Author: Albert Guan
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "Diag.h"
+#include "DMA.h"
+#include "GpioBase.h"
+#include "GpioDmaPwm.h"
+#include "GpioI2C.h"
+#include "GpioIn.h"
+#include "GpioOut.h"
+#include "GpioPwm.h"
+#include "MemSim.h"
+
+//
+// Bits the models act on, see the BCM2837 ARM peripherals for the rest.
+//
+
+static const uint32_t CM_PASSWD_MASK		= 0xFF000000;
+static const uint32_t CM_ENAB				= 1 << 4;
+static const uint32_t CM_KILL				= 1 << 5;
+static const uint32_t CM_BUSY				= 1 << 7;
+static const uint32_t CM_CTL_OFFSET[]		= { 0x70, 0x78, 0x80, 0x98, 0xA0 };
+
+static const uint32_t PWM_CTL_CLRF1		= 1 << 6;
+static const uint32_t PWM_STA_FULL1		= 1 << 0;
+static const uint32_t PWM_STA_EMPT1		= 1 << 1;
+static const uint32_t PWM_STA_W1C			= 0x000001FC;	//WERR1 to BERR
+
+static const uint32_t PCM_CS_TXCLR			= 1 << 3;
+static const uint32_t PCM_CS_RXCLR			= 1 << 4;
+static const uint32_t PCM_CS_W1C			= (1 << 15) | (1 << 16);		//TXERR, RXERR
+static const uint32_t PCM_CS_READY			= (1 << 17) | (1 << 19) | (1 << 21);	//TXW, TXD, TXE
+
+static const uint32_t I2C_C_CLEAR			= 0x3 << 4;
+static const uint32_t I2C_C_ST				= 1 << 7;
+static const uint32_t I2C_S_TA				= 1 << 0;
+static const uint32_t I2C_S_DONE			= 1 << 1;
+static const uint32_t I2C_S_READY			= (1 << 4) | (1 << 5) | (1 << 6);	//TXD, RXD, TXE
+static const uint32_t I2C_S_W1C			= (1 << 1) | (1 << 8) | (1 << 9);	//DONE, ERR, CLKT
+
+static const uint32_t DMA_CHANNEL_COUNT	= 15;
+static const uint32_t DMA_CS_ACTIVE		= 1 << 0;
+static const uint32_t DMA_CS_END			= 1 << 1;
+static const uint32_t DMA_CS_W1C			= (1 << 1) | (1 << 2);		//END, INT
+static const uint32_t DMA_CS_ONE_SHOT		= (1 << 30) | (1u << 31);	//ABORT, RESET
+static const uint32_t DMA_CS_RESET			= 1u << 31;
+
+static const uint32_t SIM_PAGE_SIZE		= BLOCK_SIZE;
+static const uint32_t GPIO_PHY_ADDR		= PERIPHERAL_PHY_BASE + GPIO_BASE_OFFSET;
+static const uintptr_t X86_TRAP_FLAG		= 0x100;
+static const uintptr_t X86_PF_WRITE		= 0x2;		//Page fault error code
+
+MemSimBackend *MemSimBackend::s_Active = NULL;
+
+static struct sigaction s_OldSegvAction;
+static struct sigaction s_OldTrapAction;
+
+//
+// The store being single stepped by this thread.
+//
+
+typedef struct _SimPendingWrite_ {
+	volatile uint32_t *Addr;
+	uintptr_t Page;
+	const void *Mapping;
+	uint32_t Previous;
+	bool Write;
+} SimPendingWrite;
+
+static thread_local SimPendingWrite s_Pending;
+
+//
+// The page protection is shared by all threads while the steps are per
+// thread, so one step at a time: taken by SegvHandler() and released by
+// TrapHandler() once the page is closed again. Otherwise a thread closing
+// the page would fault the store another thread is stepping.
+//
+
+static std::atomic_flag s_StepLock = ATOMIC_FLAG_INIT;
+
+static
+inline
+uint64_t
+PageFloor (
+	_In_ uint64_t Addr
+	)
+{
+	return Addr & ~static_cast<uint64_t>(SIM_PAGE_SIZE - 1);
+}
+
+static
+inline
+uint64_t
+PageCeil (
+	_In_ uint64_t Addr
+	)
+{
+	return PageFloor(Addr + SIM_PAGE_SIZE - 1);
+}
+
+static
+inline
+uint32_t
+GpioReg (
+	_In_ size_t Field,
+	_In_ uint32_t Word
+	)
+{
+	return GPIO_PHY_ADDR + Field + Word * sizeof(uint32_t);
+}
+
+static
+inline
+bool
+IsGpioReg (
+	_In_ uint32_t Offset,
+	_In_ size_t Field,
+	_Out_ uint32_t &Word
+	)
+
+/*
+ Routine Description:
+
+	This routine checks whether an offset in the GPIO block is one of the two
+	words of a register pair, e.g. GPSET0/GPSET1.
+
+ Parameters:
+
+ 	Offset - Supplies the offset written.
+
+ 	Field - Supplies the offset of the pair.
+
+ 	Word - Receives 0 or 1.
+
+ Return Value:
+
+	bool - true if it is.
+
+*/
+
+{
+
+	if ((Offset < Field) || (Offset >= Field + 2 * sizeof(uint32_t))) {
+		return false;
+	}
+
+	Word = (Offset - Field) / sizeof(uint32_t);
+	return true;
+}
+
+static
+void
+ChainSignal (
+	_In_ const struct sigaction &Old,
+	_In_ int Signal,
+	_In_ siginfo_t *Info,
+	_In_ void *Context
+	)
+
+/*
+ Routine Description:
+
+	This routine passes a signal the simulation doesn't own to the handler
+	installed before it, or raises it again with the default action.
+
+ Parameters:
+
+ 	Old - Supplies the previous action.
+
+ 	Signal, Info, Context - Supplies the signal.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if ((0 != (Old.sa_flags & SA_SIGINFO)) && (NULL != Old.sa_sigaction)) {
+		Old.sa_sigaction(Signal, Info, Context);
+
+	} else if ((SIG_DFL != Old.sa_handler) && (SIG_IGN != Old.sa_handler)) {
+		Old.sa_handler(Signal);
+
+	} else {
+		signal(Signal, SIG_DFL);
+		raise(Signal);
+	}
+
+	return;
+}
+
+uint32_t
+MemSimBackend::Block::Read (
+	_In_ uint32_t PhyAddr
+	)
+{
+	return __atomic_load_n(&m_View[(PhyAddr - m_PhyAddr) >> 2], __ATOMIC_ACQUIRE);
+}
+
+void
+MemSimBackend::Block::Write (
+	_In_ uint32_t PhyAddr,
+	_In_ uint32_t Value
+	)
+{
+	__atomic_store_n(&m_View[(PhyAddr - m_PhyAddr) >> 2], Value, __ATOMIC_RELEASE);
+	return;
+}
+
+MemSimBackend::MemSimBackend (
+	void
+	) : m_TrapMode(MEMSIM_TRAP_WRITES),
+		m_Writes(0),
+		m_Reads(0),
+		m_GpioRegs(NULL),
+		m_OutLevels(0),
+		m_PullUps(0),
+		m_InputMask(0),
+		m_InputLevels(0),
+		m_Levels(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of MemSimBackend. Add the hooks, then
+	select it with MemBase::SetBackend() before creating any driver.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_HookLock.clear();
+	memset(m_Mappings, 0, sizeof(m_Mappings));
+	return;
+}
+
+MemSimBackend::~MemSimBackend (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of MemSimBackend, it frees the blocks. The
+	drivers must be gone by now.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Close();
+	for (uint32_t i = 0; i < MAX_MAPPINGS; i++) {
+		if (0 != m_Mappings[i].Base) {
+			munmap(reinterpret_cast<void *>(m_Mappings[i].Base), m_Mappings[i].Size);
+		}
+	}
+
+	for (auto Regs : m_Blocks) {
+		munmap(Regs->m_View, Regs->m_Size);
+		close(Regs->m_Fd);
+		delete Regs;
+	}
+
+	m_Blocks.clear();
+	return;
+}
+
+int32_t
+MemSimBackend::Open (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine installs the signal handlers trapping the driver writes, it's
+	called when the first driver is created. Register contents survive a
+	Close()/Open() like on the hardware.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if another simulation is open or the host
+		can't single step.
+
+*/
+
+{
+
+	struct sigaction Action;
+
+#if !defined(__x86_64__) && !defined(__i386__)
+	RPI_PRINT(InfoLevelError, "MemSim traps the register writes by single stepping, only on x86");
+	return -1;
+#endif
+
+	if (this == s_Active) {
+		return 0;
+	}
+
+	if (NULL != s_Active) {
+		RPI_PRINT(InfoLevelError, "Another MemSimBackend is open");
+		return -1;
+	}
+
+	memset(&Action, 0, sizeof(Action));
+	sigemptyset(&Action.sa_mask);
+	Action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	Action.sa_sigaction = &MemSimBackend::SegvHandler;
+	sigaction(SIGSEGV, &Action, &s_OldSegvAction);
+	Action.sa_sigaction = &MemSimBackend::TrapHandler;
+	sigaction(SIGTRAP, &Action, &s_OldTrapAction);
+	s_Active = this;
+	return 0;
+}
+
+void
+MemSimBackend::Close (
+	void
+)
+{
+	if (this == s_Active) {
+		sigaction(SIGSEGV, &s_OldSegvAction, NULL);
+		sigaction(SIGTRAP, &s_OldTrapAction, NULL);
+		s_Active = NULL;
+	}
+
+	return;
+}
+
+MemSimBackend::Block *
+MemSimBackend::FindBlock (
+	_In_ uint32_t PhyAddr,
+	_In_ size_t Len,
+	_In_ bool Create
+	)
+
+/*
+ Routine Description:
+
+	This routine finds the block holding a physical range.
+
+ Parameters:
+
+ 	PhyAddr - Supplies the start of the range.
+
+ 	Len - Supplies the length of the range.
+
+ 	Create - Supplies whether to create the block if there's none.
+
+ Return Value:
+
+	Block * - The block, NULL if none or the range overlaps a block only
+		partially.
+
+*/
+
+{
+
+	uint64_t Start = PageFloor(PhyAddr);
+	uint64_t End = PageCeil(static_cast<uint64_t>(PhyAddr) + ((0 != Len) ? Len : 1));
+	Block *Regs;
+	void *View;
+	int32_t Fd;
+
+	for (auto Existing : m_Blocks) {
+		uint64_t BlockEnd = static_cast<uint64_t>(Existing->m_PhyAddr) + Existing->m_Size;
+
+		if ((Start >= Existing->m_PhyAddr) && (End <= BlockEnd)) {
+			return Existing;
+		}
+
+		if ((Start < BlockEnd) && (End > Existing->m_PhyAddr)) {
+			RPI_PRINT_EX(InfoLevelError,
+						 "0x%08x+0x%zx overlaps the block at 0x%08x",
+						 PhyAddr,
+						 Len,
+						 Existing->m_PhyAddr);
+
+			return NULL;
+		}
+	}
+
+	if (!Create) {
+		return NULL;
+	}
+
+	Fd = memfd_create("memsim", MFD_CLOEXEC);
+	if (Fd < 0) {
+		RPI_PRINT_EX(InfoLevelError, "memfd_create failed, %s", strerror(errno));
+		return NULL;
+	}
+
+	if (0 != ftruncate(Fd, End - Start)) {
+		RPI_PRINT_EX(InfoLevelError, "ftruncate failed, %s", strerror(errno));
+		close(Fd);
+		return NULL;
+	}
+
+	View = mmap(NULL, End - Start, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+	if (MAP_FAILED == View) {
+		RPI_PRINT_EX(InfoLevelError, "mmap failed, %s", strerror(errno));
+		close(Fd);
+		return NULL;
+	}
+
+	Regs = new Block();
+	Regs->m_PhyAddr = static_cast<uint32_t>(Start);
+	Regs->m_Size = End - Start;
+	Regs->m_Fd = Fd;
+	Regs->m_View = static_cast<uint32_t *>(View);
+	m_Blocks.push_back(Regs);
+	return Regs;
+}
+
+void *
+MemSimBackend::Map (
+	_In_ uint32_t PhyAddr,
+	_In_ size_t Len
+	)
+
+/*
+ Routine Description:
+
+	This routine maps a register block for a driver. The driver gets a mapping
+	of its own of the block, so the registers sit at the same page offsets as
+	with /dev/mem, protected per the trap mode.
+
+ Parameters:
+
+ 	PhyAddr - Supplies the physical address of the registers.
+
+ 	Len - Supplies the length of the registers.
+
+ Return Value:
+
+	void * - The virtual address of PhyAddr, MAP_FAILED on failure.
+
+*/
+
+{
+
+	Block *Regs;
+	uint32_t Slot;
+	void *View;
+
+	Regs = FindBlock(PhyAddr, Len, true);
+	if (NULL == Regs) {
+		return MAP_FAILED;
+	}
+
+	for (Slot = 0; Slot < MAX_MAPPINGS; Slot++) {
+		if (0 == m_Mappings[Slot].Base) {
+			break;
+		}
+	}
+
+	if (MAX_MAPPINGS == Slot) {
+		RPI_PRINT(InfoLevelError, "Out of MemSim mappings");
+		return MAP_FAILED;
+	}
+
+	View = mmap(NULL, Regs->m_Size, GetProtection(), MAP_SHARED, Regs->m_Fd, 0);
+	if (MAP_FAILED == View) {
+		return MAP_FAILED;
+	}
+
+	m_Mappings[Slot].Size = Regs->m_Size;
+	m_Mappings[Slot].Regs = Regs;
+	__atomic_store_n(&m_Mappings[Slot].Base, reinterpret_cast<uintptr_t>(View), __ATOMIC_RELEASE);
+	return static_cast<uint8_t *>(View) + (PhyAddr - Regs->m_PhyAddr);
+}
+
+void
+MemSimBackend::Unmap (
+	_In_ void *Virt,
+	_In_ size_t Len
+	)
+{
+	SimMapping *Mapping;
+
+	(void)Len;
+	Mapping = const_cast<SimMapping *>(FindMapping(reinterpret_cast<uintptr_t>(Virt)));
+	if (NULL != Mapping) {
+		munmap(reinterpret_cast<void *>(Mapping->Base), Mapping->Size);
+		__atomic_store_n(&Mapping->Base, 0, __ATOMIC_RELEASE);
+	}
+
+	return;
+}
+
+const MemSimBackend::SimMapping *
+MemSimBackend::FindMapping (
+	_In_ uintptr_t Addr
+	)
+{
+	uintptr_t Base;
+
+	for (uint32_t i = 0; i < MAX_MAPPINGS; i++) {
+		Base = __atomic_load_n(&m_Mappings[i].Base, __ATOMIC_ACQUIRE);
+		if ((0 != Base) && (Addr >= Base) && (Addr < Base + m_Mappings[i].Size)) {
+			return &m_Mappings[i];
+		}
+	}
+
+	return NULL;
+}
+
+int32_t
+MemSimBackend::AddWriteHook (
+	_In_ uint32_t PhyAddr,
+	_In_ size_t Len,
+	_In_ MemSimWriteHook Hook
+	)
+{
+	Block *Regs;
+
+	Regs = FindBlock(PhyAddr, Len, true);
+	if (NULL == Regs) {
+		return ERROR_INVALID_PARAMETER;
+	}
+
+	Regs->m_Hooks.push_back(Hook);
+	return ERROR_SUCCESS;
+}
+
+int
+MemSimBackend::GetProtection (
+	void
+	)
+{
+	switch (m_TrapMode) {
+	case MEMSIM_TRAP_NONE:
+		return PROT_READ | PROT_WRITE;
+	case MEMSIM_TRAP_ALL:
+		return PROT_NONE;
+	default:
+		return PROT_READ;
+	}
+}
+
+void
+MemSimBackend::SetTrapMode (
+	_In_ MEMSIM_TRAP Mode
+	)
+{
+	uintptr_t Base;
+
+	while (s_StepLock.test_and_set(std::memory_order_acquire)) {
+	}
+
+	m_TrapMode = Mode;
+	for (uint32_t i = 0; i < MAX_MAPPINGS; i++) {
+		Base = __atomic_load_n(&m_Mappings[i].Base, __ATOMIC_ACQUIRE);
+		if (0 != Base) {
+			mprotect(reinterpret_cast<void *>(Base), m_Mappings[i].Size, GetProtection());
+		}
+	}
+
+	s_StepLock.clear(std::memory_order_release);
+	return;
+}
+
+uint64_t
+MemSimBackend::GetWriteCount (
+	void
+	)
+{
+	return m_Writes.load();
+}
+
+uint64_t
+MemSimBackend::GetReadCount (
+	void
+	)
+{
+	return m_Reads.load();
+}
+
+void
+MemSimBackend::DispatchWrite (
+	_In_ const SimMapping &Mapping,
+	_In_ uintptr_t Addr,
+	_In_ uint32_t Value,
+	_In_ uint32_t Previous
+	)
+{
+	uint32_t PhyAddr = Mapping.Regs->m_PhyAddr + static_cast<uint32_t>(Addr - Mapping.Base);
+
+	while (m_HookLock.test_and_set(std::memory_order_acquire)) {
+	}
+
+	for (auto &Hook : Mapping.Regs->m_Hooks) {
+		Hook(*Mapping.Regs, PhyAddr, Value, Previous);
+	}
+
+	m_HookLock.clear(std::memory_order_release);
+	m_Writes.fetch_add(1, std::memory_order_relaxed);
+	return;
+}
+
+void
+MemSimBackend::SegvHandler (
+	_In_ int Signal,
+	_In_ siginfo_t *Info,
+	_In_ void *Context
+	)
+
+/*
+ Routine Description:
+
+	This routine catches an access to a driver mapping. It takes the step
+	lock, opens the page and sets the trap flag, so the access completes and
+	TrapHandler() runs right after it.
+
+ Parameters:
+
+ 	Signal, Info, Context - Supplies the fault.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uintptr_t Addr = reinterpret_cast<uintptr_t>(Info->si_addr);
+	const SimMapping *Mapping = NULL;
+
+	if ((NULL != s_Active) && (NULL == s_Pending.Addr)) {
+		Mapping = s_Active->FindMapping(Addr);
+	}
+
+	if (NULL == Mapping) {
+		ChainSignal(s_OldSegvAction, Signal, Info, Context);
+		return;
+	}
+
+	while (s_StepLock.test_and_set(std::memory_order_acquire)) {
+	}
+
+	s_Pending.Addr = reinterpret_cast<volatile uint32_t *>(Addr & ~static_cast<uintptr_t>(0x3));
+	s_Pending.Page = PageFloor(Addr);
+	s_Pending.Mapping = Mapping;
+	mprotect(reinterpret_cast<void *>(s_Pending.Page), SIM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+	s_Pending.Previous = *s_Pending.Addr;
+
+#if defined(__x86_64__) || defined(__i386__)
+	s_Pending.Write = (0 != (static_cast<ucontext_t *>(Context)->uc_mcontext.gregs[REG_ERR] & X86_PF_WRITE));
+	static_cast<ucontext_t *>(Context)->uc_mcontext.gregs[REG_EFL] |= X86_TRAP_FLAG;
+#endif
+
+	return;
+}
+
+void
+MemSimBackend::TrapHandler (
+	_In_ int Signal,
+	_In_ siginfo_t *Info,
+	_In_ void *Context
+	)
+
+/*
+ Routine Description:
+
+	This routine runs after the trapped access, it closes the page again,
+	releases the step lock and hands a write to the hooks.
+
+ Parameters:
+
+ 	Signal, Info, Context - Supplies the trap.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	const SimMapping *Mapping;
+	uint32_t Value;
+
+	if (NULL == s_Pending.Addr) {
+		ChainSignal(s_OldTrapAction, Signal, Info, Context);
+		return;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	static_cast<ucontext_t *>(Context)->uc_mcontext.gregs[REG_EFL] &= ~X86_TRAP_FLAG;
+#endif
+
+	Value = *s_Pending.Addr;
+	mprotect(reinterpret_cast<void *>(s_Pending.Page), SIM_PAGE_SIZE, s_Active->GetProtection());
+	s_StepLock.clear(std::memory_order_release);
+	Mapping = static_cast<const SimMapping *>(s_Pending.Mapping);
+	if (s_Pending.Write) {
+		s_Active->DispatchWrite(*Mapping,
+								reinterpret_cast<uintptr_t>(s_Pending.Addr),
+								Value,
+								s_Pending.Previous);
+
+	} else {
+		s_Active->m_Reads.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	s_Pending.Addr = NULL;
+	return;
+}
+
+void
+MemSimBackend::UpdateLevels (
+	_Inout_ Block &Regs
+	)
+
+/*
+ Routine Description:
+
+	This routine recomputes GPLEVn from the outputs, the driven inputs and the
+	pulls, and latches the enabled events into GPEDSn. The caller holds
+	m_HookLock.
+
+ Parameters:
+
+ 	Regs - Supplies the GPIO block.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Detect;
+	uint64_t Fall;
+	uint32_t Fsel;
+	uint64_t Levels;
+	uint64_t Outputs = 0;
+	uint64_t Rise;
+
+	for (uint32_t Pin = 0; Pin < GPIO_PIN_COUNT; Pin++) {
+		Fsel = Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPFSELn), Pin / GPIO_PINS_PER_FSEL_WORD));
+		Fsel = (Fsel >> ((Pin % GPIO_PINS_PER_FSEL_WORD) * GPIO_FSEL_BITS)) & GPIO_FSEL_FIELD_MASK;
+		if (FSEL_OUTPUT == Fsel) {
+			Outputs |= 1ull << Pin;
+		}
+	}
+
+	Levels = (m_OutLevels & Outputs) |
+			 (m_InputLevels & m_InputMask & ~Outputs) |
+			 (m_PullUps & ~m_InputMask & ~Outputs);
+
+	Rise = Levels & ~m_Levels;
+	Fall = ~Levels & m_Levels;
+	m_Levels = Levels;
+
+	for (uint32_t Word = 0; Word < 2; Word++) {
+		uint32_t Shift = Word * 32;
+		uint32_t Edges;
+
+		Detect = ((Rise >> Shift) & (Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPRENn), Word)) |
+									 Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPARENn), Word)))) |
+				 ((Fall >> Shift) & (Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPFENn), Word)) |
+									 Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPAFENn), Word)))) |
+				 ((Levels >> Shift) & Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPHENn), Word))) |
+				 (~(Levels >> Shift) & Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPLENn), Word)));
+
+		Edges = Regs.Read(GpioReg(offsetof(GpioBase::GPIORegisters, GPEDSn), Word));
+		Regs.Write(GpioReg(offsetof(GpioBase::GPIORegisters, GPEDSn), Word), Edges | static_cast<uint32_t>(Detect));
+		Regs.Write(GpioReg(offsetof(GpioBase::GPIORegisters, GPLEVn), Word), static_cast<uint32_t>(Levels >> Shift));
+	}
+
+	return;
+}
+
+void
+MemSimBackend::GpioWrite (
+	_Inout_ Block &Regs,
+	_In_ uint32_t PhyAddr,
+	_In_ uint32_t Value,
+	_In_ uint32_t Previous
+	)
+
+/*
+ Routine Description:
+
+	This routine models a write to the GPIO block. GPSETn/GPCLRn latch the
+	outputs and read back 0, GPEDSn is write 1 to clear, the pull of a pin is
+	latched when GPPUDCLKn asserts its clock.
+
+ Parameters:
+
+ 	Regs - Supplies the GPIO block.
+
+ 	PhyAddr - Supplies the register written.
+
+ 	Value - Supplies the value written.
+
+ 	Previous - Supplies the value before.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Bits;
+	uint32_t Offset = PhyAddr - GPIO_PHY_ADDR;
+	uint32_t Word;
+
+	if (IsGpioReg(Offset, offsetof(GpioBase::GPIORegisters, GPSETn), Word)) {
+		m_OutLevels |= static_cast<uint64_t>(Value) << (Word * 32);
+		Regs.Write(PhyAddr, 0);
+
+	} else if (IsGpioReg(Offset, offsetof(GpioBase::GPIORegisters, GPCLRn), Word)) {
+		m_OutLevels &= ~(static_cast<uint64_t>(Value) << (Word * 32));
+		Regs.Write(PhyAddr, 0);
+
+	} else if (IsGpioReg(Offset, offsetof(GpioBase::GPIORegisters, GPEDSn), Word)) {
+		Regs.Write(PhyAddr, Previous & ~Value);
+
+	} else if (IsGpioReg(Offset, offsetof(GpioBase::GPIORegisters, GPPUDCLKn), Word)) {
+		Bits = static_cast<uint64_t>(Value) << (Word * 32);
+		if (PULL_UP == (Regs.Read(GPIO_PHY_ADDR + offsetof(GpioBase::GPIORegisters, GPPUD)) & 0x3)) {
+			m_PullUps |= Bits;
+
+		} else {
+			m_PullUps &= ~Bits;
+		}
+	}
+
+	//
+	// Level detection sets GPEDSn again right after it was cleared if the
+	// level is still there, like on the hardware.
+	//
+
+	UpdateLevels(Regs);
+	return;
+}
+
+void
+MemSimBackend::SetInputLevels (
+	_In_ uint64_t Mask,
+	_In_ uint64_t Levels
+	)
+{
+	while (m_HookLock.test_and_set(std::memory_order_acquire)) {
+	}
+
+	m_InputMask |= Mask;
+	m_InputLevels = (m_InputLevels & ~Mask) | (Levels & Mask);
+	if (NULL != m_GpioRegs) {
+		UpdateLevels(*m_GpioRegs);
+	}
+
+	m_HookLock.clear(std::memory_order_release);
+	return;
+}
+
+int32_t
+MemSimBackend::AddDefaultModels (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine adds the models of the peripherals used by the drivers. The
+	blocks are sized to cover every mapping the drivers make of them.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - ERROR_SUCCESS, or an error if a block can't be created.
+
+*/
+
+{
+
+	const uint32_t ClkBase = PERIPHERAL_PHY_BASE + GPIO_CLOCK_OFFSET;
+	const uint32_t PwmBase = PERIPHERAL_PHY_BASE + GPIO_PWM_OFFSET;
+	const uint32_t PcmBase = PERIPHERAL_PHY_BASE + GPIO_PCM_OFFSET;
+	const uint32_t DmaBase = PERIPHERAL_PHY_BASE + DMA_OFFSET;
+	const uint32_t I2CBase[2] = {
+		PERIPHERAL_PHY_BASE + GPIO_I2C0_OFFSET,
+		PERIPHERAL_PHY_BASE + GPIO_I2C1_OFFSET
+	};
+
+	int32_t Status;
+
+	Status = AddWriteHook(GPIO_PHY_ADDR,
+						  BLOCK_SIZE,
+						  [this](Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t Previous) {
+		GpioWrite(Regs, PhyAddr, Value, Previous);
+	});
+
+	if (ERROR_SUCCESS != Status) {
+		return Status;
+	}
+
+	m_GpioRegs = FindBlock(GPIO_PHY_ADDR, BLOCK_SIZE, false);
+
+	//
+	// Clock manager: the password reads back as 0, BUSY follows ENAB unless
+	// the generator is killed.
+	//
+
+	Status = AddWriteHook(ClkBase,
+						  BLOCK_SIZE,
+						  [ClkBase](Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t) {
+		for (auto Ctl : CM_CTL_OFFSET) {
+			if (PhyAddr == ClkBase + Ctl) {
+				Value &= ~(CM_PASSWD_MASK | CM_BUSY);
+				if ((0 != (Value & CM_ENAB)) && (0 == (Value & CM_KILL))) {
+					Value |= CM_BUSY;
+				}
+
+				Regs.Write(PhyAddr, Value);
+
+			} else if (PhyAddr == ClkBase + Ctl + sizeof(uint32_t)) {
+				Regs.Write(PhyAddr, Value & ~CM_PASSWD_MASK);
+			}
+		}
+	});
+
+	if (ERROR_SUCCESS != Status) {
+		return Status;
+	}
+
+	//
+	// PWM: the FIFO drains at once, so it's never full and always empty.
+	//
+
+	Status = AddWriteHook(PwmBase,
+						  BLOCK_SIZE,
+						  [PwmBase](Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t Previous) {
+		switch (PhyAddr - PwmBase) {
+		case offsetof(GpioPwm::PWMCtrlRegisters, CTL):
+			Regs.Write(PhyAddr, Value & ~PWM_CTL_CLRF1);
+			break;
+
+		case offsetof(GpioPwm::PWMCtrlRegisters, STA):
+			Regs.Write(PhyAddr, (Previous & ~(Value & PWM_STA_W1C) & ~PWM_STA_FULL1) | PWM_STA_EMPT1);
+			break;
+
+		case offsetof(GpioPwm::PWMCtrlRegisters, FIF1):
+			Regs.Write(PhyAddr, 0);
+			break;
+
+		default:
+			break;
+		}
+	});
+
+	if (ERROR_SUCCESS != Status) {
+		return Status;
+	}
+
+	FindBlock(PwmBase, BLOCK_SIZE, false)->Write(PwmBase + offsetof(GpioPwm::PWMCtrlRegisters, STA), PWM_STA_EMPT1);
+
+	//
+	// PCM: the same for its TX FIFO, the clear bits are one shot.
+	//
+
+	Status = AddWriteHook(PcmBase,
+						  BLOCK_SIZE,
+						  [PcmBase](Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t Previous) {
+		switch (PhyAddr - PcmBase) {
+		case offsetof(GpioDmaPwm::PCMRegisters, CS):
+			Regs.Write(PhyAddr,
+					   (Value & ~(PCM_CS_W1C | PCM_CS_TXCLR | PCM_CS_RXCLR)) |
+					   (Previous & ~Value & PCM_CS_W1C) |
+					   PCM_CS_READY);
+			break;
+
+		case offsetof(GpioDmaPwm::PCMRegisters, FIFO):
+			Regs.Write(PhyAddr, 0);
+			break;
+
+		default:
+			break;
+		}
+	});
+
+	if (ERROR_SUCCESS != Status) {
+		return Status;
+	}
+
+	FindBlock(PcmBase, BLOCK_SIZE, false)->Write(PcmBase + offsetof(GpioDmaPwm::PCMRegisters, CS), PCM_CS_READY);
+
+	//
+	// BSC: a transfer is DONE as soon as it starts, reads return 0 from an
+	// always ready FIFO.
+	//
+
+	for (auto I2C : I2CBase) {
+		Status = AddWriteHook(I2C,
+							  BLOCK_SIZE,
+							  [I2C](Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t Previous) {
+			const uint32_t S = I2C + offsetof(GpioI2C::I2CRegisters, S);
+
+			switch (PhyAddr - I2C) {
+			case offsetof(GpioI2C::I2CRegisters, C):
+				if (0 != (Value & I2C_C_ST)) {
+					Regs.Write(S, (Regs.Read(S) & ~I2C_S_TA) | I2C_S_DONE);
+				}
+
+				Regs.Write(PhyAddr, Value & ~(I2C_C_ST | I2C_C_CLEAR));
+				break;
+
+			case offsetof(GpioI2C::I2CRegisters, S):
+				Regs.Write(PhyAddr, (Previous & ~(Value & I2C_S_W1C) & ~I2C_S_TA) | I2C_S_READY);
+				break;
+
+			case offsetof(GpioI2C::I2CRegisters, FIFO):
+				Regs.Write(PhyAddr, 0);
+				break;
+
+			default:
+				break;
+			}
+		});
+
+		if (ERROR_SUCCESS != Status) {
+			return Status;
+		}
+
+		FindBlock(I2C, BLOCK_SIZE, false)->Write(I2C + offsetof(GpioI2C::I2CRegisters, S), I2C_S_READY);
+	}
+
+	//
+	// DMA: a started channel ends at once, END/INT are write 1 to clear and
+	// RESET clears the channel.
+	//
+
+	Status = AddWriteHook(DmaBase,
+						  sizeof(DMACtrl::DMAReg_t),
+						  [DmaBase](Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t Previous) {
+		uint32_t Offset = PhyAddr - DmaBase - offsetof(DMACtrl::DMAReg_t, ch);
+		uint32_t CbAddr = PhyAddr - offsetof(DMACtrl::DMAChannel_t, cs) + offsetof(DMACtrl::DMAChannel_t, cbAddr);
+
+		if ((Offset >= DMA_CHANNEL_COUNT * sizeof(DMACtrl::DMAChannel_t)) ||
+			(offsetof(DMACtrl::DMAChannel_t, cs) != Offset % sizeof(DMACtrl::DMAChannel_t))) {
+			return;
+		}
+
+		if (0 != (Value & DMA_CS_RESET)) {
+			Regs.Write(PhyAddr, 0);
+			Regs.Write(CbAddr, 0);
+			return;
+		}
+
+		Value = (Value & ~(DMA_CS_W1C | DMA_CS_ONE_SHOT)) | (Previous & ~Value & DMA_CS_W1C);
+		if (0 != (Value & DMA_CS_ACTIVE)) {
+			Value = (Value & ~DMA_CS_ACTIVE) | DMA_CS_END;
+			Regs.Write(CbAddr, 0);
+		}
+
+		Regs.Write(PhyAddr, Value);
+	});
+
+	return Status;
+}
+
+void
+MemSimDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine, it runs GpioOut and GpioIn against the simulated
+	GPIO block and checks what they see.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	const int32_t OutPin = 5;
+	const int32_t InPin = 16;
+	MemSimBackend Sim;
+	uint32_t Failures = 0;
+
+	Sim.AddDefaultModels();
+	MemBase::SetBackend(&Sim);
+
+	{
+		GpioOut Out(OutPin);
+		GpioIn In(InPin, GpioIn::InputRising);
+
+		GpioOut::Update(GpioOut::PinMask(OutPin), 0);
+		if (0 == (GpioIn::readLevels() & GpioOut::PinMask(OutPin))) {
+			RPI_PRINT_EX(InfoLevelError, "GPIO%d didn't go high", OutPin);
+			Failures += 1;
+		}
+
+		Sim.SetInputLevels(GpioOut::PinMask(InPin), 0);
+		Sim.SetInputLevels(GpioOut::PinMask(InPin), GpioOut::PinMask(InPin));
+		Sim.SetInputLevels(GpioOut::PinMask(InPin), 0);
+		if ((0 != In.getValue()) || (0 == In.checkEvent())) {
+			RPI_PRINT_EX(InfoLevelError, "Pulse on GPIO%d not latched", InPin);
+			Failures += 1;
+		}
+
+		In.clearEventReg();
+		if (0 != In.checkEvent()) {
+			RPI_PRINT_EX(InfoLevelError, "Event of GPIO%d not cleared", InPin);
+			Failures += 1;
+		}
+	}
+
+	MemBase::SetBackend(NULL);
+	RPI_PRINT_EX(InfoLevelInfo,
+				 "MemSim demo done, %llu register writes, %u failures",
+				 Sim.GetWriteCount(),
+				 Failures);
+
+	return;
+}
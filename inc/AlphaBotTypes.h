@@ -21,6 +21,7 @@
 #define _Out_
 #define _In_opt_
 #define _Out_opt_
+#define _Inout_
 
 #define ADDRESS_TO_VOLATILE_POINTER(_addr_) \
     const_cast<volatile uint32_t *>(reinterpret_cast<uint32_t *>(_addr_))
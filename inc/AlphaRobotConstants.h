@@ -50,6 +50,66 @@
 #define PITCH_MOTOR_RANGE			60
 #define PITCH_MOTOR_MAX				(PITCH_MOTOR_MIN + PITCH_MOTOR_RANGE)
 
+//
+// Camera motion limits in PCA9685 counts (of 4096) per second. The SG90 turns
+// 60 degrees in 0.1s, about 680 counts per second, keep well below it. The trajectory
+// is updated once per PWM period, a faster rate wouldn't reach the servos.
+//
+
+#define CAMERA_MOTOR_MAX_VELOCITY	200.0f
+#define CAMERA_MOTOR_MAX_ACCEL		800.0f
+#define CAMERA_TRAJECTORY_RATE_HZ	50
+
+//
+// DMA channel and waveform of the software PWM driving the TB6612FNG PWMA/PWMB
+// inputs: 100 slots of 10us, 1KHz with 1% resolution. Channel 14 is the last
+// lite channel, the WS2812B stream uses 10.
+//
+
+#define MOTOR_PWM_DMA_CHANNEL		14
+#define MOTOR_PWM_SLOT_US			10
+#define MOTOR_PWM_SLOTS				100
+
+//
+// Control rate of the differential drive, and its default ramp: speeds are
+// normalized to -1.0..1.0, so 2.0 goes from stop to full speed in 0.5s.
+//
+
+#define DIFF_DRIVE_RATE_HZ			100
+#define DIFF_DRIVE_MAX_ACCEL		2.0f
+
+//
+// Joystick pins, the buttons short them to ground. They are polled at 1KHz
+// and a level must hold for 8 samples (8ms) to count. A button held for
+// 500ms reports a hold, then repeats every 100ms.
+//
+
+#define JOYSTICK_PIN_CENTER			7
+#define JOYSTICK_PIN_FRONT			8
+#define JOYSTICK_PIN_RIGHT			9
+#define JOYSTICK_PIN_LEFT			10
+#define JOYSTICK_PIN_REVERSE		11
+
+#define JOYSTICK_POLL_HZ			1000
+#define JOYSTICK_DEBOUNCE_SAMPLES	8
+#define JOYSTICK_HOLD_MS			500
+#define JOYSTICK_REPEAT_MS			100
+
+//
+// Wheel encoders. The AlphaBot2 has no encoder connector, so no pins are
+// assumed: an A pin of -1 leaves that wheel out, pass the pins the encoders
+// are wired to. A B pin of -1 is a single channel (pulse counting) encoder.
+// The edge detect status is polled every 20us, fast enough for edges at
+// several KHz, and the speed drops to 0 when no edge comes for 200ms.
+//
+
+#define WHEEL_ENCODER_LEFT_A		-1
+#define WHEEL_ENCODER_LEFT_B		-1
+#define WHEEL_ENCODER_RIGHT_A		-1
+#define WHEEL_ENCODER_RIGHT_B		-1
+#define WHEEL_ENCODER_POLL_US		20
+#define WHEEL_ENCODER_TIMEOUT_MS	200
+
 
 //
 // WS2812B pin number
@@ -57,4 +117,24 @@
 
 #define WS2812B_PIN					18
 
+//
+// Number of WS2812B LEDs on the robot, longer strips may hang off the pin.
+//
+
+#define WS2812B_LED_COUNT			4
+
+//
+// Gamma of the WS2812B color channels, so the brightness and color values
+// scale as perceived rather than as PWM duty.
+//
+
+#define WS2812B_GAMMA				2.2
+
+//
+// DMA channel which feeds the PWM FIFO in WS2812B streaming mode. Channel 10
+// is not used by the Raspbian kernel.
+//
+
+#define WS2812B_DMA_CHANNEL			10
+
 #endif /* ALPHAROBOTCONSTANTS_H_ */
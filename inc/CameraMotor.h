@@ -64,6 +64,21 @@ public:
 		_In_ int32_t Position
 	);
 
+	//
+	// Updates the PCA9685 mirror only, the caller flushes the controller, so
+	// several motors on the same module move in one I2C transaction.
+	//
+
+	int32_t
+	StagePosition (
+		_In_ int32_t Position
+	);
+
+	int32_t GetPosition();
+	int32_t GetMinPosition();
+	int32_t GetMaxPosition();
+	PCA9685Ctrl *GetController();
+
 private:
 
 	//
@@ -74,5 +89,6 @@ private:
 	float m_PWMFreq;
 	int32_t m_MinPosition;
 	int32_t m_MaxPosition;
+	int32_t m_Position;
 	PCA9685Ctrl *m_PCA9685Controller;
 };
@@ -0,0 +1,131 @@
+/*
+ * CameraTrajectory.h
+ *
+ *  Created on: Feb 6, 2021
+ *      Author: Albert Guan
+ *
+ *  This module implements the declaration of the camera trajectory engine
+ *  for AlphaRobot 2.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "CameraMotor.h"
+
+/*
+ * CameraTrajectory moves a set of camera motors through waypoints.
+ *
+ * Each move from one waypoint to the next follows a trapezoidal velocity
+ * profile. The profile is planned on the normalized path s = 0..1, with the
+ * velocity and acceleration limits of every axis scaled by the distance it
+ * travels, and the tightest of them is used. So all axes start and stop
+ * together, and none of them goes over its own limits.
+ *
+ * The engine runs at a fixed rate (absolute RpiSleepUntilNs() deadlines, so the
+ * period doesn't drift). On each tick every motor is staged to the PCA9685
+ * mirror, then the controller is flushed once: adjacent channels go out in a
+ * single I2C transaction, and motors which didn't move cost nothing.
+ */
+
+class CameraTrajectory
+{
+public:
+
+	CameraTrajectory (
+		_In_ PCA9685Ctrl &Controller,
+		_In_ uint32_t RateHz = CAMERA_TRAJECTORY_RATE_HZ
+	);
+
+	~CameraTrajectory (
+		void
+	);
+
+	//
+	// Limits are in PCA9685 counts per second (per second).
+	//
+
+	int32_t
+	AddAxis (
+		_In_ CameraMotor &Motor,
+		_In_ float MaxVelocity = CAMERA_MOTOR_MAX_VELOCITY,
+		_In_ float MaxAccel = CAMERA_MOTOR_MAX_ACCEL
+	);
+
+	//
+	// One position per axis, in the order they were added. The motors stay
+	// DwellMs at the waypoint before moving to the next one.
+	//
+
+	int32_t
+	AddWaypoint (
+		_In_ const std::vector<int32_t> &Positions,
+		_In_ uint32_t DwellMs = 0
+	);
+
+	int32_t
+	Run (
+		void
+	);
+
+	void
+	Stop (
+		void
+	);
+
+	uint32_t GetMaxLatenessUs();
+
+private:
+
+	typedef struct _CameraAxis_ {
+		CameraMotor *Motor;
+		float MaxVelocity;
+		float MaxAccel;
+	} CameraAxis;
+
+	typedef struct _CameraWaypoint_ {
+		std::vector<int32_t> Positions;
+		uint32_t DwellMs;
+	} CameraWaypoint;
+
+	//
+	// Trapezoidal profile of the normalized path, s(0) = 0 and s(Duration) = 1.
+	//
+
+	typedef struct _CameraProfile_ {
+		float Velocity;			//Cruise velocity
+		float Accel;
+		float AccelTime;		//Time to reach the cruise velocity
+		float Duration;
+	} CameraProfile;
+
+	void
+	PlanSegment (
+		_In_ const std::vector<int32_t> &From,
+		_In_ const std::vector<int32_t> &To,
+		_Out_ CameraProfile &Profile
+	);
+
+	static
+	float
+	Evaluate (
+		_In_ const CameraProfile &Profile,
+		_In_ float Time
+	);
+
+	void
+	WaitNextTick (
+		_Inout_ uint64_t &Deadline
+	);
+
+	PCA9685Ctrl *m_Controller;
+	uint32_t m_PeriodNs;
+	std::vector<CameraAxis> m_Axes;
+	std::deque<CameraWaypoint> m_Waypoints;
+	std::mutex m_WaypointLock;
+	std::atomic<int32_t> m_Stop;
+	uint32_t m_MaxLatenessUs;
+};
@@ -9,6 +9,7 @@
 #include "Rpi3BConstants.h"
 #include "WS2812BCtrl.h"
 #include "MemBase.h"
+#include "AlphaBotTypes.h"
 
 /*
  * processor documentation for RPI1 at: http://www.raspberrypi.org/wp-content/uploads/2012/02/BCM2835-ARM-Peripherals.pdf
@@ -17,6 +18,8 @@
 
 int dma_main();
 
+class DMABuffer;
+
 class DMACtrl : public MemBase
 {
 public:
@@ -147,6 +150,7 @@ public:
 	~DMACtrl();
 
 	static int32_t GeneralInit(int32_t channel_num);
+	static void GeneralUninit(int32_t channel_num);
 	static void MarkChannelInUse(int32_t channel_num);
 	static int32_t AllocMemory(volatile void **vir);
 	static void FreeMemory(volatile void **vir);
@@ -156,6 +160,7 @@ public:
 
 	volatile void *getSrcVirtAddr();
 	uint32_t getSrcPhyAddr();
+	uint32_t getSrcLen();
 	volatile DMACtrlBlock_t *getCBVirtAddr();
 	uint32_t getCBPhyAddr();
 	volatile void *AllocateDestMem();
@@ -164,7 +169,20 @@ public:
 
 	void dma_demo();
 
+	//0 if the channel couldn't be claimed or its buffer allocated, the channel isn't touched then
+	int32_t IsValid();
+
+	static uint32_t PhyToBus(volatile void *phy);
+	static uint32_t PhyToBus(uint32_t phy);
+	int32_t SetupPeripheralTx(uint32_t len, uint32_t dest_bus_addr, uint32_t peripheral);
+	void Start();
+	void Stop();
+	int32_t IsBusy();
+	int32_t WaitForCompletion(uint32_t timeout_us);
+
 	friend class WS2812BCtrl;
+	friend class DMAScheduler;
+	friend class GpioDmaPwm;
 
 	enum
 	{
@@ -175,18 +193,23 @@ public:
 		SMI		= 4,
 		PWM		= 5
 	};
+
+	static const uint32_t NO_NEXT_CB = 0x00000000;	//When nextCB is set to it, DMA controller won't load further CBs, and stop the DMA after current transfer
 private:
 	static const uint32_t DMA_BASE_ADDR = PERIPHERAL_PHY_BASE + DMA_OFFSET;
-	static const uint32_t NO_NEXT_CB = 0x00000000;	//When nextCB is set to it, DMA controller won't load further CBs, and stop the DMA after current transfer
+	static const uint32_t DMA_PRIORITY = 8;
+	static const uint32_t DMA_PANIC_PRIORITY = 8;
 	static uint32_t channel_in_use;
 	static volatile DMAReg_t *dma_regs;
 	static int32_t dma_instances;
 
 	int32_t m_ch;
+	DMABuffer *m_src;					//Source buffer, it also owns the CB chain
 	volatile void *m_src_virtual;
 	volatile void *m_src_physical;
 	volatile void *m_dest_virtual;
 	volatile void *m_dest_physical;
 	volatile void *m_cb_virtual;
 	volatile void *m_cb_physical;
+	uint32_t m_src_len;
 };
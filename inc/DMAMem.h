@@ -0,0 +1,247 @@
+/*
+ * DMAMem.h
+ *
+ *  Created on: Jan 9, 2021
+ *      Author: Albert Guan
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "DMA.h"
+
+/*
+ * The DMA engine only sees physical (bus) addresses, while a user space
+ * buffer is only virtually contiguous. DMAMemPool hands out locked buffers of
+ * any size, each page is resolved to its physical address once at allocation
+ * time, physically contiguous pages are merged into segments, and every
+ * segment gets a DMA control block. The CBs are chained in order, so a whole
+ * buffer is moved by loading the first CB to a channel.
+ *
+ * Freed buffers stay locked for reuse, up to MAX_CACHED_PAGES pages; the
+ * cache is dropped when the last DMA user goes away.
+ *
+ * Note: mlock keeps the pages in RAM but doesn't pin their physical address,
+ * the kernel may still migrate them (e.g. memory compaction) and the DMA
+ * engine would then access a stale page. Buffers allocated through the VC
+ * mailbox (/dev/vcio) don't have this limitation, they are not used here.
+ */
+
+/*
+ * PageMap translates virtual addresses of this process to physical addresses
+ * through /proc/self/pagemap (one 64 bits entry per page, PFN in bit 0-54,
+ * "present" in bit 63). The file stays open, a range of pages is resolved by a
+ * single pread, and the result is cached per locked buffer until it's freed.
+ * Note: PFNs are only visible to processes with CAP_SYS_ADMIN.
+ */
+
+class PageMap
+{
+public:
+
+	static
+	int32_t
+	Translate (
+		_In_ volatile void *Virt,
+		_In_ uint32_t Pages,
+		_Out_ std::vector<uint32_t> &PhyAddrs
+	);
+
+	static
+	int32_t
+	Lookup (
+		_In_ volatile void *Virt,
+		_Out_ uint32_t *PhyAddr
+	);
+
+	static
+	void
+	Forget (
+		_In_ volatile void *Virt
+	);
+
+	static
+	void
+	Close (
+		void
+	);
+
+private:
+
+	static
+	int32_t
+	Open (
+		void
+	);
+
+	static
+	int32_t
+	ReadEntries (
+		_In_ uintptr_t FirstPage,
+		_In_ uint32_t Pages,
+		_Out_ std::vector<uint32_t> &PhyAddrs
+	);
+
+	static const uint64_t PAGEMAP_PFN_MASK = (1ull << 55) - 1;
+	static const uint64_t PAGEMAP_PRESENT = 1ull << 63;
+
+	//
+	// Translated ranges keyed by the virtual address of their first page.
+	//
+
+	static std::map<uintptr_t, std::vector<uint32_t>> Cache;
+	static std::mutex CacheLock;
+	static int32_t PagemapFd;
+};
+
+class DMABuffer
+{
+public:
+
+	//
+	// A physically contiguous piece of the buffer.
+	//
+
+	typedef struct _DMASegment_ {
+		uint32_t Offset;		//Offset from the start of the buffer
+		uint32_t BusAddr;		//Bus address seen by the DMA engine
+		uint32_t Len;			//Length in bytes
+	} DMASegment, *PDMASegment;
+
+	volatile void *GetVirtAddr();
+	uint32_t GetSize();
+	const std::vector<DMASegment> &GetSegments();
+	uint32_t GetBusAddr(uint32_t Offset);
+
+	volatile DMACtrl::DMACtrlBlock_t *GetCBs();
+	uint32_t GetNumCBs();
+	uint32_t GetCBBusAddr(uint32_t Idx = 0);
+
+	int32_t
+	ChainAsSource (
+		_In_ uint32_t Len,
+		_In_ uint32_t DestBusAddr,
+		_In_ int32_t DestInc,
+		_In_ uint32_t Peripheral = DMACtrl::NO_USE
+	);
+
+	int32_t
+	ChainAsDest (
+		_In_ uint32_t Len,
+		_In_ uint32_t SrcBusAddr,
+		_In_ int32_t SrcInc,
+		_In_ uint32_t Peripheral = DMACtrl::NO_USE
+	);
+
+private:
+	friend class DMAMemPool;
+
+	DMABuffer();
+	~DMABuffer();
+
+	int32_t
+	Chain (
+		_In_ uint32_t Len,
+		_In_ uint32_t PeerBusAddr,
+		_In_ int32_t PeerInc,
+		_In_ uint32_t Peripheral,
+		_In_ int32_t IsSource
+	);
+
+	volatile void *m_Virt;
+	uint32_t m_Size;
+	uint32_t m_Pages;
+	std::vector<DMASegment> m_Segments;
+
+	volatile DMACtrl::DMACtrlBlock_t *m_CBs;
+	uint32_t m_CBPages;
+	std::vector<uint32_t> m_CBPageBusAddr;
+};
+
+class DMAMemPool
+{
+public:
+
+	static
+	DMABuffer *
+	Alloc (
+		_In_ uint32_t Size
+	);
+
+	static
+	void
+	Free (
+		_In_ DMABuffer *Buffer
+	);
+
+	static
+	void
+	Trim (
+		void
+	);
+
+	//
+	// Lite channels (7-14) only have 16 bits TXFR_LEN, keep segments page aligned.
+	//
+
+	static const uint32_t MAX_SEGMENT_LEN = 0xF000;
+
+	//
+	// Pages of freed buffers kept locked for reuse, 1MB.
+	//
+
+	static const uint32_t MAX_CACHED_PAGES = 256;
+
+private:
+
+	static
+	volatile void *
+	MapPages (
+		_In_ uint32_t Pages
+	);
+
+	static
+	void
+	UnmapPages (
+		_In_ volatile void *Virt,
+		_In_ uint32_t Pages
+	);
+
+	static
+	int32_t
+	ResolvePages (
+		_In_ volatile void *Virt,
+		_In_ uint32_t Pages,
+		_Out_ std::vector<uint32_t> &BusAddrs
+	);
+
+	static
+	int32_t
+	Populate (
+		_In_ DMABuffer *Buffer
+	);
+
+	static
+	void
+	Release (
+		_In_ DMABuffer *Buffer
+	);
+
+	static
+	void
+	TrimLocked (
+		_In_ uint32_t MaxPages
+	);
+
+	//
+	// Freed buffers are kept for reuse, keyed by the number of pages, so the
+	// pages don't need to be locked and resolved again.
+	//
+
+	static std::multimap<uint32_t, DMABuffer *> FreeBuffers;
+	static uint32_t CachedPages;
+	static std::mutex PoolLock;
+};
@@ -0,0 +1,126 @@
+/*
+ * DMAScheduler.h
+ *
+ *  Created on: Jan 16, 2021
+ *      Author: Albert Guan
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "DMA.h"
+#include "DMAMem.h"
+
+/*
+ * DMAScheduler owns a DMA channel and a ring of control blocks. A transfer is
+ * queued by writing the next free CB and linking it behind the last queued
+ * one, so the engine runs queued transfers back to back without the CPU.
+ *
+ * Linking a CB to a running chain races with the engine, which copies
+ * NEXTCONBK into its registers when it loads a CB. So the channel is paused
+ * while linking, and if it is executing the previous CB, the NEXTCONBK
+ * register is updated as well. If the channel went idle, it's restarted at the
+ * new CB.
+ *
+ * Completion is tracked from CONBLK_AD: every CB before the one the engine is
+ * executing is done, and all of them are done once it reads 0. Poll() reports
+ * completions through callbacks, Wait() polls until a ticket is done and
+ * returns its status.
+ */
+
+class DMAScheduler : public MemBase
+{
+public:
+
+	typedef enum _DMATransferStatus_ {
+		DMA_TRANSFER_DONE = 0,
+		DMA_TRANSFER_ERROR,
+		DMA_TRANSFER_ABORTED
+	} DMATransferStatus;
+
+	typedef std::function<void(int64_t Ticket, DMATransferStatus Status)> DMACallback;
+
+	DMAScheduler (
+		_In_ int32_t Channel,
+		_In_ uint32_t RingSize = DEFAULT_RING_SIZE
+	);
+
+	virtual
+	~DMAScheduler (
+		void
+	);
+
+	int64_t
+	Queue (
+		_In_ const DMACtrl::DMACtrlBlock_t &CB,
+		_In_ DMACallback Callback = nullptr
+	);
+
+	int64_t
+	QueueCopy (
+		_In_ uint32_t SrcBusAddr,
+		_In_ uint32_t DestBusAddr,
+		_In_ uint32_t Len,
+		_In_ DMACallback Callback = nullptr
+	);
+
+	uint32_t
+	Poll (
+		void
+	);
+
+	int32_t
+	Wait (
+		_In_ int64_t Ticket,
+		_In_ uint32_t TimeoutUs
+	);
+
+	int32_t
+	IsIdle (
+		void
+	);
+
+	uint32_t
+	GetFreeSlots (
+		void
+	);
+
+	static const uint32_t DEFAULT_RING_SIZE = 64;
+
+private:
+
+	typedef struct _DMASlot_ {
+		int64_t Ticket;
+		DMACallback Callback;
+		DMATransferStatus Status;		//Kept after retiring, until the slot is reused
+	} DMASlot;
+
+	typedef struct _DMACompletion_ {
+		int64_t Ticket;
+		DMACallback Callback;
+		DMATransferStatus Status;
+	} DMACompletion;
+
+	volatile DMACtrl::DMAChannel_t *GetChannelRegs();
+	volatile DMACtrl::DMACtrlBlock_t *GetCB(uint32_t Idx);
+	uint32_t GetCBBusAddr(uint32_t Idx);
+	void SetActive(int32_t Active);
+	void ResetChannel();
+	void Complete(DMATransferStatus Status, std::vector<DMACompletion> &Done);
+
+	int32_t m_Channel;
+	uint32_t m_RingSize;
+	DMABuffer *m_Ring;
+	std::vector<DMASlot> m_Slots;
+	uint32_t m_Head;				//Oldest in-flight slot
+	uint32_t m_Tail;				//Next free slot
+	uint32_t m_Count;				//Number of in-flight slots
+	int64_t m_NextTicket;
+	int64_t m_LastCompleted;
+	std::recursive_mutex m_Lock;
+};
+
+void DMASchedulerDemo();
@@ -8,6 +8,8 @@
 #ifndef DIAG_H_
 #define DIAG_H_
 
+#include <stdint.h>
+
 typedef enum _InfoLevel_ {
 	InfoLevelDebug = 0,
 	InfoLevelInfo,
@@ -36,6 +38,30 @@ RpiPrint (
 	...
 	);
 
+//
+// CLOCK_MONOTONIC, the clock of all timestamps and deadlines of the drivers.
+//
+
+uint64_t
+RpiGetTimeNs (
+	void
+	);
+
+uint64_t
+RpiGetTimeUs (
+	void
+	);
+
+//
+// Sleeps until an absolute RpiGetTimeNs() deadline, so a fixed-rate loop adding
+// its period to the deadline doesn't drift with the time spent on each tick.
+//
+
+void
+RpiSleepUntilNs (
+	uint64_t DeadlineNs
+	);
+
 #define RPI_PRINT(level, msg) \
 	RpiPrint(level, __func__, __LINE__, msg)
 
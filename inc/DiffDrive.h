@@ -0,0 +1,135 @@
+/*
+ * DiffDrive.h
+ *
+ *  Created on: Feb 20, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "AlphaBotTypes.h"
+#include "AlphaRobotConstants.h"
+#include "MotorCtrl.h"
+
+/*
+ * DiffDrive drives the two wheels of the robot independently: the left wheel
+ * is motor A of the TB6612FNG, the right wheel is motor B.
+ *
+ * Velocities are normalized, -1.0 (full backward) to 1.0 (full forward).
+ * Commands only set the targets, a control thread running at a fixed rate
+ * ramps the outputs towards them within the acceleration limit, and applies
+ * both wheels at once on each tick: one GPIO write for the directions, one
+ * waveform swap of the DMA PWM for the speeds.
+ *
+ * Without feedback the output is the command (open loop). Once a feedback
+ * routine reporting the measured wheel velocities is set (e.g. wheel
+ * encoders), a PI controller per wheel corrects the output.
+ */
+
+class DiffDrive
+{
+public:
+
+	//
+	// Reports the measured velocities, normalized like the commands. Returns
+	// 0 if they are valid.
+	//
+
+	typedef std::function<int32_t(float *Left, float *Right)> DiffDriveFeedback;
+
+	DiffDrive (
+		_In_ MotorCtrl &Motors,
+		_In_ uint32_t RateHz = DIFF_DRIVE_RATE_HZ,
+		_In_ float MaxAccel = DIFF_DRIVE_MAX_ACCEL
+	);
+
+	virtual
+	~DiffDrive (
+		void
+	);
+
+	void
+	SetVelocity (
+		_In_ float Left,
+		_In_ float Right
+	);
+
+	//
+	// Linear is the forward velocity, Angular turns left when positive. Both
+	// wheels are scaled down together if one of them would be over 1.0, so
+	// the arc is kept.
+	//
+
+	void
+	SetTwist (
+		_In_ float Linear,
+		_In_ float Angular
+	);
+
+	void
+	Stop (
+		void
+	);
+
+	void
+	SetFeedback (
+		_In_ DiffDriveFeedback Feedback,
+		_In_ float Kp,
+		_In_ float Ki
+	);
+
+	void
+	GetOutput (
+		_Out_ float *Left,
+		_Out_ float *Right
+	);
+
+private:
+
+	void
+	ControlLoop (
+		void
+	);
+
+	float
+	Ramp (
+		_In_ float Current,
+		_In_ float Target
+	);
+
+	float
+	Correct (
+		_In_ float Target,
+		_In_ float Measured,
+		_Inout_ float &Integral
+	);
+
+	MotorCtrl *m_Motors;
+	uint32_t m_PeriodNs;
+	float m_MaxStep;				//Max change of a ramp per tick
+
+	std::mutex m_Lock;
+	float m_TargetLeft;
+	float m_TargetRight;
+	float m_RampLeft;				//Ramped command, only used by the loop
+	float m_RampRight;
+	float m_OutputLeft;
+	float m_OutputRight;
+	DiffDriveFeedback m_Feedback;
+	float m_Kp;
+	float m_Ki;
+	float m_IntegralLeft;
+	float m_IntegralRight;
+
+	std::atomic<int32_t> m_StopLoop;
+	std::thread m_Thread;
+};
+
+void
+DiffDriveDemo (
+	void
+);
@@ -20,6 +20,12 @@
 
 #define ERROR_SUCCESS					0x0
 
+//
+// The operation has been queued but hasn't finished yet.
+//
+
+#define ERROR_PENDING					0x1
+
 //
 // Failed to mmap registers
 //
@@ -44,4 +50,40 @@
 
 #define ERROR_CHANNEL_OCCUPIED			0x80000004
 
+//
+// The operation didn't finish before its deadline.
+//
+
+#define ERROR_TIMEOUT					0x80000005
+
+//
+// The operation was cancelled before it finished, e.g. the device was closed.
+//
+
+#define ERROR_ABORTED					0x80000006
+
+//
+// I2C slave didn't acknowledge its address (S.ERR).
+//
+
+#define ERROR_I2C_NACK					0x80000007
+
+//
+// I2C slave stretched the clock longer than CLKT.TOUT (S.CLKT).
+//
+
+#define ERROR_I2C_CLOCK_STRETCH			0x80000008
+
+//
+// A parameter is out of range or the object is in the wrong state for the call.
+//
+
+#define ERROR_INVALID_PARAMETER			0x80000009
+
+//
+// A system call failed, errno tells why.
+//
+
+#define ERROR_SYSTEM_CALL				0x8000000A
+
 #endif /* INC_ERRORCODE_H_ */
@@ -13,6 +13,9 @@
 #include "MemBase.h"
 #include "AlphaBotTypes.h"
 #include "AlphaRobotConstants.h"
+#include "GpioPinSet.h"
+
+class GpioConfigBatch;
 
 class GpioBase : public MemBase
 {
@@ -90,9 +93,15 @@ public:
 		const uint32_t rev_0x7E20_00A0[4];
 	} GPIORegisters, *PGPIORegisters;
 
+	//
+	// With a Batch, the pin selection is recorded into it and programmed by
+	// GpioConfigBatch::Apply() instead of being written right away.
+	//
+
 	GpioBase (
 		const std::vector<int32_t> &Pins,
-		GPIO_FUN_SELECT PinSelect = FSEL_INPUT
+		GPIO_FUN_SELECT PinSelect = FSEL_INPUT,
+		_In_opt_ GpioConfigBatch *Batch = NULL
 	);
 
 	virtual
@@ -106,8 +115,58 @@ public:
 		void
 	);
 
+	//
+	// Select the function of a compile time PinSet, GPFSELn words without any
+	// pin of the set are not touched and each touched word is written once.
+	//
+
+	template <typename Pins>
+	static
+	void
+	Select (
+		GPIO_FUN_SELECT PinSelect
+		)
+	{
+		uint32_t Masks[GPIO_FSEL_WORD_COUNT];
+		uint32_t Values[GPIO_FSEL_WORD_COUNT];
+
+		for (uint32_t Word = 0; Word < GPIO_FSEL_WORD_COUNT; Word += 1) {
+			Masks[Word] = Pins::FselMask(Word);
+			Values[Word] = Pins::FselValue(Word, PinSelect);
+		}
+
+		UpdateFsel(Masks, Values);
+		return;
+	}
+
 protected:
 
+	static
+	void
+	UpdateFsel (
+		_In_ const uint32_t *Masks,
+		_In_ const uint32_t *Values
+		);
+
+	//
+	// Runs the GPPUD/GPPUDCLKn sequence once for all pins of Mask, bit n being
+	// GPIO n.
+	//
+
+	static
+	void
+	ProgramPull (
+		_In_ GPIO_PULL Pull,
+		_In_ uint64_t Mask
+		);
+
+	//
+	// GPPUD/GPPUDCLKn setup and hold time, the datasheet asks for 150 core
+	// cycles, this leaves plenty of margin.
+	//
+
+	static const uint32_t PULL_SETUP_TIME_US = 5;
+
 	//
 	// GPIORegs points to the mapped virtual address of GPIO control registers.
 	//
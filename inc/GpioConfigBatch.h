@@ -0,0 +1,122 @@
+/*
+ * GpioConfigBatch.h
+ *
+ *  Created on: Mar 13, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include "AlphaBotTypes.h"
+#include "Rpi3BConstants.h"
+#include "GpioBase.h"
+
+/*
+ * GpioConfigBatch collects the configuration of many pins and programs it in
+ * one go. Function select, pull up/down and event detection settings are
+ * folded into per register word masks, so Apply() does one read-modify-write
+ * per touched GPFSELn/GPxENn word, one GPPUD/GPPUDCLKn sequence per pull mode
+ * and a single settle delay at the end, instead of one of each per pin.
+ *
+ * GpioBase/GpioOut/GpioIn take an optional batch, in which case they record
+ * their settings into it rather than writing the registers. For example:
+ *
+ *	GpioConfigBatch Batch;
+ *	GpioIn Front(8, GpioIn::InputAsyncRising, &Batch);
+ *	GpioIn Right(9, GpioIn::InputAsyncRising, &Batch);
+ *	GpioOut Led(5, &Batch);
+ *	Batch.Apply();
+ */
+
+class GpioConfigBatch : public GpioBase
+{
+public:
+
+	GpioConfigBatch (
+		void
+	);
+
+	virtual
+	~GpioConfigBatch (
+		void
+	);
+
+	void
+	SetFunction (
+		_In_ int32_t Pin,
+		_In_ GPIO_FUN_SELECT PinSelect
+	);
+
+	void
+	SetPull (
+		_In_ int32_t Pin,
+		_In_ GPIO_PULL Pull
+	);
+
+	//
+	// Disables all event detections of the pin, then enables Event unless it's
+	// EVENT_NONE. Pending events of the pin are cleared after the settle delay.
+	//
+
+	void
+	SetEvent (
+		_In_ int32_t Pin,
+		_In_ GPIO_EVENT Event
+	);
+
+	//
+	// Same as SetEvent, but keeps the events already recorded for the pin, so
+	// e.g. both edges can be detected.
+	//
+
+	void
+	AddEvent (
+		_In_ int32_t Pin,
+		_In_ GPIO_EVENT Event
+	);
+
+	//
+	// Programs everything recorded so far and empties the batch. Returns the
+	// number of pins configured.
+	//
+
+	int32_t
+	Apply (
+		void
+	);
+
+	void
+	Clear (
+		void
+	);
+
+	//
+	// Time to let the pins settle after reconfiguration before stale events
+	// are cleared.
+	//
+
+	static const uint32_t SETTLE_TIME_US = 100;
+
+private:
+
+	static const uint32_t NUM_OF_PULLS = 3;
+	static const uint32_t NUM_OF_EVENT_REGS = 6;
+
+	//
+	// Function select masks of the 6 GPFSELn words.
+	//
+
+	uint32_t m_FselMasks[GPIO_FSEL_WORD_COUNT];
+	uint32_t m_FselValues[GPIO_FSEL_WORD_COUNT];
+
+	//
+	// Pins to clock in per pull mode, then per event detect register the pins
+	// to disable and to enable. Indexed by GPIO_PULL and GPIO_EVENT - 1.
+	//
+
+	uint64_t m_PullMasks[NUM_OF_PULLS];
+	uint64_t m_EventDisable;
+	uint64_t m_EventEnable[NUM_OF_EVENT_REGS];
+
+	uint64_t m_Pins;
+};
@@ -0,0 +1,178 @@
+/*
+ * GpioDmaPwm.h
+ *
+ *  Created on: Feb 13, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include "AlphaBotTypes.h"
+#include "AlphaRobotConstants.h"
+#include "MemBase.h"
+#include "GpioBase.h"
+#include "DMA.h"
+#include "DMAMem.h"
+
+/*
+ * GpioDmaPwm generates PWM on any GPIO pins (0-31) without the CPU.
+ *
+ * A PWM period is split into slots. For each slot the DMA engine writes a
+ * mask to GPSET0, a mask to GPCLR0, then writes a dummy word to the PCM TX
+ * FIFO. The PCM is clocked so it takes one word per slot, its DREQ paces the
+ * whole chain. The last CB links back to the first one, so the waveform
+ * repeats forever.
+ *
+ * The PWM peripheral isn't used for pacing since it drives the WS2812B.
+ *
+ * There are two waveforms. A duty cycle change rebuilds the masks of the idle
+ * one and links the running one to it, the engine switches at the end of the
+ * period, so a period is never half old and half new. The idle waveform is
+ * only touched once the CB address of the channel shows the engine is in the
+ * running one.
+ *
+ * The pins must already be configured as outputs, e.g. with GpioOut.
+ */
+
+class GpioDmaPwm : public MemBase
+{
+public:
+
+	GpioDmaPwm (
+		_In_ const std::vector<uint32_t> &Pins,
+		_In_ uint32_t SlotUs = MOTOR_PWM_SLOT_US,
+		_In_ uint32_t Slots = MOTOR_PWM_SLOTS,
+		_In_ int32_t Channel = MOTOR_PWM_DMA_CHANNEL
+		);
+
+	virtual
+	~GpioDmaPwm (
+		void
+		);
+
+	//
+	// DutyCycle is from 0.0 to 1.0.
+	//
+
+	int32_t
+	SetDutyCycle (
+		_In_ uint32_t Pin,
+		_In_ float DutyCycle
+		);
+
+	int32_t
+	SetDutyCycles (
+		_In_ const std::vector<float> &DutyCycles
+		);
+
+	float
+	GetFrequency (
+		void
+		);
+
+	//
+	// PCM registers, check CH8.8 of the BCM2835 ARM peripherals for more details.
+	//
+
+	typedef struct _PCMRegisters_ {
+		uint32_t CS;		//Control and status
+		uint32_t FIFO;		//FIFO data
+		uint32_t MODE;		//Mode
+		uint32_t RXC;		//Receive configuration
+		uint32_t TXC;		//Transmit configuration
+		uint32_t DREQ;		//DMA request level
+		uint32_t INTEN;		//Interrupt enables
+		uint32_t INTSTC;	//Interrupt status & clear
+		uint32_t GRAY;		//Gray mode control
+	} PCMRegisters, *PPCMRegisters;
+
+private:
+
+	//
+	// Layout of a waveform buffer: 3 CBs per slot, then a set mask and a clear
+	// mask per slot, then the word written to the PCM FIFO.
+	//
+
+	static const uint32_t CBS_PER_SLOT = 3;
+
+	//
+	// Periods a swap waits for the engine to reach the running waveform.
+	//
+
+	static const uint32_t SWAP_MAX_PERIODS = 4;
+
+	static const uint32_t PCM_CS_EN			= 1 << 0;
+	static const uint32_t PCM_CS_TXON		= 1 << 2;
+	static const uint32_t PCM_CS_TXCLR		= 1 << 3;
+	static const uint32_t PCM_CS_RXCLR		= 1 << 4;
+	static const uint32_t PCM_CS_DMAEN		= 1 << 9;
+	static const uint32_t PCM_TXC_CH1EN		= 1 << 30;
+	static const uint32_t PCM_MODE_FLEN_SHIFT = 10;
+	static const uint32_t PCM_CLK_FREQ		= 10000000;		//PLLD / 50
+	static const uint32_t PCM_MAX_FLEN		= 1023;
+
+	static const uint32_t CM_PCMCTL_OFFSET	= 0x00000098;	//CM_PCMCTL
+	static const uint32_t CM_PCMDIV_OFFSET	= 0x0000009C;	//CM_PCMDIV
+
+	static const uint32_t GPIO_PCM_PHY_ADDR	= PERIPHERAL_PHY_BASE + GPIO_PCM_OFFSET;
+	static const uint32_t GPIO_CLK_PHY_ADDR	= PERIPHERAL_PHY_BASE + GPIO_CLOCK_OFFSET;
+	static const uint32_t PCM_FIFO_BUS_ADDR	= PERIPHERAL_BUS_BASE + GPIO_PCM_OFFSET + offsetof(PCMRegisters, FIFO);
+	static const uint32_t GPSET0_BUS_ADDR	= PERIPHERAL_BUS_BASE + GPIO_BASE_OFFSET + offsetof(GpioBase::GPIORegisters, GPSETn);
+	static const uint32_t GPCLR0_BUS_ADDR	= PERIPHERAL_BUS_BASE + GPIO_BASE_OFFSET + offsetof(GpioBase::GPIORegisters, GPCLRn);
+
+	uint32_t GetCBOffset(uint32_t Slot, uint32_t Idx);
+	uint32_t GetSetMaskOffset(uint32_t Slot);
+	uint32_t GetClrMaskOffset(uint32_t Slot);
+	uint32_t GetPadOffset();
+
+	void
+	BuildWaveform (
+		_In_ uint32_t Idx
+		);
+
+	void
+	BuildMasks (
+		_In_ uint32_t Idx
+		);
+
+	int32_t
+	IsRunning (
+		_In_ uint32_t Idx
+		);
+
+	int32_t
+	SwapWaveform (
+		void
+		);
+
+	void
+	StartPCM (
+		void
+		);
+
+	void
+	StopPCM (
+		void
+		);
+
+	void
+	ResetChannel (
+		void
+		);
+
+	std::vector<uint32_t> m_Pins;
+	std::vector<float> m_DutyCycles;
+	uint32_t m_SlotUs;
+	uint32_t m_Slots;
+	int32_t m_Channel;
+
+	DMABuffer *m_Waveform[2];
+	uint32_t m_Active;				//Waveform the engine is running
+	uint64_t m_LastSwapUs;
+
+	volatile PCMRegisters *m_PCMRegisters;
+	volatile uint32_t *m_ClkRegisters;
+	std::mutex m_Lock;
+};
@@ -0,0 +1,282 @@
+/*
+ * GpioEvent.h
+ *
+ *  Created on: Mar 20, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "AlphaBotTypes.h"
+#include "ErrorCode.h"
+
+/*
+ * GpioEventEngine delivers input edges to handlers without polling GPEDSn.
+ *
+ * The edges are detected by the kernel GPIO driver through the GPIO character
+ * device (/dev/gpiochipN), which gives a file descriptor per requested line
+ * that turns readable when an edge arrives, along with the kernel timestamp of
+ * the interrupt. The engine thread waits on all of them with epoll, so it uses
+ * no CPU while idle and wakes up tens of microseconds after the edge.
+ *
+ * The descriptors come from a GpioEventSource. GpioChipEventSource talks to
+ * the kernel, GpioFakeEventSource feeds edges through pipes so the engine and
+ * its handlers can be exercised without hardware.
+ */
+
+#define GPIO_CHIP_DEVICE				"/dev/gpiochip0"
+
+typedef enum _GPIO_EDGE_ {
+	EDGE_RISING		= 0x1,
+	EDGE_FALLING	= 0x2,
+	EDGE_BOTH		= 0x3,
+} GPIO_EDGE, *PGPIO_EDGE;
+
+typedef struct _GpioEventRecord_ {
+	int32_t Pin;
+	GPIO_EDGE Edge;				//EDGE_RISING or EDGE_FALLING
+
+	//
+	// When the edge was detected, as stamped by the source, and when the
+	// engine dispatched it. Both are CLOCK_MONOTONIC on kernels since 5.7,
+	// older kernels stamp the edge with CLOCK_REALTIME.
+	//
+
+	uint64_t TimestampNs;
+	uint64_t DispatchNs;
+} GpioEventRecord;
+
+typedef std::function<void(const GpioEventRecord &Event)> GpioEventHandler;
+
+class GpioEventSource
+{
+public:
+
+	virtual
+	~GpioEventSource (
+		void
+	)
+	{
+	}
+
+	//
+	// Starts edge detection on Pin and returns a descriptor which is readable
+	// when edges are pending, or a negative value on failure.
+	//
+
+	virtual
+	int32_t
+	Request (
+		_In_ int32_t Pin,
+		_In_ GPIO_EDGE Edges
+	) = 0;
+
+	//
+	// Reads one pending edge of the descriptor returned by Request. Returns
+	// ERROR_SUCCESS, or an error if nothing could be read. It must not block
+	// when no edge is pending, the event thread may see a stale readiness.
+	//
+
+	virtual
+	int32_t
+	Read (
+		_In_ int32_t Fd,
+		_In_ int32_t Pin,
+		_Out_ GpioEventRecord &Event
+	) = 0;
+
+	virtual
+	void
+	Release (
+		_In_ int32_t Fd
+	) = 0;
+};
+
+class GpioChipEventSource : public GpioEventSource
+{
+public:
+
+	GpioChipEventSource (
+		_In_ const char *Chip = GPIO_CHIP_DEVICE
+	);
+
+	virtual
+	~GpioChipEventSource (
+		void
+	);
+
+	virtual
+	int32_t
+	Request (
+		_In_ int32_t Pin,
+		_In_ GPIO_EDGE Edges
+	);
+
+	virtual
+	int32_t
+	Read (
+		_In_ int32_t Fd,
+		_In_ int32_t Pin,
+		_Out_ GpioEventRecord &Event
+	);
+
+	virtual
+	void
+	Release (
+		_In_ int32_t Fd
+	);
+
+private:
+	int32_t m_ChipFd;
+};
+
+class GpioFakeEventSource : public GpioEventSource
+{
+public:
+
+	GpioFakeEventSource (
+		void
+	);
+
+	virtual
+	~GpioFakeEventSource (
+		void
+	);
+
+	virtual
+	int32_t
+	Request (
+		_In_ int32_t Pin,
+		_In_ GPIO_EDGE Edges
+	);
+
+	virtual
+	int32_t
+	Read (
+		_In_ int32_t Fd,
+		_In_ int32_t Pin,
+		_Out_ GpioEventRecord &Event
+	);
+
+	virtual
+	void
+	Release (
+		_In_ int32_t Fd
+	);
+
+	//
+	// Queues an edge of a requested pin, a zero timestamp is replaced with the
+	// current time. Edges not requested for the pin are dropped like the
+	// hardware would.
+	//
+
+	int32_t
+	Inject (
+		_In_ int32_t Pin,
+		_In_ GPIO_EDGE Edge,
+		_In_ uint64_t TimestampNs = 0
+	);
+
+private:
+
+	typedef struct _FakeLine_ {
+		int32_t ReadFd;
+		int32_t WriteFd;
+		GPIO_EDGE Edges;
+	} FakeLine;
+
+	std::mutex m_Lock;
+	std::map<int32_t, FakeLine> m_Lines;		//By pin
+};
+
+class GpioEventEngine
+{
+public:
+
+	GpioEventEngine (
+		_In_ GpioEventSource &Source
+	);
+
+	virtual
+	~GpioEventEngine (
+		void
+	);
+
+	//
+	// One handler per pin, it runs on the engine thread so it should be short
+	// and must not subscribe or unsubscribe itself. Other threads can do both
+	// while the engine runs.
+	//
+
+	int32_t
+	Subscribe (
+		_In_ int32_t Pin,
+		_In_ GPIO_EDGE Edges,
+		_In_ GpioEventHandler Handler
+	);
+
+	int32_t
+	Unsubscribe (
+		_In_ int32_t Pin
+	);
+
+	int32_t
+	Start (
+		void
+	);
+
+	void
+	Stop (
+		void
+	);
+
+	//
+	// Longest time from the edge timestamp to its dispatch, and the number of
+	// events dispatched.
+	//
+
+	uint64_t
+	GetMaxLatencyNs (
+		void
+	);
+
+	uint64_t
+	GetEventCount (
+		void
+	);
+
+	static const uint32_t MAX_EVENTS_PER_WAIT = 16;
+
+private:
+
+	typedef struct _Subscription_ {
+		int32_t Pin;
+		GpioEventHandler Handler;
+	} Subscription;
+
+	void
+	EventThread (
+		void
+	);
+
+	GpioEventSource &m_Source;
+	int32_t m_EpollFd;
+	int32_t m_StopFd;				//eventfd to wake the thread up on Stop
+
+	std::mutex m_Lock;
+	std::map<int32_t, Subscription> m_Subscriptions;	//By descriptor
+
+	std::atomic<uint64_t> m_MaxLatencyNs;
+	std::atomic<uint64_t> m_EventCount;
+	std::thread m_Thread;
+};
+
+void
+GpioEventDemo (
+	void
+);
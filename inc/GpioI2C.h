@@ -6,7 +6,16 @@
  */
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "GpioBase.h"
+#include "ErrorCode.h"
 
 class GpioI2C : public GpioBase
 {
@@ -210,6 +219,109 @@ public:
 		void
 	);
 
+	//
+	// Asynchronous transactions are executed in order by a worker thread, the
+	// result is the number of bytes written (write) or read (read). The BSC
+	// controller has no DREQ, so instead of spinning on TXD/RXD per byte, the
+	// worker tops up or drains the 16 bytes FIFO in one batch, then sleeps
+	// until about half of the FIFO has been shifted out.
+	//
+	// Each transaction has a deadline, and fails as soon as the controller
+	// reports S.ERR (NACK) or S.CLKT (clock stretch timeout), so a stuck bus
+	// costs a bounded amount of time.
+	//
+
+	typedef std::function<void(int16_t Result, int32_t Status)> I2CCallback;
+
+	class I2CTransaction
+	{
+	public:
+		int32_t IsDone();
+		int32_t GetStatus();
+		int16_t GetResult();
+		uint64_t GetLatencyUs();
+		uint64_t GetBusTimeUs();
+
+	private:
+		friend class GpioI2C;
+
+		typedef enum _I2CTxnState_ {
+			I2C_TXN_START_WRITE,
+			I2C_TXN_WRITING,
+			I2C_TXN_START_READ,
+			I2C_TXN_READING,
+			I2C_TXN_DONE
+		} I2CTxnState;
+
+		int8_t m_Addr;
+		std::vector<int8_t> m_TxData;	//Bytes to write, the register for reads
+		int8_t *m_RxData;
+		int16_t m_RxLen;				//Bytes to read after m_TxData, 0 for writes
+		int16_t m_Sent;
+		int16_t m_Received;
+		I2CTxnState m_State;
+		int32_t m_Status;
+		uint64_t m_SubmitUs;
+		uint64_t m_StartUs;
+		uint64_t m_DoneUs;
+		uint64_t m_DeadlineUs;			//0 until the default one starts with m_StartUs
+		uint32_t m_TimeoutUs;			//Default deadline, relative to m_StartUs
+		std::atomic<int32_t> m_Done;
+		std::promise<int16_t> m_Promise;
+		I2CCallback m_Callback;
+	};
+
+	typedef std::shared_ptr<I2CTransaction> I2CHandle;
+
+	//
+	// DeadlineUs is relative to the submission, 0 picks one from the length
+	// and the bus speed, which only starts once the transaction gets the bus.
+	//
+
+	I2CHandle
+	SubmitWrite (
+		_In_ const int8_t Addr,
+		_In_ const std::vector<int8_t> &Values,
+		_In_ uint32_t DeadlineUs = 0,
+		_In_ I2CCallback Callback = nullptr
+	);
+
+	//
+	// Note: Values must stay valid until the transaction completes.
+	//
+
+	I2CHandle
+	SubmitRead (
+		_In_ int8_t Addr,
+		_In_ int8_t Reg,
+		_Out_ int8_t *Values,
+		_In_ const int16_t Len = 1,
+		_In_ uint32_t DeadlineUs = 0,
+		_In_ I2CCallback Callback = nullptr
+	);
+
+	int32_t
+	Wait (
+		_In_ const I2CHandle &Handle,
+		_In_ uint32_t TimeoutUs
+	);
+
+	std::future<int16_t>
+	WriteAsync (
+		_In_ const int8_t Addr,
+		_In_ const std::vector<int8_t> &Values,
+		_In_ I2CCallback Callback = nullptr
+	);
+
+	std::future<int16_t>
+	ReadAsync (
+		_In_ int8_t Addr,
+		_In_ int8_t Reg,
+		_Out_ int8_t *Values,
+		_In_ const int16_t Len = 1,
+		_In_ I2CCallback Callback = nullptr
+	);
+
 protected:
 	static const uint32_t GPIO_I2C_PHY_ADDR[2];
 	static int32_t NumOfI2CInstances;
@@ -218,7 +330,64 @@ protected:
 
 	static I2CCtrlRegister CTRL;
 	static I2CStatusRegister STATUS;
+	static const int32_t I2C_FIFO_DEPTH = 16;
+
 private:
+
+	static const uint32_t I2C_TXN_BASE_TIMEOUT_US = 2000;
+
+	void
+	PrepareTransaction (
+		_In_ I2CTransaction &Txn,
+		_In_ int8_t Addr,
+		_In_ const std::vector<int8_t> &TxData,
+		_In_ int8_t *RxData,
+		_In_ int16_t RxLen,
+		_In_ uint32_t DeadlineUs
+	);
+
+	void
+	StartTransaction (
+		_In_ I2CTransaction &Txn
+	);
+
+	I2CHandle
+	Submit (
+		_In_ I2CHandle Txn
+	);
+
+	void
+	FinishTransaction (
+		_In_ I2CTransaction &Txn,
+		_In_ int32_t Status
+	);
+
+	int32_t
+	StepTransaction (
+		_In_ I2CTransaction &Txn
+	);
+
+	uint32_t
+	GetByteTimeUs (
+		void
+	);
+
+	void
+	AsyncWorker (
+		void
+	);
+
 	volatile I2CRegisters *m_I2CRegisters;
 	int32_t m_I2CChannelId;
+
+	//
+	// m_BusLock serializes synchronous calls with the async worker.
+	//
+
+	std::recursive_mutex m_BusLock;
+	std::mutex m_QueueLock;
+	std::condition_variable m_QueueCond;
+	std::deque<I2CHandle> m_Pending;
+	std::thread m_Worker;
+	bool m_StopWorker;
 };
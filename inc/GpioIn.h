@@ -7,27 +7,46 @@
 
 #pragma once
 
+#include <map>
 #include "GpioBase.h"
+#include "GpioConfigBatch.h"
 
 class GpioIn : public GpioBase
 {
 public:
+	//Same order as GPIO_EVENT
 	typedef enum {
-		NONE,
-		InputRising,
-		InputFalling,
-		InputHigh,
-		InputLow,
-		InputAsyncRising,
-		InputAsyncFalling,
+		NONE = EVENT_NONE,
+		InputRising = EVENT_RISING,
+		InputFalling = EVENT_FALLING,
+		InputHigh = EVENT_HIGH,
+		InputLow = EVENT_LOW,
+		InputAsyncRising = EVENT_ASYNC_RISING,
+		InputAsyncFalling = EVENT_ASYNC_FALLING,
 	} GpioInEvent;
 
-	GpioIn(int32_t pin, GpioInEvent event = NONE);
+	//With a Batch the pin is configured by GpioConfigBatch::Apply(), otherwise
+	//right away. The pull of the pin is only programmed if asked for, pins
+	//sharing a pull mode are better programmed together by configurePulls()
+	GpioIn(int32_t pin, GpioInEvent event = NONE, GpioConfigBatch *Batch = NULL,
+		   GPIO_PULL pull = PULL_KEEP);
 	virtual ~GpioIn();
 
 
 	static void checkPinLevels(const std::vector<int32_t> &pins, std::vector<int32_t> &pin_levels);
 	static void checkPinEvents(const std::vector<int32_t> &pins, std::vector<int32_t> &pin_events);
+
+	//Snapshot of GPLEV0/GPLEV1, bit n is the level of GPIO n
+	static inline uint64_t readLevels()
+	{
+		uint64_t low = GPIORegs->GPLEVn[0];
+		return low | (static_cast<uint64_t>(GPIORegs->GPLEVn[1]) << 32);
+	}
+
+	//Programs the pull of many pins, one GPPUD/GPPUDCLKn sequence per pull mode
+	//covering both words. Needs a GPIO instance alive to have the registers
+	//mapped. Returns the number of sequences run or -1 on invalid input
+	static int32_t configurePulls(const std::map<int32_t, GPIO_PULL> &pulls);
 	int32_t getValue();
 	int32_t checkEvent();
 	void clearEventReg();
@@ -38,6 +57,3 @@ private:
 	uint32_t m_word_off;
 	uint32_t m_mask;
 };
-
-void JoyStickDemo();
-
@@ -9,12 +9,33 @@
 #include <vector>
 
 #include "GpioBase.h"
+#include "GpioConfigBatch.h"
 class GpioOut : public GpioBase
 {
 public:
-	GpioOut(int32_t pin);
+	//With a Batch the pin is configured by GpioConfigBatch::Apply()
+	GpioOut(int32_t pin, GpioConfigBatch *Batch = NULL);
 	virtual ~GpioOut();
 	static void Update(const std::vector<uint32_t> &set_pins, const std::vector<uint32_t> &clear_pins);
+
+	//Bit n of the masks is GPIO n, pins are set first then cleared
+	static void Update(uint64_t set_mask, uint64_t clear_mask);
+	static constexpr uint64_t PinMask(uint32_t pin) { return 0x1ull << pin; }
+
+	//Compile time version for fixed pins, the masks of the PinSets are folded
+	//by the compiler so this is at most one store per GPSETn/GPCLRn word
+	template <typename SetPins, typename ClearPins = PinSet<>>
+	static inline void Write()
+	{
+		if (SetPins::WORD0 != 0)
+			GPIORegs->GPSETn[0] = SetPins::WORD0;
+		if (SetPins::WORD1 != 0)
+			GPIORegs->GPSETn[1] = SetPins::WORD1;
+		if (ClearPins::WORD0 != 0)
+			GPIORegs->GPCLRn[0] = ClearPins::WORD0;
+		if (ClearPins::WORD1 != 0)
+			GPIORegs->GPCLRn[1] = ClearPins::WORD1;
+	}
 protected:
 
 };
@@ -0,0 +1,147 @@
+/*
+ * GpioOutQueue.h
+ *
+ *  Created on: Feb 27, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "AlphaBotTypes.h"
+#include "GpioOut.h"
+#include "SpscRing.h"
+
+/*
+ * GpioOutQueue lets several threads change output pins without locks or heap
+ * allocation on the posting path, a dedicated thread does the register writes.
+ *
+ * Each producer (motors, buzzer, sensors...) registers once and gets its own
+ * single-producer/single-consumer ring of commands. A command is a pair of
+ * precomputed 64 bits masks, bit n being GPIO n. The output thread drains all
+ * rings round robin and writes GPSETn/GPCLRn directly. Commands of a producer
+ * are applied in order, there's no order between producers.
+ *
+ * The time from Post to the register write is measured for every command.
+ */
+
+class GpioOutQueue
+{
+public:
+
+	class Producer;
+
+	typedef struct _GpioOutLatency_ {
+		uint64_t Count;
+		uint64_t TotalNs;
+		uint64_t MaxNs;
+		uint64_t LastNs;
+	} GpioOutLatency;
+
+	GpioOutQueue (
+		void
+	);
+
+	virtual
+	~GpioOutQueue (
+		void
+	);
+
+	//
+	// Registration takes a lock, do it once per producer thread. Capacity is
+	// rounded up to a power of 2.
+	//
+
+	Producer *
+	RegisterProducer (
+		_In_ uint32_t Capacity = DEFAULT_CAPACITY
+	);
+
+	GpioOutLatency
+	GetLatency (
+		void
+	);
+
+	static const uint32_t MAX_PRODUCERS = 8;
+	static const uint32_t DEFAULT_CAPACITY = 64;
+
+	class Producer
+	{
+	public:
+
+		//
+		// Returns 0 if queued, -1 if the ring is full. It never blocks.
+		//
+
+		int32_t
+		Post (
+			_In_ uint64_t SetMask,
+			_In_ uint64_t ClearMask
+		);
+
+	private:
+		friend class GpioOutQueue;
+
+		typedef struct _GpioOutCommand_ {
+			uint64_t SetMask;
+			uint64_t ClearMask;
+			uint64_t EnqueueNs;
+		} GpioOutCommand;
+
+		Producer (
+			_In_ GpioOutQueue *Queue,
+			_In_ uint32_t Capacity
+		);
+
+		~Producer (
+			void
+		);
+
+		int32_t
+		Pop (
+			_Out_ GpioOutCommand &Command
+		);
+
+		GpioOutQueue *m_Queue;
+		SpscRing<GpioOutCommand> m_Ring;
+	};
+
+private:
+
+	void
+	OutputThread (
+		void
+	);
+
+	void
+	Wakeup (
+		void
+	);
+
+	Producer *m_Producers[MAX_PRODUCERS];
+	std::atomic<uint32_t> m_NumProducers;
+	std::mutex m_RegisterLock;
+
+	//
+	// The output thread sleeps when all rings are empty. A post wakes it up
+	// only if it's asleep, the timed wait covers a wake up racing with it.
+	//
+
+	std::atomic<int32_t> m_Sleeping;
+	std::mutex m_SleepLock;
+	std::condition_variable m_SleepCond;
+
+	std::atomic<int32_t> m_Stop;
+	std::thread m_Thread;
+
+	std::mutex m_LatencyLock;
+	GpioOutLatency m_Latency;
+};
+
+void
+GpioOutQueueDemo (
+	void
+);
@@ -0,0 +1,144 @@
+/*
+ * GpioPinSet.h
+ *
+ *  Created on: Mar 6, 2021
+ *      Author: Albert Guan
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+//
+// Number of GPIO pins on BCM2837, each GPFSELn word holds 10 of them and each
+// GPSETn/GPCLRn/GPLEVn word holds 32 of them.
+//
+
+#define GPIO_PIN_COUNT					54
+#define GPIO_PINS_PER_FSEL_WORD			10
+#define GPIO_FSEL_WORD_COUNT			6
+#define GPIO_FSEL_BITS					3
+#define GPIO_FSEL_FIELD_MASK			0x7u
+
+//
+// PinSet folds a list of pins into the register masks at compile time, so a
+// fixed group of pins is toggled or selected without building vectors or
+// looping over pins at run time. For example:
+//
+//	typedef PinSet<12, 20> In1Pins;
+//	GpioOut::Write<In1Pins>();
+//	GpioBase::Select<In1Pins>(FSEL_OUTPUT);
+//
+// The members are written as single return constexpr expressions to stay
+// within C++11.
+//
+
+template <uint32_t... Pins>
+struct PinSet;
+
+template <>
+struct PinSet<>
+{
+	static constexpr uint64_t MASK = 0;
+	static constexpr uint32_t WORD0 = 0;
+	static constexpr uint32_t WORD1 = 0;
+	static constexpr uint32_t COUNT = 0;
+
+	static
+	constexpr
+	uint32_t
+	FselMask (
+		uint32_t
+		)
+	{
+		return 0;
+	}
+
+	static
+	constexpr
+	uint32_t
+	FselValue (
+		uint32_t,
+		uint32_t
+		)
+	{
+		return 0;
+	}
+};
+
+template <uint32_t Pin, uint32_t... Rest>
+struct PinSet<Pin, Rest...>
+{
+	static_assert(Pin < GPIO_PIN_COUNT, "PinSet: GPIO pin out of range");
+
+	//
+	// MASK has bit n set for GPIO n, WORD0/WORD1 are the values to write to
+	// GPSETn[0]/GPCLRn[0] and GPSETn[1]/GPCLRn[1].
+	//
+
+	static constexpr uint64_t MASK = (1ull << Pin) | PinSet<Rest...>::MASK;
+	static constexpr uint32_t WORD0 = static_cast<uint32_t>(MASK);
+	static constexpr uint32_t WORD1 = static_cast<uint32_t>(MASK >> 32);
+	static constexpr uint32_t COUNT = 1 + PinSet<Rest...>::COUNT;
+
+	static
+	constexpr
+	uint32_t
+	FselMask (
+		uint32_t Word
+		)
+
+	/*
+	 Routine Description:
+
+		This routine returns the bits of GPFSELn[Word] owned by the pins of the
+		set, i.e. the bits to clear before a new function is OR'ed in.
+
+	 Parameters:
+
+		Word - Supplies the GPFSELn index, 0 to 5.
+
+	 Return Value:
+
+		uint32_t - Clear mask of the GPFSELn word, 0 if no pin lives in it.
+
+	*/
+
+	{
+		return ((Pin / GPIO_PINS_PER_FSEL_WORD == Word) ?
+					(GPIO_FSEL_FIELD_MASK << (Pin % GPIO_PINS_PER_FSEL_WORD * GPIO_FSEL_BITS)) : 0) |
+			   PinSet<Rest...>::FselMask(Word);
+	}
+
+	static
+	constexpr
+	uint32_t
+	FselValue (
+		uint32_t Word,
+		uint32_t Fsel
+		)
+
+	/*
+	 Routine Description:
+
+		This routine returns the value to OR into GPFSELn[Word] to select Fsel
+		for all pins of the set living in that word.
+
+	 Parameters:
+
+		Word - Supplies the GPFSELn index, 0 to 5.
+
+		Fsel - Supplies the GPIO_FUN_SELECT value.
+
+	 Return Value:
+
+		uint32_t - Function select bits of the GPFSELn word.
+
+	*/
+
+	{
+		return ((Pin / GPIO_PINS_PER_FSEL_WORD == Word) ?
+					((Fsel & GPIO_FSEL_FIELD_MASK) << (Pin % GPIO_PINS_PER_FSEL_WORD * GPIO_FSEL_BITS)) : 0) |
+			   PinSet<Rest...>::FselValue(Word, Fsel);
+	}
+};
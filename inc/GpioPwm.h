@@ -247,7 +247,37 @@ public:
 		uint32_t len
 		);
 
+	//
+	// Writes words until the FIFO is full, without waiting.
+	//
+
+	uint32_t
+	FillPWMFIFO (
+		_In_ const uint32_t *vals,
+		_In_ uint32_t len
+		);
+
+	//
+	// DMA routines, the DMA engine writes the FIFO when DREQ is asserted.
+	//
+
+	void
+	SetDMA (
+		_In_ int32_t Enable,
+		_In_ uint32_t Dreq = PWM_DMA_DREQ_THRESHOLD,
+		_In_ uint32_t Panic = PWM_DMA_PANIC_THRESHOLD
+		);
+
+	static
+	uint32_t
+	GetFIFOBusAddr (
+		void
+		);
+
 private:
+	static const uint32_t PWM_DMA_DREQ_THRESHOLD	= 7;
+	static const uint32_t PWM_DMA_PANIC_THRESHOLD	= 7;
+
 	static const uint32_t GPIO_PWM_PHY_ADDR 	= PERIPHERAL_PHY_BASE + GPIO_PWM_OFFSET;
 	static const uint32_t GPIO_CLK_PHY_ADDR 	= PERIPHERAL_PHY_BASE + GPIO_CLOCK_OFFSET;
 	static const uint32_t PWM_FIFO_PHY_ADDR		= GPIO_PWM_PHY_ADDR + offsetof(PWMCtrlRegisters, FIF1);
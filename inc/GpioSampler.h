@@ -0,0 +1,126 @@
+/*
+ * GpioSampler.h
+ *
+ *  Created on: Mar 27, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "AlphaBotTypes.h"
+#include "GpioBase.h"
+#include "SpscRing.h"
+
+/*
+ * GpioSampler snapshots both GPLEVn words at a fixed rate on a dedicated
+ * thread and stores {timestamp, levels} records into a lock-free single
+ * producer/single consumer ring. Consumers drain the ring at their own pace
+ * and decode edges, pulse widths or debounced states from it, so pulses
+ * shorter than their own loop period aren't missed.
+ *
+ * Up to SPIN_THRESHOLD_HZ the thread sleeps until each sample is due, above
+ * it the thread spins on the clock, which takes a whole core but reaches the
+ * MHz range. Either way samples are taken on absolute deadlines so the rate
+ * doesn't drift. If the consumer falls behind, new samples are dropped and
+ * counted as overruns.
+ */
+
+typedef struct _GpioSample_ {
+	uint64_t TimestampNs;		//CLOCK_MONOTONIC
+	uint64_t Levels;			//Bit n is the level of GPIO n
+} GpioSample;
+
+typedef struct _GpioSampleEdge_ {
+	uint64_t TimestampNs;
+	int32_t Pin;
+	int32_t Level;				//Level after the edge
+} GpioSampleEdge;
+
+class GpioSampler : public GpioBase
+{
+public:
+
+	//
+	// Capacity is rounded up to a power of 2.
+	//
+
+	GpioSampler (
+		_In_ uint32_t RateHz,
+		_In_ uint32_t Capacity = DEFAULT_CAPACITY
+	);
+
+	virtual
+	~GpioSampler (
+		void
+	);
+
+	int32_t
+	Start (
+		void
+	);
+
+	void
+	Stop (
+		void
+	);
+
+	//
+	// Pops up to MaxSamples samples, oldest first. Returns the number popped.
+	//
+
+	uint32_t
+	Read (
+		_Out_ GpioSample *Samples,
+		_In_ uint32_t MaxSamples
+	);
+
+	uint64_t
+	GetOverruns (
+		void
+	);
+
+	//
+	// Finds the edges of the pins of PinMask in Samples. LastLevels supplies
+	// the levels before the first sample and receives the levels after the
+	// last one decoded, so consecutive batches decode seamlessly. Returns the
+	// number of edges stored, at most MaxEdges. When Edges fills up, Consumed
+	// is less than Count, and decoding resumes at Samples[Consumed] with the
+	// updated LastLevels without repeating or losing edges.
+	//
+
+	static
+	uint32_t
+	DecodeEdges (
+		_In_ const GpioSample *Samples,
+		_In_ uint32_t Count,
+		_In_ uint64_t PinMask,
+		_Inout_ uint64_t &LastLevels,
+		_Out_ GpioSampleEdge *Edges,
+		_In_ uint32_t MaxEdges,
+		_Out_ uint32_t &Consumed
+	);
+
+	static const uint32_t DEFAULT_CAPACITY = 65536;
+	static const uint32_t SPIN_THRESHOLD_HZ = 10000;
+
+private:
+
+	void
+	SampleThread (
+		void
+	);
+
+	uint64_t m_PeriodNs;
+	SpscRing<GpioSample> m_Ring;		//Sample thread to consumer
+
+	std::atomic<uint64_t> m_Overruns;
+	std::atomic<int32_t> m_Stop;
+	std::thread m_Thread;
+};
+
+void
+GpioSamplerDemo (
+	void
+);
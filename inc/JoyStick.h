@@ -0,0 +1,163 @@
+/*
+ * JoyStick.h
+ *
+ *  Created on: Apr 3, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "AlphaBotTypes.h"
+#include "AlphaRobotConstants.h"
+#include "GpioIn.h"
+
+/*
+ * JoyStick turns the five buttons of the AlphaBot joystick into events.
+ *
+ * All buttons are sampled together with one GPLEV read per tick. Each button
+ * keeps a history of its last samples and only changes state once the whole
+ * history agrees, which filters out the contact bounce. A stable press
+ * reports PRESS, then HOLD once held long enough, then REPEAT periodically
+ * until RELEASE. Whenever two or more buttons are down together, the set
+ * reports CHORD once.
+ *
+ * Start() runs the sampling on its own thread. Alternatively Process() can be
+ * called from any existing loop with its own level snapshots (e.g. the samples
+ * of a GpioSampler), there's no per button thread either way.
+ */
+
+typedef enum _JOYSTICK_BUTTON_ {
+	BUTTON_CENTER = 0,
+	BUTTON_FRONT,
+	BUTTON_RIGHT,
+	BUTTON_LEFT,
+	BUTTON_REVERSE,
+	BUTTON_COUNT,
+} JOYSTICK_BUTTON, *PJOYSTICK_BUTTON;
+
+typedef enum _JOYSTICK_EVENT_ {
+	JOYSTICK_PRESS = 0,
+	JOYSTICK_RELEASE,
+	JOYSTICK_HOLD,
+	JOYSTICK_REPEAT,
+	JOYSTICK_CHORD,
+} JOYSTICK_EVENT, *PJOYSTICK_EVENT;
+
+typedef struct _JoyStickEvent_ {
+	uint64_t TimestampNs;		//CLOCK_MONOTONIC of the sample deciding it
+	JOYSTICK_EVENT Type;
+
+	//
+	// Bit n is JOYSTICK_BUTTON n. One bit for PRESS/RELEASE/HOLD/REPEAT, all
+	// the buttons down for CHORD.
+	//
+
+	uint32_t Buttons;
+} JoyStickEvent;
+
+typedef std::function<void(const JoyStickEvent &Event)> JoyStickHandler;
+
+class JoyStick
+{
+public:
+
+	JoyStick (
+		_In_ JoyStickHandler Handler,
+		_In_ uint32_t PollHz = JOYSTICK_POLL_HZ,
+		_In_ uint32_t DebounceSamples = JOYSTICK_DEBOUNCE_SAMPLES
+	);
+
+	virtual
+	~JoyStick (
+		void
+	);
+
+	int32_t
+	Start (
+		void
+	);
+
+	void
+	Stop (
+		void
+	);
+
+	//
+	// Feeds one level snapshot, bit n is GPIO n. The handler is called from
+	// here for each event.
+	//
+
+	void
+	Process (
+		_In_ uint64_t TimestampNs,
+		_In_ uint64_t Levels
+	);
+
+	//
+	// Debounced buttons currently down, bit n is JOYSTICK_BUTTON n.
+	//
+
+	uint32_t
+	GetPressed (
+		void
+	);
+
+	static
+	const char *
+	GetButtonName (
+		_In_ uint32_t Button
+	);
+
+	static
+	const char *
+	GetEventName (
+		_In_ JOYSTICK_EVENT Type
+	);
+
+	static const int32_t BUTTON_PINS[BUTTON_COUNT];
+
+private:
+
+	void
+	PollThread (
+		void
+	);
+
+	void
+	Emit (
+		_In_ uint64_t TimestampNs,
+		_In_ JOYSTICK_EVENT Type,
+		_In_ uint32_t Buttons
+	);
+
+	JoyStickHandler m_Handler;
+	uint64_t m_PeriodNs;
+	uint64_t m_HoldNs;
+	uint64_t m_RepeatNs;
+	uint32_t m_HistoryMask;		//DebounceSamples low bits set
+
+	//
+	// Per button sample history (bit 0 is the newest, 1 is down) and when the
+	// next HOLD/REPEAT is due.
+	//
+
+	uint32_t m_History[BUTTON_COUNT];
+	uint64_t m_NextRepeatNs[BUTTON_COUNT];
+	bool m_Held[BUTTON_COUNT];
+
+	std::atomic<uint32_t> m_Pressed;
+	uint32_t m_LastChord;
+
+	std::vector<GpioIn *> m_Pins;
+	std::atomic<int32_t> m_Stop;
+	std::thread m_Thread;
+};
+
+void
+JoyStickDemo (
+	void
+);
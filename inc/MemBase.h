@@ -9,15 +9,49 @@
 #include <vector>
 #pragma once
 
+//Where the drivers get their registers from: /dev/mem on the Pi, or a
+//simulation (see MemSim.h). Map returns MAP_FAILED on failure like mmap
+class MemBackend
+{
+public:
+	virtual ~MemBackend() {}
+	virtual int32_t Open() = 0;
+	virtual void Close() = 0;
+	virtual void *Map(uint32_t phy_addr, size_t len) = 0;
+	virtual void Unmap(void *virt, size_t len) = 0;
+};
+
+//Maps the physical address space through /dev/mem
+class DevMemBackend : public MemBackend
+{
+public:
+	DevMemBackend();
+	virtual ~DevMemBackend();
+	virtual int32_t Open();
+	virtual void Close();
+	virtual void *Map(uint32_t phy_addr, size_t len);
+	virtual void Unmap(void *virt, size_t len);
+private:
+	int32_t m_fd;
+};
+
 class MemBase
 {
 public:
 	MemBase();
 	virtual ~MemBase();
+
+	//Selects the backend of all drivers, call it before the first driver is
+	//created. NULL goes back to /dev/mem
+	static void SetBackend(MemBackend *backend);
+	static MemBackend *GetBackend();
 protected:
 	static int32_t Init();
 	static void Uninit();
-	static int32_t mem_fd;
+	static void *MapRegisters(uint32_t phy_addr, size_t len);
+	static void UnmapRegisters(volatile void *virt, size_t len);
 private:
 	static int32_t num_of_mem_inst;
+	static MemBackend *backend;
+	static DevMemBackend dev_mem;
 };
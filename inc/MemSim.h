@@ -0,0 +1,273 @@
+/*
+ * MemSim.h
+ *
+ *  Created on: Apr 17, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <signal.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "AlphaBotTypes.h"
+#include "MemBase.h"
+
+/*
+ * MemSimBackend serves the register blocks of the drivers from memory, so
+ * they run unmodified on an x86 Linux host without /dev/mem.
+ *
+ * Each block covers whole pages at a physical address and is backed by a
+ * memfd. The drivers get a mapping of their own at the offsets they asked
+ * for, which is read only: a store faults, the page is opened for the one
+ * instruction, single stepped, and closed again. The write hooks of the block
+ * then see the address, the value written and the value it replaced, and play
+ * back the side effects of the hardware on the models' mapping: write 1 to
+ * clear status bits, FIFOs draining, DONE/END flags being raised, clocks
+ * reporting BUSY and so on. Reads cost nothing.
+ *
+ * The hooks run synchronously in the signal handler of the writing thread, so
+ * they must not allocate or take locks the drivers hold. One single step runs
+ * at a time in the process, a thread faulting meanwhile waits in the handler
+ * until the page is closed again. A store from another thread hitting the
+ * page while it's open for a single step is not seen.
+ * Under gdb, "handle SIGSEGV SIGTRAP nostop noprint pass" keeps it going.
+ *
+ * The trap mode trades fidelity for speed: MEMSIM_TRAP_NONE leaves the driver
+ * mappings writable so register accesses cost what memory accesses cost but
+ * nothing is modelled, MEMSIM_TRAP_ALL traps the loads as well to count them.
+ *
+ * DMAMem buffers (locked pages looked up in /proc/self/pagemap) are not
+ * served by a backend, DMA transfers complete without moving data.
+ */
+
+typedef enum _MEMSIM_TRAP_ {
+	MEMSIM_TRAP_NONE = 0,
+	MEMSIM_TRAP_WRITES,
+	MEMSIM_TRAP_ALL,
+} MEMSIM_TRAP, *PMEMSIM_TRAP;
+
+class MemSimBackend : public MemBackend
+{
+public:
+
+	class Block
+	{
+	public:
+
+		uint32_t
+		Read (
+			_In_ uint32_t PhyAddr
+		);
+
+		//
+		// Updates a register as the hardware would, it's not seen by the hooks.
+		//
+
+		void
+		Write (
+			_In_ uint32_t PhyAddr,
+			_In_ uint32_t Value
+		);
+
+	private:
+
+		friend class MemSimBackend;
+
+		uint32_t m_PhyAddr;
+		size_t m_Size;
+		int32_t m_Fd;
+		uint32_t *m_View;					//The hooks' mapping, never faults
+		std::vector<std::function<void(Block &, uint32_t, uint32_t, uint32_t)>> m_Hooks;
+	};
+
+	//
+	// Called after the driver wrote Value to the register at PhyAddr, which
+	// held Previous before.
+	//
+
+	typedef std::function<void(Block &Regs, uint32_t PhyAddr, uint32_t Value, uint32_t Previous)> MemSimWriteHook;
+
+	MemSimBackend (
+		void
+	);
+
+	virtual
+	~MemSimBackend (
+		void
+	);
+
+	virtual
+	int32_t
+	Open (
+		void
+	);
+
+	virtual
+	void
+	Close (
+		void
+	);
+
+	virtual
+	void *
+	Map (
+		_In_ uint32_t PhyAddr,
+		_In_ size_t Len
+	);
+
+	virtual
+	void
+	Unmap (
+		_In_ void *Virt,
+		_In_ size_t Len
+	);
+
+	//
+	// Calls Hook for every driver write to the block holding
+	// [PhyAddr, PhyAddr + Len), the block is created if needed. Register blocks
+	// mapped later by the drivers must fall within one block.
+	//
+
+	int32_t
+	AddWriteHook (
+		_In_ uint32_t PhyAddr,
+		_In_ size_t Len,
+		_In_ MemSimWriteHook Hook
+	);
+
+	//
+	// Adds the models of GPIO, the clock manager, PWM, PCM, both BSC (I2C)
+	// controllers and DMA channels 0-14.
+	//
+
+	int32_t
+	AddDefaultModels (
+		void
+	);
+
+	//
+	// Drives the level of the input pins in Mask, bit n is GPIO n. The edge
+	// and level detectors latch into GPEDSn right away.
+	//
+
+	void
+	SetInputLevels (
+		_In_ uint64_t Mask,
+		_In_ uint64_t Levels
+	);
+
+	//
+	// Applies to the mappings made so far and later ones, MEMSIM_TRAP_WRITES
+	// by default.
+	//
+
+	void
+	SetTrapMode (
+		_In_ MEMSIM_TRAP Mode
+	);
+
+	//
+	// Number of driver accesses trapped so far.
+	//
+
+	uint64_t
+	GetWriteCount (
+		void
+	);
+
+	uint64_t
+	GetReadCount (
+		void
+	);
+
+	static const uint32_t MAX_MAPPINGS = 32;
+
+private:
+
+	typedef struct _SimMapping_ {
+		uintptr_t Base;					//Page aligned, 0 if the slot is free
+		size_t Size;
+		Block *Regs;
+	} SimMapping;
+
+	Block *
+	FindBlock (
+		_In_ uint32_t PhyAddr,
+		_In_ size_t Len,
+		_In_ bool Create
+	);
+
+	int
+	GetProtection (
+		void
+	);
+
+	const SimMapping *
+	FindMapping (
+		_In_ uintptr_t Addr
+	);
+
+	void
+	DispatchWrite (
+		_In_ const SimMapping &Mapping,
+		_In_ uintptr_t Addr,
+		_In_ uint32_t Value,
+		_In_ uint32_t Previous
+	);
+
+	void
+	UpdateLevels (
+		_Inout_ Block &Regs
+	);
+
+	void
+	GpioWrite (
+		_Inout_ Block &Regs,
+		_In_ uint32_t PhyAddr,
+		_In_ uint32_t Value,
+		_In_ uint32_t Previous
+	);
+
+	static
+	void
+	SegvHandler (
+		_In_ int Signal,
+		_In_ siginfo_t *Info,
+		_In_ void *Context
+	);
+
+	static
+	void
+	TrapHandler (
+		_In_ int Signal,
+		_In_ siginfo_t *Info,
+		_In_ void *Context
+	);
+
+	static MemSimBackend *s_Active;
+
+	std::vector<Block *> m_Blocks;
+	SimMapping m_Mappings[MAX_MAPPINGS];
+	std::atomic_flag m_HookLock;
+	MEMSIM_TRAP m_TrapMode;
+	std::atomic<uint64_t> m_Writes;
+	std::atomic<uint64_t> m_Reads;
+
+	//
+	// GPIO pin state, under m_HookLock.
+	//
+
+	Block *m_GpioRegs;
+	uint64_t m_OutLevels;
+	uint64_t m_PullUps;
+	uint64_t m_InputMask;
+	uint64_t m_InputLevels;
+	uint64_t m_Levels;
+};
+
+void
+MemSimDemo (
+	void
+);
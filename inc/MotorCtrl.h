@@ -11,6 +11,7 @@
 
 #include "GpioOut.h"
 #include "GpioBase.h"
+#include "GpioDmaPwm.h"
 #include "Rpi3BConstants.h"
 
 //Using the TB6612FNG H-bridge to control two motors
@@ -24,7 +25,17 @@ public:
 	void CCW();
 	void CW();
 	void Stop();
+
+	//Speed is from 0.0 (stopped) to 1.0 (full), it's the duty cycle of PWMA/PWMB
+	void SetSpeed(float SpeedA, float SpeedB);
+
+	//Signed speed per motor, -1.0 to 1.0, positive is forward. The direction of
+	//both motors is changed by one register write, 0 stops the motor (IN1/IN2 low)
+	void Drive(float SpeedA, float SpeedB);
 private:
+	static void AddDirection(float Speed, uint64_t In1, uint64_t In2,
+							 uint64_t &set_mask, uint64_t &clear_mask);
+
 	const static uint32_t GPIO_AIN1 = 12;
 	const static uint32_t GPIO_AIN2 = 13;
 	const static uint32_t GPIO_PWMA = 6;
@@ -32,7 +43,20 @@ private:
 	const static uint32_t GPIO_BIN2 = 21;
 	const static uint32_t GPIO_PWMB = 26;
 
+	//Pin groups folded into GPSET0/GPCLR0 masks at compile time
+	typedef PinSet<GPIO_AIN1, GPIO_BIN1> PINS_IN1;
+	typedef PinSet<GPIO_AIN2, GPIO_BIN2> PINS_IN2;
+	typedef PinSet<GPIO_AIN1, GPIO_AIN2, GPIO_BIN1, GPIO_BIN2> PINS_IN;
+	typedef PinSet<GPIO_PWMA, GPIO_PWMB> PINS_PWM;
+
+	//Masks of single pins for the directions picked at run time by Drive()
+	const static uint64_t MASK_AIN1 = PinSet<GPIO_AIN1>::MASK;
+	const static uint64_t MASK_AIN2 = PinSet<GPIO_AIN2>::MASK;
+	const static uint64_t MASK_BIN1 = PinSet<GPIO_BIN1>::MASK;
+	const static uint64_t MASK_BIN2 = PinSet<GPIO_BIN2>::MASK;
+
 	std::vector<GpioBase *> m_pins;
+	GpioDmaPwm *m_pwm;
 };
 
 void MotorDemo();
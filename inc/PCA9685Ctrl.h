@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <bitset>
 #include "GpioI2C.h"
 
 /*
@@ -46,10 +47,28 @@ public:
 	// TODO: We don't support programming MODE2 reg for now.
 	//
 
+	//
+	// In burst mode MODE1.AI (auto-increment) is enabled once, then the four
+	// LEDn_ON_L/ON_H/OFF_L/OFF_H registers of a channel, or of a run of
+	// adjacent channels, are written in a single I2C transaction.
+	//
+
 	PCA9685Ctrl (
 		_In_ int32_t PinSda,
 		_In_ int32_t PinScl,
-		_In_ const int8_t I2CAddr
+		_In_ const int8_t I2CAddr,
+		_In_ int32_t BurstMode = 1
+		);
+
+	//
+	// Several modules on one bus share a single I2C control instance, the
+	// caller keeps it alive.
+	//
+
+	PCA9685Ctrl (
+		_In_ GpioI2C &I2CCtrl,
+		_In_ const int8_t I2CAddr,
+		_In_ int32_t BurstMode = 1
 		);
 
 	virtual
@@ -86,6 +105,44 @@ public:
 		_In_ int32_t RisingEdgeDelay = 0
 		);
 
+	int32_t
+	SetPWMDutyCycles (
+		_In_ int32_t FirstChannelIdx,
+		_In_ const std::vector<float> &DutyCycles,
+		_In_ int32_t RisingEdgeDelay = 0
+		);
+
+	//
+	// The module keeps a host side mirror of the registers. Stage* only update
+	// the mirror and mark the bytes which changed as dirty, Flush() sends the
+	// dirty bytes, each run of them (short clean gaps included) in one
+	// auto-increment write. Set* are Stage* followed by Flush(), so resending
+	// an unchanged duty cycle costs no I2C traffic.
+	//
+
+	int32_t
+	StageRegister (
+		_In_ uint8_t Reg,
+		_In_ uint8_t Val
+		);
+
+	int32_t
+	StagePWMDutyCycle (
+		_In_ int32_t ChannelIdx,
+		_In_ float DutyCycle,
+		_In_ int32_t RisingEdgeDelay = 0
+		);
+
+	int32_t
+	Flush (
+		void
+		);
+
+	int32_t
+	Sync (
+		void
+		);
+
 	//
 	// The PCA9685 also supports programmable group I2C address, check
 	//
@@ -97,7 +154,27 @@ public:
 		ALLCALLADR
 	} PCA9685GroupRegs, *PPCA9685GroupRegs;
 
+	//
+	// Makes the module respond to a group (7 bits) address as well, so a write
+	// to the group address updates all members at once. Check chapter 7.3.6
+	// for more details, LED All Call (0x70) is enabled at power on.
+	//
+
+	int32_t
+	JoinGroup (
+		_In_ PCA9685GroupRegs Group,
+		_In_ int8_t GroupAddr
+		);
+
+	int32_t
+	LeaveGroup (
+		_In_ PCA9685GroupRegs Group
+		);
+
+	int8_t GetI2CAddr();
+
 private:
+	friend class PCA9685Group;
 
 	//
 	// The PCA9685 integrated with an oscillator can be used as the clock source
@@ -124,6 +201,126 @@ private:
 	const static int8_t REG_LEDALL_OFF_HIGH_ADDR	=		0xFD;
 	const static int8_t REG_PRE_SCALE_ADDR			=		0xFE;
 
+	const static int8_t REG_LED15_OFF_HIGH_ADDR		=		0x45;
+
+	static const int32_t NUM_OF_CHANNELS			=		16;
+	static const int32_t BYTES_PER_CHANNEL			=		4;
+	static const int32_t NUM_OF_REGS				=		256;
+
+	//
+	// Resending a few clean bytes is cheaper than the start condition, the
+	// slave address and the register address of another write.
+	//
+
+	static const int32_t MAX_FLUSH_GAP				=		3;
+
+	static
+	int32_t
+	IsCacheable (
+		_In_ uint8_t Reg
+		);
+
+	void
+	UpdateMirror (
+		_In_ uint8_t FirstReg,
+		_In_ const int8_t *Vals,
+		_In_ uint32_t Len,
+		_In_ int32_t Written
+		);
+
+	int32_t
+	WriteRun (
+		_In_ uint8_t First,
+		_In_ uint8_t Last
+		);
+
+	static
+	void
+	EncodeDutyCycle (
+		_In_ float DutyCycle,
+		_In_ int32_t RisingEdgeDelay,
+		_Out_ int8_t *Regs
+		);
+
+	int32_t
+	EnableAutoIncrement (
+		void
+		);
+
 	const int8_t m_I2CSlaveAddr;
 	GpioI2C *m_I2CCtrl;
+	int32_t m_OwnsI2CCtrl;
+	int32_t m_BurstMode;
+	int32_t m_AutoIncrement;		//MODE1.AI has been set
+
+	uint8_t m_Shadow[NUM_OF_REGS];
+	std::bitset<NUM_OF_REGS> m_Valid;	//The mirror matches the module
+	std::bitset<NUM_OF_REGS> m_Dirty;	//Staged, not written yet
+};
+
+/*
+ * PCA9685Group drives the modules which joined the same group address. Every
+ * write is one transaction to the group address, whatever the number of
+ * members, and the mirrors of the members are updated with it. Group writes
+ * can't be read back, so the members must be in burst mode.
+ */
+
+class PCA9685Group
+{
+public:
+
+	PCA9685Group (
+		_In_ GpioI2C &I2CCtrl,
+		_In_ PCA9685Ctrl::PCA9685GroupRegs Group,
+		_In_ int8_t GroupAddr
+		);
+
+	virtual
+	~PCA9685Group (
+		void
+		);
+
+	int32_t
+	Add (
+		_In_ PCA9685Ctrl &Member
+		);
+
+	int32_t
+	Remove (
+		_In_ PCA9685Ctrl &Member
+		);
+
+	int32_t
+	SetPWMDutyCycle (
+		_In_ int32_t ChannelIdx,
+		_In_ float DutyCycle,
+		_In_ int32_t RisingEdgeDelay = 0
+		);
+
+	int32_t
+	SetPWMDutyCycles (
+		_In_ int32_t FirstChannelIdx,
+		_In_ const std::vector<float> &DutyCycles,
+		_In_ int32_t RisingEdgeDelay = 0
+		);
+
+	int32_t
+	SetPWMDutyCycle (
+		_In_ float DutyCycle,
+		_In_ int32_t RisingEdgeDelay = 0
+		);
+
+private:
+
+	int32_t
+	Broadcast (
+		_In_ const std::vector<int8_t> &Packet,
+		_In_ uint8_t MirrorReg,
+		_In_ const std::vector<int8_t> &MirrorVals
+		);
+
+	GpioI2C *m_I2CCtrl;
+	PCA9685Ctrl::PCA9685GroupRegs m_Group;
+	const int8_t m_GroupAddr;
+	std::vector<PCA9685Ctrl *> m_Members;
 };
@@ -12,15 +12,29 @@
 
 #define RPI_OSCILLATOR_FREQ			19200000ull
 
+//
+// The core clock (VPU) drives the BSC (I2C) controllers.
+//
+
+#define RPI_CORE_CLK_FREQ			250000000ull
+
 #define PERIPHERAL_PHY_BASE			0x3F000000
 #define PERIPHERAL_BUS_BASE			0x7E000000
 
+//
+// The DMA engines see SDRAM through bus aliases, 0xC0000000 is the uncached one
+// which doesn't go through the VC L2 cache.
+//
+
+#define SDRAM_BUS_BASE				0xC0000000
+
 //PWM Related Address
 #define GPIO_CLOCK_OFFSET			0x00101000
 #define GPIO_BASE_OFFSET			0x00200000
 #define GPIO_PWM_OFFSET				0x0020C000
 #define GPIO_I2C0_OFFSET			0x00205000
 #define GPIO_I2C1_OFFSET			0x00804000
+#define GPIO_PCM_OFFSET				0x00203000
 
 //DMA Related Address
 #define DMA_OFFSET					0x00007000
@@ -30,6 +44,12 @@
 
 #define PWM_CLK_SRC_REQ				RPI_OSCILLATOR_FREQ
 
+//
+// PLLD, clock source 6 of the clock managers
+//
+
+#define RPI_PLLD_FREQ				500000000ull
+
 typedef enum _GPIO_FUN_SELECT_ {
 	FSEL_INPUT	= 0b0000,
 	FSEL_OUTPUT	= 0b0001,
@@ -45,8 +65,29 @@ typedef enum _GPIO_PULL_ {
 	PULL_DISABLE	= 0b00,
 	PULL_DOWN		= 0b01,
 	PULL_UP			= 0b10,
+
+	//
+	// Not a register value, leaves the pull of the pin as it is.
+	//
+
+	PULL_KEEP		= 0b11,
 } GPIO_PULL, *PGPIO_PULL;
 
+//
+// Event detection of an input pin, one of GPRENn/GPFENn/GPHENn/GPLENn/GPARENn/
+// GPAFENn in this order.
+//
+
+typedef enum _GPIO_EVENT_ {
+	EVENT_NONE			= 0,
+	EVENT_RISING		= 1,
+	EVENT_FALLING		= 2,
+	EVENT_HIGH			= 3,
+	EVENT_LOW			= 4,
+	EVENT_ASYNC_RISING	= 5,
+	EVENT_ASYNC_FALLING	= 6,
+} GPIO_EVENT, *PGPIO_EVENT;
+
 typedef enum _ONOFF_ {
 	OFF = 0,
 	ON = 1,
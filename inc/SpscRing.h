@@ -0,0 +1,146 @@
+/*
+ * SpscRing.h
+ *
+ *  Created on: Feb 27, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "AlphaBotTypes.h"
+
+/*
+ * SpscRing is a lock-free single producer/single consumer ring of T. Push is
+ * called from one thread and Pop from one other thread, neither blocks nor
+ * allocates. The capacity is rounded up to a power of 2 so the free running
+ * head and tail are folded into the ring with a mask.
+ *
+ * The producer publishes an item by storing the tail with release semantics
+ * and the consumer frees a slot by storing the head the same way, each side
+ * loads the other's index with acquire semantics.
+ */
+
+template <typename T>
+class SpscRing
+{
+public:
+
+	SpscRing (
+		_In_ uint32_t Capacity
+		) : m_Ring(NULL),
+			m_Mask(0),
+			m_Tail(0),
+			m_Head(0)
+	{
+		uint32_t Size = 2;
+
+		while (Size < Capacity) {
+			Size <<= 1;
+		}
+
+		m_Ring = new T[Size];
+		m_Mask = Size - 1;
+	}
+
+	~SpscRing (
+		void
+		)
+	{
+		delete [] m_Ring;
+		m_Ring = NULL;
+	}
+
+	//
+	// Producer side. Returns 0 if queued, -1 if the ring is full.
+	//
+
+	int32_t
+	Push (
+		_In_ const T &Item
+		)
+	{
+		uint32_t Tail = m_Tail.load(std::memory_order_relaxed);
+
+		if (Tail - m_Head.load(std::memory_order_acquire) > m_Mask) {
+			return -1;
+		}
+
+		m_Ring[Tail & m_Mask] = Item;
+		m_Tail.store(Tail + 1, std::memory_order_release);
+		return 0;
+	}
+
+	//
+	// Consumer side. Returns 1 if the oldest item was taken, 0 if the ring is
+	// empty.
+	//
+
+	int32_t
+	Pop (
+		_Out_ T &Item
+		)
+	{
+		return (0 != Pop(&Item, 1)) ? 1 : 0;
+	}
+
+	//
+	// Consumer side. Pops up to MaxItems items, oldest first, and returns the
+	// number popped.
+	//
+
+	uint32_t
+	Pop (
+		_Out_ T *Items,
+		_In_ uint32_t MaxItems
+		)
+	{
+		uint32_t Count;
+		uint32_t Head = m_Head.load(std::memory_order_relaxed);
+
+		Count = m_Tail.load(std::memory_order_acquire) - Head;
+		if (Count > MaxItems) {
+			Count = MaxItems;
+		}
+
+		for (uint32_t i = 0; i < Count; i++) {
+			Items[i] = m_Ring[(Head + i) & m_Mask];
+		}
+
+		if (0 != Count) {
+			m_Head.store(Head + Count, std::memory_order_release);
+		}
+
+		return Count;
+	}
+
+private:
+
+	//
+	// Owns the ring, not copyable.
+	//
+
+	SpscRing (
+		const SpscRing &
+	);
+
+	SpscRing &
+	operator= (
+		const SpscRing &
+	);
+
+	T *m_Ring;
+	uint32_t m_Mask;			//Capacity - 1
+
+	//
+	// Written by the producer and the consumer respectively, padded to keep
+	// them on their own cache lines (operator new doesn't honor alignas in
+	// C++14).
+	//
+
+	uint8_t m_Pad0[64];
+	std::atomic<uint32_t> m_Tail;
+	uint8_t m_Pad1[64];
+	std::atomic<uint32_t> m_Head;
+	uint8_t m_Pad2[64];
+};
@@ -9,30 +9,49 @@
 
 #include <wiringPi.h>
 #include <stdint.h>
+#include <vector>
 #include "AlphaBotTypes.h"
+#include "AlphaRobotConstants.h"
 #include "GpioPwm.h"
 #include "Rpi3BConstants.h"
 
 /*
  * The WS2812B LED takes 24 "bits" (G, R, B) to control the color and brightness
- * We have 4 WS2812B LEDs on the robot, so we need 4 * 24 = 96"bits" to control all of them
- * After sending these 96"bits", the pin should be reset for >= 50us indicates control done
+ * We have 4 WS2812B LEDs on the robot, a strip of any length may be chained on
+ * the pin, each LED takes 24 "bits" and passes the rest on to the next one.
+ * After sending all the "bits", the pin should be reset for >= 50us indicates control done
  * We are using the PWM serializer mode to send these "bits", base on the datasheet to WS2812B
  * each "bits" lasts 1.25us (8MHz):
  * 		- logical 1 is 0.8us high and 0.45us low
  * 		- logical 0 is 0.4us high and 0.85us low
  * So we may use 1 PWM pulse to indicate 1 "bit", and each logical bit lasts about 1.25 / 3 us (2.4MHz)	=> WS2812B_PWM_DIVIDOR
  * The PWM serializer mode outputs PWM wave by bits, the "RNG1/2" register indicates who wide each word represents => WS2812B_PWM_RANGE
- * We use 24 * 4 * 3 /32 = 9 words in the FIFO to control these 4 LEDs.
- * ToDo:
- * Using DMA to update the FIFO
+ * Every 4 LEDs take 24 * 4 * 3 / 32 = 9 words in the FIFO, the 4 LEDs of the robot fit in the 16 words FIFO.
+ * Each color byte goes out MSB first in G, R, B order. Its 24 "bits" of
+ * symbols are looked up in a 256-entry table, which also applies the
+ * brightness and the gamma (WS2812B_GAMMA) since SetBrightness() rebuilds it,
+ * so the frame path has no floating point. 4 LEDs make 9 whole words so
+ * frames are packed a group at a time with shifts only.
+ *
+ * The strip is sized at construction. SetPixel() updates the colors and
+ * Show() encodes them into the frame buffer and sends it, followed by the
+ * latch words. Without DMA the CPU keeps topping up the FIFO until the frame
+ * is out, a frame longer than the FIFO breaks if the thread is preempted for
+ * more than 16 words (213us). In streaming mode, a DMA channel paced by the PWM
+ * DREQ feeds the FIFO, so the CPU only copies the frame to the DMA buffer and
+ * kicks the channel, and the next frame is encoded while this one goes out.
+ * Either way a frame takes 30us per LED plus the latch on the wire.
  */
+class DMACtrl;
+
 class WS2812BCtrl
 {
 public:
 
 	WS2812BCtrl (
-		_In_ float brightness = 0.3
+		_In_ float brightness = 0.3,
+		_In_ int32_t UseDMA = 0,
+		_In_ uint32_t LedCount = WS2812B_LED_COUNT
 		);
 
 	~WS2812BCtrl (
@@ -44,6 +63,26 @@ public:
 		_In_ float Brightness
 		);
 
+	uint32_t
+	GetLedCount (
+		void
+		);
+
+	void
+	SetPixel (
+		_In_ uint32_t Idx,
+		_In_ const LEDPixel &Color
+		);
+
+	//
+	// Sends the pixels to the strip, returns 0 on success.
+	//
+
+	int32_t
+	Show (
+		void
+		);
+
 	void
 	setSerializedRGB (
 		_Out_ uint32_t *arr,
@@ -51,25 +90,95 @@ public:
 		_In_ const LEDPixel &color
 		);
 
+	//
+	// Encodes count pixels into the first GetFrameWords(count) words of arr.
+	//
+
 	void
+	EncodeFrame (
+		_Out_ uint32_t *arr,
+		_In_ const LEDPixel *pixels,
+		_In_ uint32_t count
+		);
+
+	static
+	uint32_t
+	GetFrameWords (
+		_In_ uint32_t count
+		);
+
+	int32_t
 	OneShot (
-		_In_ uint32_t *vals,
+		_In_ const uint32_t *vals,
+		_In_ uint32_t len
+		);
+
+	int32_t
+	Stream (
+		_In_ const uint32_t *vals,
 		_In_ uint32_t len
 		);
 
 private:
+
+	static
+	uint32_t
+	ClampColor (
+		_In_ uint32_t Channel
+		);
+
+	static
+	uint32_t
+	GetSymbols (
+		_In_ uint32_t Byte
+		);
+
+	void
+	EncodeGroup (
+		_Out_ uint32_t *Words,
+		_In_ const LEDPixel *Pixels,
+		_In_ uint32_t Count
+		);
+
+	static
+	void
+	PackGroup (
+		_Out_ uint32_t *Words,
+		_In_ const uint32_t *Codes
+		);
+
+	static const uint32_t WS2812B_LATCH_WORDS = 24;		//24 * 32 / 2.4MHz = 320us low to latch the frame
+	static const uint32_t WS2812B_STREAM_TIMEOUT_US = 100000;
+	static const uint32_t WS2812B_FIFO_TIMEOUT_US = 1000;	//Per word, 13.3us on the wire
+
 	static const uint32_t BITS_PER_COLOR = 8;
+	static const uint32_t WS2812B_SYMBOL_ONE = 0x6;		//0b110
+	static const uint32_t WS2812B_SYMBOL_ZERO = 0x4;	//0b100
+	static const uint32_t WS2812B_GROUP_LEDS = 4;		//4 * 72 bits = 9 words
+	static const uint32_t WS2812B_GROUP_WORDS = 9;
 	static const uint32_t WS2812B_PWM_RANGE = 32;
 	static const uint32_t WS2812B_PWM_DIVIDOR = 8;		//19.2MHz / 8 = 2.4MHz
 	static const uint32_t WS2812B_PWM_MODE = 1;			//Seriliser mode
 	static const uint32_t WS2812B_PWM_FIFO = 1;			//Using FIFO
 
+	int32_t
+	FeedFIFO (
+		_In_ const uint32_t *Words,
+		_In_ uint32_t Len
+		);
+
 	GpioPwm *m_PWM;
+	DMACtrl *m_DMA;
+	uint32_t m_LedCount;
+	std::vector<LEDPixel> m_Pixels;
+	std::vector<uint32_t> m_Frame;		//Encoded by Show()
 	float m_Brightness;
+	uint8_t m_Lut[256];					//Brightness and gamma corrected color byte
+	uint32_t m_Code[256];				//Symbols of m_Lut[], first one in bits 23:21
 };
 
 //
 // Sample code
 //
 
-void WaterLight();
+void WaterLight(int32_t UseDMA = 0);
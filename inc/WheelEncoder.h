@@ -0,0 +1,166 @@
+/*
+ * WheelEncoder.h
+ *
+ *  Created on: Apr 10, 2021
+ *      Author: Albert Guan
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "AlphaBotTypes.h"
+#include "AlphaRobotConstants.h"
+#include "GpioBase.h"
+#include "DiffDrive.h"
+
+/*
+ * WheelEncoder counts the ticks of the two wheel encoders.
+ *
+ * The edges are caught by the async edge detectors (GPARENn/GPAFENn), which
+ * latch into GPEDSn even when the pulse is far shorter than the polling
+ * period. A SCHED_FIFO reader thread polls GPEDSn, clears exactly the bits it
+ * saw and updates the counts, so nothing is lost as long as a pin doesn't
+ * toggle twice within a poll period.
+ *
+ * A single channel encoder (B pin is -1) counts its rising edges and takes
+ * the direction from SetDirection(). A quadrature encoder detects both edges
+ * of A and B and decodes the direction from the levels. A wheel whose A pin
+ * is -1, the default, isn't counted.
+ *
+ * Readers get a consistent snapshot of a wheel through a sequence lock, the
+ * speed is derived from the time between the last two edges, and decays
+ * when edges stop coming.
+ */
+
+typedef enum _WHEEL_ {
+	WHEEL_LEFT = 0,
+	WHEEL_RIGHT,
+	WHEEL_COUNT,
+} WHEEL, *PWHEEL;
+
+typedef struct _WheelState_ {
+	int64_t Ticks;				//Signed, forward is positive
+	float TicksPerSec;			//Signed
+	uint64_t LastEdgeNs;		//CLOCK_MONOTONIC, 0 before the first edge
+	uint64_t Errors;			//Quadrature steps skipped, the poll was too slow
+} WheelState;
+
+class WheelEncoder : public GpioBase
+{
+public:
+
+	WheelEncoder (
+		_In_ int32_t LeftA = WHEEL_ENCODER_LEFT_A,
+		_In_ int32_t LeftB = WHEEL_ENCODER_LEFT_B,
+		_In_ int32_t RightA = WHEEL_ENCODER_RIGHT_A,
+		_In_ int32_t RightB = WHEEL_ENCODER_RIGHT_B,
+		_In_ uint32_t PollUs = WHEEL_ENCODER_POLL_US
+	);
+
+	virtual
+	~WheelEncoder (
+		void
+	);
+
+	int32_t
+	Start (
+		void
+	);
+
+	void
+	Stop (
+		void
+	);
+
+	void
+	GetState (
+		_In_ WHEEL Wheel,
+		_Out_ WheelState &State
+	);
+
+	//
+	// Direction of a single channel encoder, 1 forward or -1 backward. Ignored
+	// for quadrature encoders.
+	//
+
+	void
+	SetDirection (
+		_In_ WHEEL Wheel,
+		_In_ int32_t Sign
+	);
+
+	//
+	// Builds a DiffDrive feedback routine reporting the wheel speeds,
+	// normalized by the speed at full duty cycle. Single channel encoders take
+	// their direction from the output of Drive.
+	//
+
+	DiffDrive::DiffDriveFeedback
+	MakeFeedback (
+		_In_ DiffDrive &Drive,
+		_In_ float MaxTicksPerSec
+	);
+
+private:
+
+	typedef struct _WheelCounter_ {
+		int32_t PinA;
+		int32_t PinB;
+		uint64_t Mask;					//Bits of PinA/PinB in GPEDSn
+		std::atomic<int32_t> Sign;
+
+		//
+		// Owned by the reader thread.
+		//
+
+		uint32_t Levels;				//(A << 1) | B after the last poll
+		int32_t Direction;				//Of the last edge
+		int64_t Ticks;
+		uint64_t LastEdgeNs;
+		uint64_t PeriodNs;
+		uint64_t Errors;
+
+		//
+		// Published copy, written by the reader thread under Seq, odd while
+		// it's being written.
+		//
+
+		std::atomic<uint32_t> Seq;
+		std::atomic<int64_t> PubTicks;
+		std::atomic<uint64_t> PubLastEdgeNs;
+		std::atomic<uint64_t> PubPeriodNs;
+		std::atomic<int32_t> PubDirection;
+		std::atomic<uint64_t> PubErrors;
+	} WheelCounter;
+
+	void
+	ReaderThread (
+		void
+	);
+
+	void
+	Update (
+		_Inout_ WheelCounter &W,
+		_In_ uint64_t Events,
+		_In_ uint64_t Levels,
+		_In_ uint64_t NowNs
+	);
+
+	void
+	Publish (
+		_Inout_ WheelCounter &W
+	);
+
+	WheelCounter m_Wheels[WHEEL_COUNT];
+	uint64_t m_EventMask;
+	uint64_t m_PollNs;
+
+	std::atomic<int32_t> m_Stop;
+	std::thread m_Thread;
+};
+
+void
+WheelEncoderDemo (
+	void
+);
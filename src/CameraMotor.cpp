@@ -17,6 +17,7 @@
 #include <bitset>
 #include <assert.h>
 #include <CameraMotor.h>
+#include "CameraTrajectory.h"
 #include <exception>
 
 /*Based on the datasheet of SG90 motor
@@ -35,6 +36,7 @@ CameraMotor::CameraMotor (
 		m_PWMFreq(PWMFreq),
 		m_MinPosition(MinPosition),
 		m_MaxPosition(MaxPosition),
+		m_Position(MinPosition),
 		m_PCA9685Controller(&Controller)
 
 /*
@@ -145,10 +147,150 @@ CameraMotor::MoveTo (
 	m_PCA9685Controller->SetPWMDutyCycle(m_PCA9685ChannelId,
 										 (float)Position / 4096);
 
+	m_Position = Position;
+
 MoveToEnd:
 	return;
 }
 
+int32_t
+CameraMotor::StagePosition (
+	_In_ int32_t Position
+	)
+
+/*
+ Routine Description:
+
+	This routine stages the target position in the PCA9685 mirror, it takes
+	effect on the next flush of the controller.
+
+ Parameters:
+
+ 	Position - Supplies the position moves the motor to, it's clamped to the
+ 		range of the motor.
+
+ Return Value:
+
+	int32_t - Supplies the number of PCA9685 register bytes changed.
+
+*/
+
+{
+
+	assert(m_PCA9685Controller != NULL);
+
+	if (Position < m_MinPosition) {
+		Position = m_MinPosition;
+
+	} else if (Position > m_MaxPosition) {
+		Position = m_MaxPosition;
+	}
+
+	m_Position = Position;
+	return m_PCA9685Controller->StagePWMDutyCycle(m_PCA9685ChannelId,
+												  (float)Position / 4096);
+}
+
+int32_t
+CameraMotor::GetPosition (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the last position the motor was moved to.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - Supplies the position.
+
+*/
+
+{
+
+	return m_Position;
+}
+
+int32_t
+CameraMotor::GetMinPosition (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the min position the motor can reach.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - Supplies the position.
+
+*/
+
+{
+
+	return m_MinPosition;
+}
+
+int32_t
+CameraMotor::GetMaxPosition (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the max position the motor can reach.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - Supplies the position.
+
+*/
+
+{
+
+	return m_MaxPosition;
+}
+
+PCA9685Ctrl *
+CameraMotor::GetController (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the PCA9685 control instance of the motor.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	PCA9685Ctrl * - Supplies the control instance.
+
+*/
+
+{
+
+	return m_PCA9685Controller;
+}
+
 void
 TwoMotorCtrl (
 	void
@@ -197,31 +339,21 @@ TwoMotorCtrl (
 						   PITCH_MOTOR_MAX,
 						   PWMController);
 
-	sleep(1);
-	int YawPosition = YAW_MOTOR_MIN;
-	int PitchPosition = PITCH_MOTOR_MIN;
-	int percentage = 0;
-	int increase = 1;
-	while(1) {
-		MotorYaw.MoveTo(YawPosition);
-		MotorPitch.MoveTo(PitchPosition);
-		usleep(500000);
-		if (increase) {
-			percentage += 2;
-
-		} else {
-			percentage -= 2;
-		}
-
-		if (percentage >= 100) {
-			increase = 0;
+	//
+	// Sweep both motors between the ends of their ranges, the trajectory
+	// engine ramps them smoothly and updates both in one I2C write per tick.
+	//
 
-		} else if (percentage <= 0) {
-			increase = 1;
-		}
+	CameraTrajectory Trajectory(PWMController);
+	Trajectory.AddAxis(MotorYaw);
+	Trajectory.AddAxis(MotorPitch);
 
-		YawPosition = YAW_MOTOR_MIN + (YAW_MOTOR_RANGE * percentage) / 100;
-		PitchPosition = PITCH_MOTOR_MIN + (PITCH_MOTOR_RANGE * percentage) / 100;
+	sleep(1);
+	while(1) {
+		Trajectory.AddWaypoint({YAW_MOTOR_MAX, PITCH_MOTOR_MAX}, 200);
+		Trajectory.AddWaypoint({YAW_MOTOR_MIN, PITCH_MOTOR_MIN}, 200);
+		Trajectory.Run();
+		RPI_PRINT_EX(InfoLevelDebug, "Max tick lateness %u us", Trajectory.GetMaxLatenessUs());
 	}
 
 	return;
@@ -0,0 +1,441 @@
+/*
+ * CameraTrajectory.cpp
+ *
+ *  Created on: Feb 6, 2021
+ *      Author: Albert Guan
+ *
+ *  This module implements the definition of the camera trajectory engine
+ *  for AlphaRobot 2.
+ */
+
+#include <math.h>
+#include <assert.h>
+#include "CameraTrajectory.h"
+#include "Diag.h"
+
+CameraTrajectory::CameraTrajectory (
+	_In_ PCA9685Ctrl &Controller,
+	_In_ uint32_t RateHz
+	) : m_Controller(&Controller),
+		m_PeriodNs(1000000000 / RateHz),
+		m_Stop(0),
+		m_MaxLatenessUs(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of CameraTrajectory.
+
+ Parameters:
+
+ 	Controller - Supplies the PCA9685 control instance all motors are on.
+
+ 	RateHz - Supplies the control rate.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	assert(RateHz > 0);
+	return;
+}
+
+CameraTrajectory::~CameraTrajectory (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of CameraTrajectory.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_Controller = NULL;
+	return;
+}
+
+int32_t
+CameraTrajectory::AddAxis (
+	_In_ CameraMotor &Motor,
+	_In_ float MaxVelocity,
+	_In_ float MaxAccel
+	)
+
+/*
+ Routine Description:
+
+	This routine adds a motor to the engine.
+
+ Parameters:
+
+ 	Motor - Supplies the motor, it must be on the PCA9685 of the engine.
+
+ 	MaxVelocity - Supplies the max velocity in counts per second.
+
+ 	MaxAccel - Supplies the max acceleration in counts per second^2.
+
+ Return Value:
+
+	int32_t - Supplies the index of the axis.
+
+*/
+
+{
+
+	assert(Motor.GetController() == m_Controller);
+	assert(MaxVelocity > 0 && MaxAccel > 0);
+
+	m_Axes.push_back({&Motor, MaxVelocity, MaxAccel});
+	return m_Axes.size() - 1;
+}
+
+int32_t
+CameraTrajectory::AddWaypoint (
+	_In_ const std::vector<int32_t> &Positions,
+	_In_ uint32_t DwellMs
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a waypoint, it can be called while Run is running.
+
+ Parameters:
+
+ 	Positions - Supplies the position of each axis.
+
+ 	DwellMs - Supplies the time to stay at the waypoint.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if the number of positions is wrong.
+
+*/
+
+{
+
+	if (Positions.size() != m_Axes.size()) {
+		assert(Positions.size() == m_Axes.size());
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> Guard(m_WaypointLock);
+	m_Waypoints.push_back({Positions, DwellMs});
+	return 0;
+}
+
+void
+CameraTrajectory::Stop (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine makes Run return after the current tick, the motors stay
+	where they are.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_Stop.store(1);
+	return;
+}
+
+uint32_t
+CameraTrajectory::GetMaxLatenessUs (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the worst wake up lateness of the control loop.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint32_t - Supplies the lateness in microseconds.
+
+*/
+
+{
+
+	return m_MaxLatenessUs;
+}
+
+void
+CameraTrajectory::PlanSegment (
+	_In_ const std::vector<int32_t> &From,
+	_In_ const std::vector<int32_t> &To,
+	_Out_ CameraProfile &Profile
+	)
+
+/*
+ Routine Description:
+
+	This routine plans the profile of a move. An axis moving a distance D
+	with limits Vmax and Amax limits the normalized path to Vmax/D and
+	Amax/D, the smallest of them over all axes is used.
+
+ Parameters:
+
+ 	From - Supplies the start position of each axis.
+
+ 	To - Supplies the end position of each axis.
+
+ 	Profile - Supplies the profile.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	float Velocity = INFINITY;
+	float Accel = INFINITY;
+	float Distance;
+
+	for (uint32_t i = 0; i < m_Axes.size(); i++) {
+		Distance = fabsf(static_cast<float>(To[i] - From[i]));
+		if (Distance > 0) {
+			Velocity = fminf(Velocity, m_Axes[i].MaxVelocity / Distance);
+			Accel = fminf(Accel, m_Axes[i].MaxAccel / Distance);
+		}
+	}
+
+	if (isinf(Velocity)) {
+
+		//
+		// Nothing moves.
+		//
+
+		Profile = {0, 0, 0, 0};
+		return;
+	}
+
+	Profile.Accel = Accel;
+	if (Velocity * Velocity / Accel >= 1.0f) {
+
+		//
+		// The cruise velocity isn't reached before half way, triangle profile.
+		//
+
+		Profile.AccelTime = sqrtf(1.0f / Accel);
+		Profile.Velocity = Accel * Profile.AccelTime;
+		Profile.Duration = 2 * Profile.AccelTime;
+
+	} else {
+		Profile.Velocity = Velocity;
+		Profile.AccelTime = Velocity / Accel;
+		Profile.Duration = 1.0f / Velocity + Profile.AccelTime;
+	}
+
+	return;
+}
+
+float
+CameraTrajectory::Evaluate (
+	_In_ const CameraProfile &Profile,
+	_In_ float Time
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the normalized position of a profile at a time.
+
+ Parameters:
+
+ 	Profile - Supplies the profile.
+
+ 	Time - Supplies the time since the start of the move, in seconds.
+
+ Return Value:
+
+	float - Supplies s, from 0 to 1.
+
+*/
+
+{
+
+	float Remain;
+
+	if (Time >= Profile.Duration) {
+		return 1.0f;
+	}
+
+	if (Time <= 0) {
+		return 0;
+	}
+
+	if (Time < Profile.AccelTime) {
+		return 0.5f * Profile.Accel * Time * Time;
+	}
+
+	Remain = Profile.Duration - Time;
+	if (Remain < Profile.AccelTime) {
+		return 1.0f - 0.5f * Profile.Accel * Remain * Remain;
+	}
+
+	return 0.5f * Profile.Accel * Profile.AccelTime * Profile.AccelTime +
+		   Profile.Velocity * (Time - Profile.AccelTime);
+}
+
+void
+CameraTrajectory::WaitNextTick (
+	_Inout_ uint64_t &Deadline
+	)
+
+/*
+ Routine Description:
+
+	This routine sleeps until the next tick. Ticks are absolute, so the time
+	spent on I2C doesn't shift the period. If the loop fell more than a period
+	behind, it starts over from now instead of bursting to catch up.
+
+ Parameters:
+
+ 	Deadline - Supplies the current tick, updated to the next one.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Now;
+	int64_t LatenessNs;
+
+	Deadline += m_PeriodNs;
+	RpiSleepUntilNs(Deadline);
+
+	Now = RpiGetTimeNs();
+	LatenessNs = static_cast<int64_t>(Now - Deadline);
+	if (LatenessNs / 1000 > m_MaxLatenessUs) {
+		m_MaxLatenessUs = LatenessNs / 1000;
+	}
+
+	if (LatenessNs > m_PeriodNs) {
+		Deadline = Now;
+	}
+
+	return;
+}
+
+int32_t
+CameraTrajectory::Run (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine moves the motors through the queued waypoints, it returns
+	once the queue is empty or Stop is called.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - Supplies the number of waypoints reached.
+
+*/
+
+{
+
+	uint64_t Deadline;
+	std::vector<int32_t> From(m_Axes.size());
+	CameraWaypoint Waypoint;
+	CameraProfile Profile;
+	uint32_t Ticks;
+	uint32_t Tick;
+	float Time;
+	float s;
+	int32_t Reached = 0;
+
+	m_Stop.store(0);
+	for (uint32_t i = 0; i < m_Axes.size(); i++) {
+		From[i] = m_Axes[i].Motor->GetPosition();
+	}
+
+	Deadline = RpiGetTimeNs();
+	while (0 == m_Stop.load()) {
+		{
+			std::lock_guard<std::mutex> Guard(m_WaypointLock);
+			if (m_Waypoints.empty()) {
+				break;
+			}
+
+			Waypoint = m_Waypoints.front();
+			m_Waypoints.pop_front();
+		}
+
+		PlanSegment(From, Waypoint.Positions, Profile);
+		Ticks = static_cast<uint32_t>(ceilf(Profile.Duration * 1e9f / m_PeriodNs));
+		for (Tick = 1; (Tick <= Ticks) && (0 == m_Stop.load()); Tick++) {
+			WaitNextTick(Deadline);
+			Time = static_cast<float>(Tick) * m_PeriodNs / 1e9f;
+			s = Evaluate(Profile, Time);
+
+			//
+			// Stage all motors, then a single flush for the whole tick.
+			//
+
+			for (uint32_t i = 0; i < m_Axes.size(); i++) {
+				m_Axes[i].Motor->StagePosition(
+					From[i] + lroundf((Waypoint.Positions[i] - From[i]) * s));
+			}
+
+			m_Controller->Flush();
+		}
+
+		if (0 != m_Stop.load()) {
+			break;
+		}
+
+		Reached += 1;
+		for (uint32_t i = 0; i < m_Axes.size(); i++) {
+			From[i] = m_Axes[i].Motor->GetPosition();
+		}
+
+		for (Tick = 0; (Tick < Waypoint.DwellMs * 1000000ull / m_PeriodNs) && (0 == m_Stop.load()); Tick++) {
+			WaitNextTick(Deadline);
+		}
+	}
+
+	return Reached;
+}
@@ -6,8 +6,10 @@
 #include <fcntl.h> //for file opening
 #include <stdint.h> //for uint32_t
 #include <string.h> //for memset
+#include <sched.h> //for sched_yield
 
 #include "DMA.h" // for DMA addresses, etc.
+#include "DMAMem.h" // for DMA buffers
 
 uint32_t DMACtrl::channel_in_use = 0;
 volatile DMACtrl::DMAReg_t *DMACtrl::dma_regs = NULL;
@@ -22,43 +24,56 @@ int dma_main()
 
 DMACtrl::DMACtrl(int32_t channel_num, uint32_t src_len)
 	: m_ch(channel_num),
+	  m_src(NULL),
+	  m_src_virtual(NULL),
+	  m_src_physical(NULL),
 	  m_dest_virtual(NULL),
-	  m_dest_physical(NULL)
+	  m_dest_physical(NULL),
+	  m_cb_virtual(NULL),
+	  m_cb_physical(NULL),
+	  m_src_len(src_len)
 {
-	if (src_len > (uint32_t)getpagesize())
+	if (DMACtrl::GeneralInit(channel_num) < 0)
 	{
-		std::cout << "Doesn't support DMA more than PAGE_SIZE(" << getpagesize() << ") bytes of data" << std::endl;
-		exit(1);
+		//Leave m_src NULL, IsValid() reports it and the channel stays with its owner
+		RPI_PRINT_EX(InfoLevelError, "DMA channel %d can't be claimed", channel_num);
 	}
-
-	if (DMACtrl::GeneralInit(channel_num) >= 0)
+	else
 	{
-		AllocMemory(&m_src_virtual);
-		GetPhyAddr(&m_src_virtual, &m_src_physical);
-
-		AllocMemory(&m_cb_virtual);
-		GetPhyAddr(&m_cb_virtual, &m_cb_physical);
-
-		DMACtrl::MarkChannelInUse(channel_num);
+		//The source may span multiple pages, the pool resolves every page
+		//and chains one CB per physically contiguous segment.
+		m_src = DMAMemPool::Alloc(src_len);
+		if (m_src == NULL)
+		{
+			std::cout << "Failed to allocate " << src_len << " bytes of DMA memory" << std::endl;
+			exit(1);
+		}
+
+		m_src_virtual = m_src->GetVirtAddr();
+		m_src_physical = (volatile void *)(uintptr_t)(m_src->GetBusAddr(0) & ~SDRAM_BUS_BASE);
+		m_cb_virtual = m_src->GetCBs();
+		m_cb_physical = (volatile void *)(uintptr_t)(m_src->GetCBBusAddr(0) & ~SDRAM_BUS_BASE);
 	}
-	++dma_instances;
 }
 
 DMACtrl::~DMACtrl()
 {
-	FreeMemory(&m_src_virtual);
-	FreeMemory(&m_cb_virtual);
+	//The source is only allocated once the channel was claimed
+	int32_t claimed = (m_src != NULL);
+
+	DMAMemPool::Free(m_src);
+	m_src = NULL;
 
 	//ToDo: How about peripheral destination?
 	FreeMemory(&m_dest_virtual);
 
-	channel_in_use &= ~(0x1 << m_ch);
-	--dma_instances;
-	if (0 == dma_instances)
-	{
-		munmap((void *)dma_regs, sizeof(DMAReg_t));
-		dma_regs = NULL;
-	}
+	if (claimed)
+		GeneralUninit(m_ch);
+}
+
+int32_t DMACtrl::IsValid()
+{
+	return (m_src != NULL);
 }
 
 volatile void *DMACtrl::getSrcVirtAddr()
@@ -68,7 +83,12 @@ volatile void *DMACtrl::getSrcVirtAddr()
 
 uint32_t DMACtrl::getSrcPhyAddr()
 {
-	return (uint32_t)m_src_physical;
+	return (uint32_t)(uintptr_t)m_src_physical;
+}
+
+uint32_t DMACtrl::getSrcLen()
+{
+	return m_src_len;
 }
 
 volatile DMACtrl::DMACtrlBlock_t *DMACtrl::getCBVirtAddr()
@@ -78,41 +98,66 @@ volatile DMACtrl::DMACtrlBlock_t *DMACtrl::getCBVirtAddr()
 
 uint32_t DMACtrl::getCBPhyAddr()
 {
-	return (uint32_t)m_cb_physical;
+	return (uint32_t)(uintptr_t)m_cb_physical;
 }
 
 uint32_t DMACtrl::getDestPhyAddr()
 {
-	return (uint32_t)m_dest_physical;
+	return (uint32_t)(uintptr_t)m_dest_physical;
 }
 
 
 volatile void *DMACtrl::SetDMADest(uint32_t dest_phy_addr, int32_t len)
 {
-	m_dest_physical = (volatile void *)dest_phy_addr;
-	m_dest_virtual = (volatile void *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, dest_phy_addr);
+	m_dest_physical = (volatile void *)(uintptr_t)dest_phy_addr;
+	m_dest_virtual = (volatile void *)MapRegisters(dest_phy_addr, len);
 	return m_dest_virtual;
 }
 
 int32_t DMACtrl::GeneralInit(int32_t channel_num)
 {
-
-	dma_regs = (volatile DMAReg_t *)mmap(NULL, sizeof(DMAReg_t), PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, DMA_BASE_ADDR);
-	if (dma_regs == MAP_FAILED)
+	//Only map the registers for the first instance
+	if (dma_regs == NULL)
 	{
-		std::cout << "Failed to map dma_regs!" << std::endl;
-		exit(2);
+		dma_regs = (volatile DMAReg_t *)MapRegisters(DMA_BASE_ADDR, sizeof(DMAReg_t));
+		if (dma_regs == MAP_FAILED)
+		{
+			std::cout << "Failed to map dma_regs!" << std::endl;
+			exit(2);
+		}
 	}
 
 	if (channel_in_use & (0x1 << channel_num))
 	{
 		std::cout << "Channel " << channel_num << " is already in use!\n";
+		if (0 == dma_instances)
+		{
+			UnmapRegisters(dma_regs, sizeof(DMAReg_t));
+			dma_regs = NULL;
+		}
 		return -1;
 	}
 
+	//Claim the channel and take a reference on the registers, GeneralUninit undoes both
+	MarkChannelInUse(channel_num);
+	++dma_instances;
 	return 0;
 }
 
+void DMACtrl::GeneralUninit(int32_t channel_num)
+{
+	channel_in_use &= ~(0x1 << channel_num);
+	--dma_instances;
+	if (0 == dma_instances)
+	{
+		UnmapRegisters(dma_regs, sizeof(DMAReg_t));
+		dma_regs = NULL;
+
+		//Nobody uses DMA anymore, unlock the buffers cached for reuse
+		DMAMemPool::Trim();
+	}
+}
+
 void DMACtrl::MarkChannelInUse(int32_t channel_num)
 {
 	DMACtrl::channel_in_use |= 0x1 << channel_num;
@@ -132,14 +177,16 @@ int32_t DMACtrl::AllocMemory(volatile void **vir)
 
 int32_t DMACtrl::GetPhyAddr(volatile void **vir, volatile void **phy)
 {
-	//Magic to determine the physical address for this page:
-	uint64_t pageInfo;
-	int file = open("/proc/self/pagemap", 'r');
-	lseek(file, ((size_t) *vir) >> 9, SEEK_SET);
-	read(file, &pageInfo, 8);
+	//The translation is cached, so it only costs a pagemap read for the first lookup of a page
+	uint32_t phy_addr;
+	if (PageMap::Lookup(*vir, &phy_addr) != 0)
+	{
+		*phy = NULL;
+		return -1;
+	}
 
-	*phy = (void*) (size_t) (pageInfo * getpagesize());
-	printf("GetPhyAddr virtual to phys: %p -> %p\n", *vir, *phy);
+	*phy = (volatile void *)(uintptr_t)phy_addr;
+	RPI_PRINT_EX(InfoLevelDebug, "virtual to phys: %p -> %p", *vir, *phy);
 	return 0;
 }
 
@@ -147,8 +194,10 @@ void DMACtrl::FreeMemory(volatile void **vir)
 {
 	if (*vir != NULL)
 	{
-		munlock((const void *)vir, getpagesize());
+		PageMap::Forget(*vir);
+		munlock((const void *)*vir, getpagesize());
 		free((void *)*vir);
+		*vir = NULL;
 	}
 }
 
@@ -164,10 +213,10 @@ void DMACtrl::debugPrintDMARegs()
 	printf("+m_ch: %d\n", m_ch);
 	printf("sizeof(DMAChannel_t): %d\n", sizeof(DMAChannel_t));
 	printf("+CtrlStatus: \t0x%08x\n", dma_regs->ch[m_ch].cs.word);
-	printf("+CBAddr: \t0x%08x, CBAddr: 0x%08x\n", dma_regs->ch[m_ch].cbAddr, (uint32_t)m_cb_physical);
+	printf("+CBAddr: \t0x%08x, CBAddr: 0x%08x\n", dma_regs->ch[m_ch].cbAddr, (uint32_t)(uintptr_t)m_cb_physical);
 	printf("+TransInfo: \t0x%08x\n", dma_regs->ch[5].transInfo.word);
-	printf("+srcAddr: \t0x%08x, SrcAddr: 0x%08x\n", dma_regs->ch[m_ch].srcAddr, (uint32_t)m_src_physical);
-	printf("+destAddr: \t0x%08x, DestAddr: 0x%08x\n", dma_regs->ch[m_ch].destAddr, (uint32_t)m_dest_physical);
+	printf("+srcAddr: \t0x%08x, SrcAddr: 0x%08x\n", dma_regs->ch[m_ch].srcAddr, (uint32_t)(uintptr_t)m_src_physical);
+	printf("+destAddr: \t0x%08x, DestAddr: 0x%08x\n", dma_regs->ch[m_ch].destAddr, (uint32_t)(uintptr_t)m_dest_physical);
 	printf("+transLen: \t0x%08x\n", dma_regs->ch[m_ch].translen.word);
 	printf("+Stride: \t0x%08x\n", dma_regs->ch[m_ch].stride.word);
 	printf("+nextCB: \t0x%08x\n", dma_regs->ch[m_ch].nextCB);
@@ -176,6 +225,9 @@ void DMACtrl::debugPrintDMARegs()
 
 void DMACtrl::dma_demo()
 {
+	if (!IsValid())
+		return;
+
 	std::cout << "\n\ndma_test start" << std::endl;
 
 	AllocateDestMem();
@@ -198,22 +250,124 @@ void DMACtrl::dma_demo()
 	cb->transInfo.word = 0;
 	cb->transInfo.src_inc = 1;
 	cb->transInfo.dest_inc = 1;
-	cb->srcAddr = (uint32_t) m_src_physical; //set source and destination DMA address
-	cb->destAddr = (uint32_t) m_dest_physical;
+	cb->srcAddr = PhyToBus(m_src_physical); //set source and destination DMA address
+	cb->destAddr = PhyToBus(m_dest_physical);
 	cb->transLen.x_len = 12; //transfer 12 bytes
 	cb->stride.word = 0; //no 2D stride
 	cb->nextCB = DMACtrl::NO_NEXT_CB; //no next control block
 
-	dma_regs->enable |= 0x1 << m_ch;
-	dma_regs->ch[m_ch].cs.reset = 1;
-	sleep(1);
-	dma_regs->ch[m_ch].debug.read_err = 1;
-	dma_regs->ch[m_ch].debug.fifo_err = 1;
-	dma_regs->ch[m_ch].debug.read_last_not_set_err = 1;
-	dma_regs->ch[m_ch].cbAddr = (uint32_t) m_cb_physical;
-	dma_regs->ch[m_ch].cs.active = 1;
-	//DMACtrl::debugPrintDMARegs();
-	sleep(1);
+	//Poll the channel instead of sleeping and hoping the transfer has finished
+	Start();
+	if (WaitForCompletion(1000) != 0)
+		DMACtrl::debugPrintDMARegs();
+
 	std::cout << "src: " << (char *)m_src_virtual << std::endl;
 	std::cout << "dest: " << (char *)m_dest_virtual << std::endl;
 }
+
+uint32_t DMACtrl::PhyToBus(volatile void *phy)
+{
+	return PhyToBus((uint32_t)(uintptr_t)phy);
+}
+
+uint32_t DMACtrl::PhyToBus(uint32_t phy)
+{
+	//The DMA engine addresses SDRAM through the uncached bus alias
+	return (phy & ~SDRAM_BUS_BASE) | SDRAM_BUS_BASE;
+}
+
+int32_t DMACtrl::SetupPeripheralTx(uint32_t len, uint32_t dest_bus_addr, uint32_t peripheral)
+{
+	//Copy len bytes of the source buffer to a peripheral register (e.g. a FIFO),
+	//each write is paced by the DREQ of the peripheral.
+	if ((len & 0x3) != 0)
+	{
+		RPI_PRINT_EX(InfoLevelError, "DMA length %u is not word aligned", len);
+		return -1;
+	}
+
+	if (!IsValid())
+		return -1;
+
+	return m_src->ChainAsSource(len, dest_bus_addr, 0, peripheral);
+}
+
+void DMACtrl::Start()
+{
+	DMACtrlStaus_t cs;
+
+	//Never touch a channel this instance didn't claim
+	if (!IsValid())
+		return;
+
+	//Reset the channel, clear errors and the END flag, then load the first CB
+	dma_regs->enable |= 0x1 << m_ch;
+	cs.word = 0;
+	cs.reset = 1;
+	dma_regs->ch[m_ch].cs.word = cs.word;
+
+	dma_regs->ch[m_ch].debug.word = 0x7;
+	cs.word = 0;
+	cs.end = 1;
+	cs.int_status = 1;
+	dma_regs->ch[m_ch].cs.word = cs.word;
+	dma_regs->ch[m_ch].cbAddr = PhyToBus(m_cb_physical);
+
+	cs.word = 0;
+	cs.priority = DMA_PRIORITY;
+	cs.panic_priority = DMA_PANIC_PRIORITY;
+	cs.wait_for_outstanding_wt = 1;
+	cs.active = 1;
+	dma_regs->ch[m_ch].cs.word = cs.word;
+}
+
+void DMACtrl::Stop()
+{
+	DMACtrlStaus_t cs;
+
+	if (!IsValid())
+		return;
+
+	//Abort the current CB and reset the channel
+	cs.word = 0;
+	cs.abort = 1;
+	dma_regs->ch[m_ch].cs.word = cs.word;
+	cs.word = 0;
+	cs.reset = 1;
+	dma_regs->ch[m_ch].cs.word = cs.word;
+}
+
+int32_t DMACtrl::IsBusy()
+{
+	if (!IsValid())
+		return 0;
+
+	return dma_regs->ch[m_ch].cs.active;
+}
+
+int32_t DMACtrl::WaitForCompletion(uint32_t timeout_us)
+{
+	if (!IsValid())
+		return -1;
+
+	//Poll the ACTIVE flag, it drops once the last CB is done, instead of guessing how long the transfer takes
+	uint64_t start = RpiGetTimeUs();
+
+	while (IsBusy())
+	{
+		if (RpiGetTimeUs() - start >= timeout_us)
+		{
+			RPI_PRINT_EX(InfoLevelWarning, "DMA channel %d timeout after %u us", m_ch, timeout_us);
+			return -1;
+		}
+		sched_yield();
+	}
+
+	if (dma_regs->ch[m_ch].cs.error)
+	{
+		RPI_PRINT_EX(InfoLevelError, "DMA channel %d error, debug 0x%08x", m_ch, dma_regs->ch[m_ch].debug.word);
+		return -2;
+	}
+
+	return 0;
+}
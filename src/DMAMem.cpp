@@ -0,0 +1,876 @@
+/*
+ * DMAMem.cpp
+ *
+ *  Created on: Jan 9, 2021
+ *      Author: Albert Guan
+ */
+
+#include <iostream>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <assert.h>
+#include "DMAMem.h"
+
+std::multimap<uint32_t, DMABuffer *> DMAMemPool::FreeBuffers;
+uint32_t DMAMemPool::CachedPages = 0;
+std::mutex DMAMemPool::PoolLock;
+std::map<uintptr_t, std::vector<uint32_t>> PageMap::Cache;
+std::mutex PageMap::CacheLock;
+int32_t PageMap::PagemapFd = -1;
+
+int32_t
+PageMap::Open (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine opens /proc/self/pagemap once, the caller holds CacheLock.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	if (PagemapFd < 0) {
+		PagemapFd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+		if (PagemapFd < 0) {
+			RPI_PRINT(InfoLevelError, "Failed to open /proc/self/pagemap");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+void
+PageMap::Close (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine closes the pagemap and drops all cached translations.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(CacheLock);
+	if (PagemapFd >= 0) {
+		close(PagemapFd);
+		PagemapFd = -1;
+	}
+
+	Cache.clear();
+	return;
+}
+
+int32_t
+PageMap::ReadEntries (
+	_In_ uintptr_t FirstPage,
+	_In_ uint32_t Pages,
+	_Out_ std::vector<uint32_t> &PhyAddrs
+	)
+
+/*
+ Routine Description:
+
+	This routine reads the pagemap entries of consecutive pages with a single
+	pread, the caller holds CacheLock.
+
+ Parameters:
+
+ 	FirstPage - Supplies the virtual page number of the first page.
+
+ 	Pages - Supplies the number of pages.
+
+ 	PhyAddrs - Supplies the physical address of each page.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	std::vector<uint64_t> Entries(Pages);
+	ssize_t Expected = Pages * sizeof(uint64_t);
+	uint32_t PageSize = getpagesize();
+
+	if (Open() != 0) {
+		return -1;
+	}
+
+	if (pread(PagemapFd, Entries.data(), Expected, FirstPage * sizeof(uint64_t)) != Expected) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to read pagemap of %u pages", Pages);
+		return -2;
+	}
+
+	PhyAddrs.resize(Pages);
+	for (uint32_t i = 0; i < Pages; ++i) {
+		uint64_t Pfn = Entries[i] & PAGEMAP_PFN_MASK;
+		if (((Entries[i] & PAGEMAP_PRESENT) == 0) || (0 == Pfn)) {
+			RPI_PRINT(InfoLevelError, "Page is not present or PFN is hidden, try to run with sudo");
+			return -3;
+		}
+
+		PhyAddrs[i] = static_cast<uint32_t>(Pfn * PageSize);
+	}
+
+	return 0;
+}
+
+int32_t
+PageMap::Translate (
+	_In_ volatile void *Virt,
+	_In_ uint32_t Pages,
+	_Out_ std::vector<uint32_t> &PhyAddrs
+	)
+
+/*
+ Routine Description:
+
+	This routine translates a locked range of pages and caches the result, so
+	later lookups within the range don't touch the pagemap.
+
+ Parameters:
+
+ 	Virt - Supplies the virtual address of the first page.
+
+ 	Pages - Supplies the number of pages.
+
+ 	PhyAddrs - Supplies the physical address of each page.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	uint32_t PageSize = getpagesize();
+	uintptr_t First = reinterpret_cast<uintptr_t>(Virt) / PageSize;
+	std::lock_guard<std::mutex> Guard(CacheLock);
+
+	auto It = Cache.find(First * PageSize);
+	if ((It != Cache.end()) && (It->second.size() >= Pages)) {
+		PhyAddrs.assign(It->second.begin(), It->second.begin() + Pages);
+		return 0;
+	}
+
+	if (ReadEntries(First, Pages, PhyAddrs) != 0) {
+		return -1;
+	}
+
+	Cache[First * PageSize] = PhyAddrs;
+	return 0;
+}
+
+int32_t
+PageMap::Lookup (
+	_In_ volatile void *Virt,
+	_Out_ uint32_t *PhyAddr
+	)
+
+/*
+ Routine Description:
+
+	This routine translates one virtual address. Cached ranges are checked
+	first, otherwise the page is read from the pagemap and cached.
+
+ Parameters:
+
+ 	Virt - Supplies the virtual address.
+
+ 	PhyAddr - Supplies the physical address.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	uint32_t PageSize = getpagesize();
+	uintptr_t Addr = reinterpret_cast<uintptr_t>(Virt);
+	std::vector<uint32_t> PhyAddrs;
+	std::lock_guard<std::mutex> Guard(CacheLock);
+
+	auto It = Cache.upper_bound(Addr);
+	if (It != Cache.begin()) {
+		--It;
+		uintptr_t PageIdx = (Addr - It->first) / PageSize;
+		if (PageIdx < It->second.size()) {
+			*PhyAddr = It->second[PageIdx] + (Addr % PageSize);
+			return 0;
+		}
+	}
+
+	if (ReadEntries(Addr / PageSize, 1, PhyAddrs) != 0) {
+		return -1;
+	}
+
+	Cache[Addr - (Addr % PageSize)] = PhyAddrs;
+	*PhyAddr = PhyAddrs[0] + (Addr % PageSize);
+	return 0;
+}
+
+void
+PageMap::Forget (
+	_In_ volatile void *Virt
+	)
+
+/*
+ Routine Description:
+
+	This routine drops the cached range starting at Virt, it must be called
+	before the pages are unlocked.
+
+ Parameters:
+
+ 	Virt - Supplies the virtual address of the first page of the range.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(CacheLock);
+	Cache.erase(reinterpret_cast<uintptr_t>(Virt));
+	return;
+}
+
+DMABuffer::DMABuffer (
+	void
+	) : m_Virt(NULL),
+		m_Size(0),
+		m_Pages(0),
+		m_CBs(NULL),
+		m_CBPages(0)
+{
+}
+
+DMABuffer::~DMABuffer (
+	void
+	)
+{
+}
+
+volatile void *
+DMABuffer::GetVirtAddr (
+	void
+	)
+{
+	return m_Virt;
+}
+
+uint32_t
+DMABuffer::GetSize (
+	void
+	)
+{
+	return m_Size;
+}
+
+const std::vector<DMABuffer::DMASegment> &
+DMABuffer::GetSegments (
+	void
+	)
+{
+	return m_Segments;
+}
+
+uint32_t
+DMABuffer::GetBusAddr (
+	_In_ uint32_t Offset
+	)
+
+/*
+ Routine Description:
+
+	This routine translates an offset of the buffer to its bus address.
+
+ Parameters:
+
+ 	Offset - Supplies the offset from the start of the buffer.
+
+ Return Value:
+
+	uint32_t - Supplies the bus address, 0 if Offset is out of the buffer.
+
+*/
+
+{
+
+	for (auto &Seg : m_Segments) {
+		if (Offset >= Seg.Offset && Offset < Seg.Offset + Seg.Len) {
+			return Seg.BusAddr + (Offset - Seg.Offset);
+		}
+	}
+
+	return 0;
+}
+
+volatile DMACtrl::DMACtrlBlock_t *
+DMABuffer::GetCBs (
+	void
+	)
+{
+	return m_CBs;
+}
+
+uint32_t
+DMABuffer::GetNumCBs (
+	void
+	)
+{
+	return m_Segments.size();
+}
+
+uint32_t
+DMABuffer::GetCBBusAddr (
+	_In_ uint32_t Idx
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the bus address of a control block of this buffer.
+
+ Parameters:
+
+ 	Idx - Supplies the index of the CB.
+
+ Return Value:
+
+	uint32_t - Supplies the bus address of the CB.
+
+*/
+
+{
+
+	uint32_t Offset = Idx * sizeof(DMACtrl::DMACtrlBlock_t);
+	uint32_t PageSize = getpagesize();
+
+	assert(Offset / PageSize < m_CBPageBusAddr.size());
+	return m_CBPageBusAddr[Offset / PageSize] + (Offset % PageSize);
+}
+
+int32_t
+DMABuffer::ChainAsSource (
+	_In_ uint32_t Len,
+	_In_ uint32_t DestBusAddr,
+	_In_ int32_t DestInc,
+	_In_ uint32_t Peripheral
+	)
+
+/*
+ Routine Description:
+
+	This routine prepares the CB chain to copy the first Len bytes of this
+	buffer to DestBusAddr.
+
+ Parameters:
+
+ 	Len - Supplies the number of bytes to transfer.
+
+ 	DestBusAddr - Supplies the bus address of the destination.
+
+ 	DestInc - Supplies whether the destination address increments, it's 0 for
+ 		a peripheral FIFO.
+
+ 	Peripheral - Supplies the peripheral whose DREQ paces the writes.
+
+ Return Value:
+
+	int32_t - Number of CBs in the chain, negative value on failure.
+
+*/
+
+{
+
+	return Chain(Len, DestBusAddr, DestInc, Peripheral, 1);
+}
+
+int32_t
+DMABuffer::ChainAsDest (
+	_In_ uint32_t Len,
+	_In_ uint32_t SrcBusAddr,
+	_In_ int32_t SrcInc,
+	_In_ uint32_t Peripheral
+	)
+
+/*
+ Routine Description:
+
+	This routine prepares the CB chain to copy Len bytes from SrcBusAddr to
+	the start of this buffer.
+
+ Parameters:
+
+ 	Len - Supplies the number of bytes to transfer.
+
+ 	SrcBusAddr - Supplies the bus address of the source.
+
+ 	SrcInc - Supplies whether the source address increments, it's 0 for
+ 		a peripheral FIFO.
+
+ 	Peripheral - Supplies the peripheral whose DREQ paces the reads.
+
+ Return Value:
+
+	int32_t - Number of CBs in the chain, negative value on failure.
+
+*/
+
+{
+
+	return Chain(Len, SrcBusAddr, SrcInc, Peripheral, 0);
+}
+
+int32_t
+DMABuffer::Chain (
+	_In_ uint32_t Len,
+	_In_ uint32_t PeerBusAddr,
+	_In_ int32_t PeerInc,
+	_In_ uint32_t Peripheral,
+	_In_ int32_t IsSource
+	)
+
+/*
+ Routine Description:
+
+	This routine fills one CB per segment until Len bytes are covered, and
+	terminates the chain at the last one.
+
+ Parameters:
+
+ 	Len - Supplies the number of bytes to transfer.
+
+ 	PeerBusAddr - Supplies the bus address on the other side of the transfer.
+
+ 	PeerInc - Supplies whether the peer address increments.
+
+ 	Peripheral - Supplies the peripheral whose DREQ paces the transfer.
+
+ 	IsSource - Supplies whether this buffer is the source or destination.
+
+ Return Value:
+
+	int32_t - Number of CBs in the chain, negative value on failure.
+
+*/
+
+{
+
+	uint32_t Idx;
+	uint32_t Remaining;
+
+	if ((0 == Len) || (Len > m_Size)) {
+		RPI_PRINT_EX(InfoLevelError, "Invalid DMA length %u, buffer is %u bytes", Len, m_Size);
+		return -1;
+	}
+
+	Remaining = Len;
+	for (Idx = 0; (Idx < m_Segments.size()) && (Remaining > 0); ++Idx) {
+		const DMASegment &Seg = m_Segments[Idx];
+		uint32_t Chunk = (Remaining < Seg.Len) ? Remaining : Seg.Len;
+		uint32_t PeerAddr = PeerBusAddr + ((PeerInc != 0) ? Seg.Offset : 0);
+		volatile DMACtrl::DMACtrlBlock_t *CB = &m_CBs[Idx];
+
+		CB->transInfo.word = 0;
+		CB->transInfo.wait_resp = 1;
+		CB->transInfo.premap = Peripheral;
+		if (IsSource != 0) {
+			CB->transInfo.src_inc = 1;
+			CB->transInfo.dest_inc = (PeerInc != 0) ? 1 : 0;
+			CB->transInfo.dest_dreq = (Peripheral != DMACtrl::NO_USE) ? 1 : 0;
+			CB->srcAddr = Seg.BusAddr;
+			CB->destAddr = PeerAddr;
+
+		} else {
+			CB->transInfo.dest_inc = 1;
+			CB->transInfo.src_inc = (PeerInc != 0) ? 1 : 0;
+			CB->transInfo.src_dreq = (Peripheral != DMACtrl::NO_USE) ? 1 : 0;
+			CB->srcAddr = PeerAddr;
+			CB->destAddr = Seg.BusAddr;
+		}
+
+		CB->transLen.word = Chunk;
+		CB->stride.word = 0;
+		Remaining -= Chunk;
+		CB->nextCB = (Remaining > 0) ? GetCBBusAddr(Idx + 1) : DMACtrl::NO_NEXT_CB;
+	}
+
+	return Idx;
+}
+
+DMABuffer *
+DMAMemPool::Alloc (
+	_In_ uint32_t Size
+	)
+
+/*
+ Routine Description:
+
+	This routine allocates a locked DMA buffer with its physical segments and
+	a default CB chain (the whole buffer as the source, no destination yet).
+
+ Parameters:
+
+ 	Size - Supplies the size of the buffer in bytes.
+
+ Return Value:
+
+	DMABuffer * - Supplies the buffer, NULL on failure.
+
+*/
+
+{
+
+	DMABuffer *Buffer;
+	uint32_t PageSize = getpagesize();
+	uint32_t Pages = (Size + PageSize - 1) / PageSize;
+
+	if (0 == Pages) {
+		return NULL;
+	}
+
+	Buffer = NULL;
+	{
+		std::lock_guard<std::mutex> Guard(PoolLock);
+		auto It = FreeBuffers.find(Pages);
+		if (It != FreeBuffers.end()) {
+			Buffer = It->second;
+			FreeBuffers.erase(It);
+			CachedPages -= Pages;
+		}
+	}
+
+	if (Buffer == NULL) {
+		Buffer = new DMABuffer();
+		Buffer->m_Pages = Pages;
+		if (Populate(Buffer) != 0) {
+			Release(Buffer);
+			return NULL;
+		}
+
+	} else {
+		memset((void *)Buffer->m_Virt, 0, Pages * PageSize);
+	}
+
+	Buffer->m_Size = Size;
+	Buffer->ChainAsSource(Size, 0, 1);
+	return Buffer;
+}
+
+void
+DMAMemPool::Free (
+	_In_ DMABuffer *Buffer
+	)
+
+/*
+ Routine Description:
+
+	This routine returns a buffer to the pool. The pages stay locked and
+	resolved, so the next allocation of the same size is cheap, as long as
+	the cache stays within MAX_CACHED_PAGES. Beyond that the largest cached
+	buffers are released.
+
+ Parameters:
+
+ 	Buffer - Supplies the buffer to free.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if (Buffer == NULL) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> Guard(PoolLock);
+	FreeBuffers.insert(std::make_pair(Buffer->m_Pages, Buffer));
+	CachedPages += Buffer->m_Pages;
+	if (CachedPages > MAX_CACHED_PAGES) {
+		TrimLocked(MAX_CACHED_PAGES);
+	}
+
+	return;
+}
+
+void
+DMAMemPool::Trim (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine unlocks and unmaps all cached free buffers.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(PoolLock);
+	TrimLocked(0);
+	return;
+}
+
+void
+DMAMemPool::TrimLocked (
+	_In_ uint32_t MaxPages
+	)
+
+/*
+ Routine Description:
+
+	This routine releases cached free buffers, largest first, until at most
+	MaxPages pages are cached. The caller holds PoolLock.
+
+ Parameters:
+
+ 	MaxPages - Supplies the number of pages which may stay cached.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	while ((CachedPages > MaxPages) && !FreeBuffers.empty()) {
+		auto It = std::prev(FreeBuffers.end());
+		CachedPages -= It->first;
+		Release(It->second);
+		FreeBuffers.erase(It);
+	}
+
+	return;
+}
+
+volatile void *
+DMAMemPool::MapPages (
+	_In_ uint32_t Pages
+	)
+
+/*
+ Routine Description:
+
+	This routine maps pages, forces them into RAM and locks them there.
+
+ Parameters:
+
+ 	Pages - Supplies the number of pages.
+
+ Return Value:
+
+	volatile void * - Supplies the virtual address, NULL on failure.
+
+*/
+
+{
+
+	void *Virt;
+	uint32_t PageSize = getpagesize();
+
+	Virt = mmap(NULL,
+				Pages * PageSize,
+				PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS,
+				-1,
+				0);
+
+	if (MAP_FAILED == Virt) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to map %u pages", Pages);
+		return NULL;
+	}
+
+	if (mlock(Virt, Pages * PageSize) != 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to lock %u pages", Pages);
+		munmap(Virt, Pages * PageSize);
+		return NULL;
+	}
+
+	//
+	// Touch every page so it has a physical frame before being resolved.
+	//
+
+	memset(Virt, 0, Pages * PageSize);
+	return Virt;
+}
+
+void
+DMAMemPool::UnmapPages (
+	_In_ volatile void *Virt,
+	_In_ uint32_t Pages
+	)
+{
+	if (Virt != NULL) {
+		PageMap::Forget(Virt);
+		munlock((const void *)Virt, Pages * getpagesize());
+		munmap((void *)Virt, Pages * getpagesize());
+	}
+}
+
+int32_t
+DMAMemPool::ResolvePages (
+	_In_ volatile void *Virt,
+	_In_ uint32_t Pages,
+	_Out_ std::vector<uint32_t> &BusAddrs
+	)
+
+/*
+ Routine Description:
+
+	This routine resolves the bus address of every page.
+
+ Parameters:
+
+ 	Virt - Supplies the virtual address of the first page.
+
+ 	Pages - Supplies the number of pages.
+
+ 	BusAddrs - Supplies the bus address of each page.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	if (PageMap::Translate(Virt, Pages, BusAddrs) != 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to resolve %u pages", Pages);
+		return -1;
+	}
+
+	for (auto &Addr : BusAddrs) {
+		Addr = DMACtrl::PhyToBus(Addr);
+	}
+
+	return 0;
+}
+
+int32_t
+DMAMemPool::Populate (
+	_In_ DMABuffer *Buffer
+	)
+
+/*
+ Routine Description:
+
+	This routine maps the data and CB pages of a buffer, resolves them and
+	merges physically contiguous data pages into segments.
+
+ Parameters:
+
+ 	Buffer - Supplies the buffer to populate, m_Pages must be set.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	std::vector<uint32_t> BusAddrs;
+	uint32_t PageSize = getpagesize();
+	uint32_t CBsPerPage = PageSize / sizeof(DMACtrl::DMACtrlBlock_t);
+
+	Buffer->m_Virt = MapPages(Buffer->m_Pages);
+	if (Buffer->m_Virt == NULL) {
+		return -1;
+	}
+
+	if (ResolvePages(Buffer->m_Virt, Buffer->m_Pages, BusAddrs) != 0) {
+		return -2;
+	}
+
+	//
+	// Merge contiguous pages, a segment never exceeds MAX_SEGMENT_LEN.
+	//
+
+	Buffer->m_Segments.clear();
+	for (uint32_t i = 0; i < Buffer->m_Pages; ++i) {
+		if (!Buffer->m_Segments.empty()) {
+			DMABuffer::DMASegment &Last = Buffer->m_Segments.back();
+			if ((Last.BusAddr + Last.Len == BusAddrs[i]) &&
+				(Last.Len + PageSize <= MAX_SEGMENT_LEN)) {
+
+				Last.Len += PageSize;
+				continue;
+			}
+		}
+
+		Buffer->m_Segments.push_back({i * PageSize, BusAddrs[i], PageSize});
+	}
+
+	//
+	// One CB per segment, plus CB pages for the chain itself.
+	//
+
+	Buffer->m_CBPages = (Buffer->m_Segments.size() + CBsPerPage - 1) / CBsPerPage;
+	Buffer->m_CBs = (volatile DMACtrl::DMACtrlBlock_t *)MapPages(Buffer->m_CBPages);
+	if (Buffer->m_CBs == NULL) {
+		return -3;
+	}
+
+	if (ResolvePages(Buffer->m_CBs, Buffer->m_CBPages, Buffer->m_CBPageBusAddr) != 0) {
+		return -4;
+	}
+
+	return 0;
+}
+
+void
+DMAMemPool::Release (
+	_In_ DMABuffer *Buffer
+	)
+{
+	UnmapPages(Buffer->m_Virt, Buffer->m_Pages);
+	UnmapPages(Buffer->m_CBs, Buffer->m_CBPages);
+	delete Buffer;
+}
@@ -0,0 +1,554 @@
+/*
+ * DMAScheduler.cpp
+ *
+ *  Created on: Jan 16, 2021
+ *      Author: Albert Guan
+ */
+
+#include <iostream>
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+#include <assert.h>
+#include "DMAScheduler.h"
+
+DMAScheduler::DMAScheduler (
+	_In_ int32_t Channel,
+	_In_ uint32_t RingSize
+	) : m_Channel(Channel),
+		m_RingSize(RingSize),
+		m_Ring(NULL),
+		m_Slots(RingSize),
+		m_Head(0),
+		m_Tail(0),
+		m_Count(0),
+		m_NextTicket(1),
+		m_LastCompleted(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of DMAScheduler. It claims the channel,
+	allocates the CB ring and resets the channel.
+
+ Parameters:
+
+ 	Channel - Supplies the DMA channel to use.
+
+ 	RingSize - Supplies the number of CBs in the ring.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	assert(RingSize >= 2);
+	if (DMACtrl::GeneralInit(Channel) < 0) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to init DMA channel %d", Channel);
+		exit(1);
+	}
+
+	m_Ring = DMAMemPool::Alloc(RingSize * sizeof(DMACtrl::DMACtrlBlock_t));
+	if (m_Ring == NULL) {
+		RPI_PRINT_EX(InfoLevelError, "Failed to allocate %u CBs", RingSize);
+		exit(1);
+	}
+
+	DMACtrl::dma_regs->enable |= 0x1 << m_Channel;
+	ResetChannel();
+	return;
+}
+
+DMAScheduler::~DMAScheduler (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of DMAScheduler. It aborts in-flight
+	transfers and releases the channel.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::vector<DMACompletion> Done;
+
+	Poll();
+	{
+		std::lock_guard<std::recursive_mutex> Guard(m_Lock);
+		ResetChannel();
+		Complete(DMA_TRANSFER_ABORTED, Done);
+	}
+
+	for (auto &Entry : Done) {
+		if (Entry.Callback) {
+			Entry.Callback(Entry.Ticket, Entry.Status);
+		}
+	}
+
+	DMAMemPool::Free(m_Ring);
+	m_Ring = NULL;
+	DMACtrl::GeneralUninit(m_Channel);
+	return;
+}
+
+volatile DMACtrl::DMAChannel_t *
+DMAScheduler::GetChannelRegs (
+	void
+	)
+{
+	return &DMACtrl::dma_regs->ch[m_Channel];
+}
+
+volatile DMACtrl::DMACtrlBlock_t *
+DMAScheduler::GetCB (
+	_In_ uint32_t Idx
+	)
+{
+	return static_cast<volatile DMACtrl::DMACtrlBlock_t *>(m_Ring->GetVirtAddr()) + Idx;
+}
+
+uint32_t
+DMAScheduler::GetCBBusAddr (
+	_In_ uint32_t Idx
+	)
+{
+	return m_Ring->GetBusAddr(Idx * sizeof(DMACtrl::DMACtrlBlock_t));
+}
+
+void
+DMAScheduler::SetActive (
+	_In_ int32_t Active
+	)
+
+/*
+ Routine Description:
+
+	This routine pauses/resumes the channel. END is write-1-to-clear, so CS is
+	written as a whole instead of through the bit fields.
+
+ Parameters:
+
+ 	Active - Supplies 1 to resume, 0 to pause.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	DMACtrl::DMACtrlStaus_t CS;
+
+	CS.word = 0;
+	CS.priority = DMACtrl::DMA_PRIORITY;
+	CS.panic_priority = DMACtrl::DMA_PANIC_PRIORITY;
+	CS.wait_for_outstanding_wt = 1;
+	CS.active = (Active != 0) ? 1 : 0;
+	GetChannelRegs()->cs.word = CS.word;
+	return;
+}
+
+void
+DMAScheduler::ResetChannel (
+	void
+	)
+{
+	DMACtrl::DMACtrlStaus_t CS;
+
+	CS.word = 0;
+	CS.abort = 1;
+	GetChannelRegs()->cs.word = CS.word;
+	CS.word = 0;
+	CS.reset = 1;
+	GetChannelRegs()->cs.word = CS.word;
+	GetChannelRegs()->debug.word = 0x7;
+	CS.word = 0;
+	CS.end = 1;
+	CS.int_status = 1;
+	GetChannelRegs()->cs.word = CS.word;
+}
+
+int64_t
+DMAScheduler::Queue (
+	_In_ const DMACtrl::DMACtrlBlock_t &CB,
+	_In_ DMACallback Callback
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a transfer behind the in-flight ones.
+
+ Parameters:
+
+ 	CB - Supplies the transfer, nextCB is ignored.
+
+ 	Callback - Supplies the routine called by Poll() once it's done.
+
+ Return Value:
+
+	int64_t - Supplies the ticket of the transfer, -1 if the ring is full.
+
+*/
+
+{
+
+	volatile DMACtrl::DMAChannel_t *Regs = GetChannelRegs();
+	volatile DMACtrl::DMACtrlBlock_t *Slot;
+	uint32_t Current;
+	uint32_t Idx;
+	uint32_t Prev;
+	int64_t Ticket;
+	std::lock_guard<std::recursive_mutex> Guard(m_Lock);
+
+	if (m_Count == m_RingSize) {
+		return -1;
+	}
+
+	Idx = m_Tail;
+	Slot = GetCB(Idx);
+	Slot->transInfo.word = CB.transInfo.word;
+	Slot->srcAddr = CB.srcAddr;
+	Slot->destAddr = CB.destAddr;
+	Slot->transLen.word = CB.transLen.word;
+	Slot->stride.word = CB.stride.word;
+	Slot->nextCB = DMACtrl::NO_NEXT_CB;
+
+	Ticket = m_NextTicket++;
+	m_Slots[Idx].Ticket = Ticket;
+	m_Slots[Idx].Callback = Callback;
+
+	//
+	// Pause the channel so it can't load a CB while the chain is patched.
+	//
+
+	SetActive(0);
+	Current = Regs->cbAddr;
+	if ((0 == m_Count) || (0 == Current)) {
+
+		//
+		// The channel is idle, everything before is done, start from here.
+		//
+
+		Regs->cbAddr = GetCBBusAddr(Idx);
+
+	} else {
+		Prev = (Idx + m_RingSize - 1) % m_RingSize;
+		GetCB(Prev)->nextCB = GetCBBusAddr(Idx);
+		if (Current == GetCBBusAddr(Prev)) {
+			Regs->nextCB = GetCBBusAddr(Idx);
+		}
+	}
+
+	SetActive(1);
+	m_Tail = (Idx + 1) % m_RingSize;
+	m_Count += 1;
+	return Ticket;
+}
+
+int64_t
+DMAScheduler::QueueCopy (
+	_In_ uint32_t SrcBusAddr,
+	_In_ uint32_t DestBusAddr,
+	_In_ uint32_t Len,
+	_In_ DMACallback Callback
+	)
+
+/*
+ Routine Description:
+
+	This routine queues a memory to memory copy.
+
+ Parameters:
+
+ 	SrcBusAddr - Supplies the bus address of the source.
+
+ 	DestBusAddr - Supplies the bus address of the destination.
+
+ 	Len - Supplies the number of bytes to copy.
+
+ 	Callback - Supplies the routine called by Poll() once it's done.
+
+ Return Value:
+
+	int64_t - Supplies the ticket of the transfer, -1 if the ring is full.
+
+*/
+
+{
+
+	DMACtrl::DMACtrlBlock_t CB;
+
+	memset(&CB, 0, sizeof(CB));
+	CB.transInfo.src_inc = 1;
+	CB.transInfo.dest_inc = 1;
+	CB.transInfo.wait_resp = 1;
+	CB.srcAddr = SrcBusAddr;
+	CB.destAddr = DestBusAddr;
+	CB.transLen.word = Len;
+	return Queue(CB, Callback);
+}
+
+void
+DMAScheduler::Complete (
+	_In_ DMATransferStatus Status,
+	_Out_ std::vector<DMACompletion> &Done
+	)
+
+/*
+ Routine Description:
+
+	This routine retires all in-flight slots with Status, the caller holds
+	m_Lock.
+
+ Parameters:
+
+ 	Status - Supplies the status to report.
+
+ 	Done - Supplies the retired slots.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	while (m_Count > 0) {
+		Done.push_back({m_Slots[m_Head].Ticket, m_Slots[m_Head].Callback, Status});
+		m_LastCompleted = m_Slots[m_Head].Ticket;
+		m_Slots[m_Head].Status = Status;
+		m_Slots[m_Head].Callback = nullptr;
+		m_Head = (m_Head + 1) % m_RingSize;
+		m_Count -= 1;
+	}
+}
+
+uint32_t
+DMAScheduler::Poll (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine retires finished transfers and calls their callbacks. Every
+	slot before the CB the engine is executing is done.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint32_t - Supplies the number of retired transfers.
+
+*/
+
+{
+
+	volatile DMACtrl::DMAChannel_t *Regs = GetChannelRegs();
+	std::vector<DMACompletion> Done;
+	DMACtrl::DMACtrlStaus_t CS;
+	uint32_t Current;
+
+	{
+		std::lock_guard<std::recursive_mutex> Guard(m_Lock);
+		CS.word = Regs->cs.word;
+		Current = Regs->cbAddr;
+
+		while (m_Count > 0) {
+			if ((Current != 0) && (Current == GetCBBusAddr(m_Head))) {
+				break;
+			}
+
+			Done.push_back({m_Slots[m_Head].Ticket, m_Slots[m_Head].Callback, DMA_TRANSFER_DONE});
+			m_LastCompleted = m_Slots[m_Head].Ticket;
+			m_Slots[m_Head].Status = DMA_TRANSFER_DONE;
+			m_Slots[m_Head].Callback = nullptr;
+			m_Head = (m_Head + 1) % m_RingSize;
+			m_Count -= 1;
+		}
+
+		//
+		// An error stops the channel, fail the rest and start over.
+		//
+
+		if (CS.error) {
+			RPI_PRINT_EX(InfoLevelError,
+						 "DMA channel %d error, debug 0x%08x",
+						 m_Channel,
+						 Regs->debug.word);
+
+			ResetChannel();
+			Complete(DMA_TRANSFER_ERROR, Done);
+
+		} else if ((0 == m_Count) && CS.end) {
+			CS.word = 0;
+			CS.end = 1;
+			Regs->cs.word = CS.word;
+		}
+	}
+
+	for (auto &Entry : Done) {
+		if (Entry.Callback) {
+			Entry.Callback(Entry.Ticket, Entry.Status);
+		}
+	}
+
+	return Done.size();
+}
+
+int32_t
+DMAScheduler::Wait (
+	_In_ int64_t Ticket,
+	_In_ uint32_t TimeoutUs
+	)
+
+/*
+ Routine Description:
+
+	This routine polls until a transfer is retired. The status of a transfer
+	is kept in its slot until the slot is reused RingSize transfers later,
+	an older ticket is reported as done.
+
+ Parameters:
+
+ 	Ticket - Supplies the ticket returned by Queue().
+
+ 	TimeoutUs - Supplies the timeout in microseconds.
+
+ Return Value:
+
+	int32_t - DMA_TRANSFER_* status of the transfer once it's retired, -1 on
+		timeout.
+
+*/
+
+{
+
+	uint64_t StartUs = RpiGetTimeUs();
+
+	while (1) {
+		Poll();
+		{
+			std::lock_guard<std::recursive_mutex> Guard(m_Lock);
+			if (m_LastCompleted >= Ticket) {
+				for (auto &Slot : m_Slots) {
+					if (Slot.Ticket == Ticket) {
+						return Slot.Status;
+					}
+				}
+
+				return DMA_TRANSFER_DONE;
+			}
+		}
+
+		if (RpiGetTimeUs() - StartUs >= TimeoutUs) {
+			return -1;
+		}
+
+		sched_yield();
+	}
+
+	return 0;
+}
+
+int32_t
+DMAScheduler::IsIdle (
+	void
+	)
+{
+	Poll();
+	std::lock_guard<std::recursive_mutex> Guard(m_Lock);
+	return (0 == m_Count) ? 1 : 0;
+}
+
+uint32_t
+DMAScheduler::GetFreeSlots (
+	void
+	)
+{
+	std::lock_guard<std::recursive_mutex> Guard(m_Lock);
+	return m_RingSize - m_Count;
+}
+
+void
+DMASchedulerDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine which queues back to back copies.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	const uint32_t Size = 64 * 1024;
+	DMAScheduler Scheduler(5);
+	DMABuffer *Src = DMAMemPool::Alloc(Size);
+	DMABuffer *Dest = DMAMemPool::Alloc(Size);
+	int32_t Status;
+	int64_t Ticket = -1;
+
+	for (uint32_t i = 0; i < Size; ++i) {
+		static_cast<volatile uint8_t *>(Src->GetVirtAddr())[i] = i & 0xFF;
+	}
+
+	//
+	// One CB can't cross a physical page boundary of either buffer.
+	//
+
+	for (uint32_t Offset = 0; Offset < Size; Offset += getpagesize()) {
+		Ticket = Scheduler.QueueCopy(Src->GetBusAddr(Offset),
+									 Dest->GetBusAddr(Offset),
+									 getpagesize(),
+									 [](int64_t Done, DMAScheduler::DMATransferStatus Status) {
+										 printf("Transfer %lld finished with %d\n", (long long)Done, Status);
+									 });
+	}
+
+	Status = Scheduler.Wait(Ticket, 100000);
+	if (Status < 0) {
+		printf("Transfers timeout\n");
+
+	} else if (Status != DMAScheduler::DMA_TRANSFER_DONE) {
+		printf("Transfers failed with %d\n", Status);
+	}
+
+	printf("Copy %s\n",
+		   memcmp((const void *)Src->GetVirtAddr(),
+				  (const void *)Dest->GetVirtAddr(),
+				  Size) ? "mismatch" : "matches");
+
+	DMAMemPool::Free(Src);
+	DMAMemPool::Free(Dest);
+	return;
+}
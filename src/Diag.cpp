@@ -6,8 +6,10 @@
  */
 
 #include <Diag.h>
+#include <errno.h>
 #include <iostream>
 #include <cstdarg>
+#include <time.h>
 
 void
 RpiPrint (
@@ -35,3 +37,43 @@ RpiPrint (
 
 	return;
 }
+
+uint64_t
+RpiGetTimeNs (
+	void
+	)
+
+{
+
+	struct timespec Now;
+
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return static_cast<uint64_t>(Now.tv_sec) * 1000000000ull + Now.tv_nsec;
+}
+
+uint64_t
+RpiGetTimeUs (
+	void
+	)
+
+{
+
+	return RpiGetTimeNs() / 1000;
+}
+
+void
+RpiSleepUntilNs (
+	uint64_t DeadlineNs
+	)
+
+{
+
+	struct timespec Deadline;
+
+	Deadline.tv_sec = DeadlineNs / 1000000000ull;
+	Deadline.tv_nsec = DeadlineNs % 1000000000ull;
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, NULL)) {
+	}
+
+	return;
+}
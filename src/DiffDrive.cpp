@@ -0,0 +1,460 @@
+/*
+ * DiffDrive.cpp
+ *
+ *  Created on: Feb 20, 2021
+ *      Author: Albert Guan
+ */
+#include <math.h>
+#include <unistd.h>
+#include <assert.h>
+#include "DiffDrive.h"
+#include "Diag.h"
+
+DiffDrive::DiffDrive (
+	_In_ MotorCtrl &Motors,
+	_In_ uint32_t RateHz,
+	_In_ float MaxAccel
+	) : m_Motors(&Motors),
+		m_PeriodNs(1000000000 / RateHz),
+		m_MaxStep(MaxAccel / RateHz),
+		m_TargetLeft(0),
+		m_TargetRight(0),
+		m_RampLeft(0),
+		m_RampRight(0),
+		m_OutputLeft(0),
+		m_OutputRight(0),
+		m_Feedback(nullptr),
+		m_Kp(0),
+		m_Ki(0),
+		m_IntegralLeft(0),
+		m_IntegralRight(0),
+		m_StopLoop(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of DiffDrive, it stops both wheels and
+	starts the control thread.
+
+ Parameters:
+
+ 	Motors - Supplies the motor control of both wheels.
+
+ 	RateHz - Supplies the control rate.
+
+ 	MaxAccel - Supplies the max change of velocity per second.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	assert(RateHz > 0 && MaxAccel > 0);
+
+	m_Motors->Drive(0, 0);
+	m_Thread = std::thread(&DiffDrive::ControlLoop, this);
+	return;
+}
+
+DiffDrive::~DiffDrive (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of DiffDrive, it stops the control thread
+	and both wheels right away.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	m_StopLoop.store(1);
+	if (m_Thread.joinable()) {
+		m_Thread.join();
+	}
+
+	m_Motors->Drive(0, 0);
+	m_Motors = NULL;
+	return;
+}
+
+void
+DiffDrive::SetVelocity (
+	_In_ float Left,
+	_In_ float Right
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the target velocity of each wheel, the control loop
+	ramps to it.
+
+ Parameters:
+
+ 	Left - Supplies the velocity of the left wheel, -1.0 to 1.0.
+
+ 	Right - Supplies the velocity of the right wheel, -1.0 to 1.0.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_Lock);
+
+	m_TargetLeft = fmaxf(-1.0f, fminf(1.0f, Left));
+	m_TargetRight = fmaxf(-1.0f, fminf(1.0f, Right));
+	return;
+}
+
+void
+DiffDrive::SetTwist (
+	_In_ float Linear,
+	_In_ float Angular
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the target motion of the robot. Linear = 0 turns in
+	place, Angular = 0 goes straight, anything else is an arc.
+
+ Parameters:
+
+ 	Linear - Supplies the forward velocity.
+
+ 	Angular - Supplies the turn rate, the difference between the wheels.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	float Left = Linear - Angular;
+	float Right = Linear + Angular;
+	float Scale = fmaxf(fabsf(Left), fabsf(Right));
+
+	if (Scale > 1.0f) {
+		Left /= Scale;
+		Right /= Scale;
+	}
+
+	SetVelocity(Left, Right);
+	return;
+}
+
+void
+DiffDrive::Stop (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine ramps both wheels down to stop.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	SetVelocity(0, 0);
+	return;
+}
+
+void
+DiffDrive::SetFeedback (
+	_In_ DiffDriveFeedback Feedback,
+	_In_ float Kp,
+	_In_ float Ki
+	)
+
+/*
+ Routine Description:
+
+	This routine closes the loop with measured wheel velocities. nullptr
+	goes back to open loop.
+
+ Parameters:
+
+ 	Feedback - Supplies the routine reporting the measured velocities, it's
+ 		called from the control thread once per tick.
+
+ 	Kp - Supplies the proportional gain.
+
+ 	Ki - Supplies the integral gain, per second.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_Lock);
+
+	m_Feedback = Feedback;
+	m_Kp = Kp;
+	m_Ki = Ki;
+	m_IntegralLeft = 0;
+	m_IntegralRight = 0;
+	return;
+}
+
+void
+DiffDrive::GetOutput (
+	_Out_ float *Left,
+	_Out_ float *Right
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the signed duty cycles applied on the last tick.
+
+ Parameters:
+
+ 	Left - Supplies the output of the left wheel.
+
+ 	Right - Supplies the output of the right wheel.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	std::lock_guard<std::mutex> Guard(m_Lock);
+
+	*Left = m_OutputLeft;
+	*Right = m_OutputRight;
+	return;
+}
+
+float
+DiffDrive::Ramp (
+	_In_ float Current,
+	_In_ float Target
+	)
+
+/*
+ Routine Description:
+
+	This routine moves a command towards its target by one tick.
+
+ Parameters:
+
+ 	Current - Supplies the current command.
+
+ 	Target - Supplies the target.
+
+ Return Value:
+
+	float - Supplies the command of this tick.
+
+*/
+
+{
+
+	if (Target > Current + m_MaxStep) {
+		return Current + m_MaxStep;
+	}
+
+	if (Target < Current - m_MaxStep) {
+		return Current - m_MaxStep;
+	}
+
+	return Target;
+}
+
+float
+DiffDrive::Correct (
+	_In_ float Target,
+	_In_ float Measured,
+	_Inout_ float &Integral
+	)
+
+/*
+ Routine Description:
+
+	This routine runs one step of the PI controller of a wheel. The command
+	is the feed forward term, the integral is bounded to avoid wind up while
+	the output saturates.
+
+ Parameters:
+
+ 	Target - Supplies the ramped command.
+
+ 	Measured - Supplies the measured velocity.
+
+ 	Integral - Supplies the integral of the error.
+
+ Return Value:
+
+	float - Supplies the output, -1.0 to 1.0.
+
+*/
+
+{
+
+	float Error = Target - Measured;
+	float Output;
+
+	if (0 == Target) {
+		Integral = 0;
+		return 0;
+	}
+
+	Integral += Error * m_PeriodNs / 1e9f;
+	Integral = fmaxf(-1.0f, fminf(1.0f, Integral));
+	Output = Target + m_Kp * Error + m_Ki * Integral;
+	return fmaxf(-1.0f, fminf(1.0f, Output));
+}
+
+void
+DiffDrive::ControlLoop (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine is the control thread. Ticks are on absolute deadlines, so
+	the rate doesn't drift with the time spent on each tick. The motors are
+	only written when the output changes.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Deadline;
+	DiffDriveFeedback Feedback;
+	float TargetLeft;
+	float TargetRight;
+	float MeasuredLeft;
+	float MeasuredRight;
+	float Left;
+	float Right;
+	float LastLeft = 0;
+	float LastRight = 0;
+
+	Deadline = RpiGetTimeNs();
+	while (0 == m_StopLoop.load()) {
+		Deadline += m_PeriodNs;
+		RpiSleepUntilNs(Deadline);
+
+		{
+			std::lock_guard<std::mutex> Guard(m_Lock);
+			TargetLeft = m_TargetLeft;
+			TargetRight = m_TargetRight;
+			Feedback = m_Feedback;
+		}
+
+		m_RampLeft = Ramp(m_RampLeft, TargetLeft);
+		m_RampRight = Ramp(m_RampRight, TargetRight);
+		Left = m_RampLeft;
+		Right = m_RampRight;
+
+		//
+		// The feedback routine is called without the lock, it may block.
+		//
+
+		if (Feedback && (0 == Feedback(&MeasuredLeft, &MeasuredRight))) {
+			std::lock_guard<std::mutex> Guard(m_Lock);
+			Left = Correct(m_RampLeft, MeasuredLeft, m_IntegralLeft);
+			Right = Correct(m_RampRight, MeasuredRight, m_IntegralRight);
+		}
+
+		if ((Left != LastLeft) || (Right != LastRight)) {
+			m_Motors->Drive(Left, Right);
+			LastLeft = Left;
+			LastRight = Right;
+		}
+
+		{
+			std::lock_guard<std::mutex> Guard(m_Lock);
+			m_OutputLeft = Left;
+			m_OutputRight = Right;
+		}
+	}
+
+	return;
+}
+
+void
+DiffDriveDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine which drives straight, turns in place and
+	follows an arc.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	MotorCtrl Motors;
+	DiffDrive Drive(Motors);
+
+	while (1) {
+		Drive.SetTwist(0.6f, 0);
+		sleep(2);
+		Drive.SetTwist(0, 0.5f);
+		sleep(1);
+		Drive.SetTwist(0.5f, 0.2f);
+		sleep(3);
+		Drive.Stop();
+		sleep(1);
+	}
+
+	return;
+}
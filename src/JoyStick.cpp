@@ -0,0 +1,389 @@
+/*
+ * JoyStick.cpp
+ *
+ *  Created on: Apr 3, 2021
+ *      Author: Albert Guan
+ */
+
+#include <unistd.h>
+#include "Diag.h"
+#include "GpioConfigBatch.h"
+#include "JoyStick.h"
+
+const int32_t JoyStick::BUTTON_PINS[BUTTON_COUNT] = {
+	JOYSTICK_PIN_CENTER,
+	JOYSTICK_PIN_FRONT,
+	JOYSTICK_PIN_RIGHT,
+	JOYSTICK_PIN_LEFT,
+	JOYSTICK_PIN_REVERSE,
+};
+
+JoyStick::JoyStick (
+	_In_ JoyStickHandler Handler,
+	_In_ uint32_t PollHz,
+	_In_ uint32_t DebounceSamples
+	) : m_Handler(Handler),
+		m_Pressed(0),
+		m_LastChord(0),
+		m_Stop(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of JoyStick, it configures the button pins
+	as pulled up inputs in one batch.
+
+ Parameters:
+
+ 	Handler - Supplies the routine called for each event.
+
+ 	PollHz - Supplies the sampling rate of Start().
+
+ 	DebounceSamples - Supplies how many consecutive samples must agree before
+ 		a button changes state, 1 to 32.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	GpioConfigBatch Batch;
+
+	if (0 == DebounceSamples) {
+		DebounceSamples = 1;
+
+	} else if (DebounceSamples > 32) {
+		DebounceSamples = 32;
+	}
+
+	m_PeriodNs = 1000000000ull / ((0 != PollHz) ? PollHz : JOYSTICK_POLL_HZ);
+	m_HoldNs = JOYSTICK_HOLD_MS * 1000000ull;
+	m_RepeatNs = JOYSTICK_REPEAT_MS * 1000000ull;
+	m_HistoryMask = (32 == DebounceSamples) ? 0xFFFFFFFFu : ((1u << DebounceSamples) - 1);
+
+	for (uint32_t Button = 0; Button < BUTTON_COUNT; Button++) {
+		m_History[Button] = 0;
+		m_NextRepeatNs[Button] = 0;
+		m_Held[Button] = false;
+		m_Pins.push_back(new GpioIn(BUTTON_PINS[Button], GpioIn::NONE, &Batch, PULL_UP));
+	}
+
+	Batch.Apply();
+	return;
+}
+
+JoyStick::~JoyStick (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of JoyStick.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	Stop();
+	for (auto Pin : m_Pins) {
+		delete Pin;
+	}
+
+	m_Pins.clear();
+	return;
+}
+
+int32_t
+JoyStick::Start (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine starts sampling the buttons on a thread of their own.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 if started, -1 if it already runs.
+
+*/
+
+{
+
+	if (m_Thread.joinable()) {
+		return -1;
+	}
+
+	m_Stop.store(0);
+	m_Thread = std::thread(&JoyStick::PollThread, this);
+	return 0;
+}
+
+void
+JoyStick::Stop (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine stops the sampling thread.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if (m_Thread.joinable()) {
+		m_Stop.store(1);
+		m_Thread.join();
+	}
+
+	return;
+}
+
+uint32_t
+JoyStick::GetPressed (
+	void
+)
+{
+	return m_Pressed.load();
+}
+
+void
+JoyStick::Emit (
+	_In_ uint64_t TimestampNs,
+	_In_ JOYSTICK_EVENT Type,
+	_In_ uint32_t Buttons
+	)
+{
+	JoyStickEvent Event;
+
+	Event.TimestampNs = TimestampNs;
+	Event.Type = Type;
+	Event.Buttons = Buttons;
+	if (m_Handler) {
+		m_Handler(Event);
+	}
+
+	return;
+}
+
+void
+JoyStick::Process (
+	_In_ uint64_t TimestampNs,
+	_In_ uint64_t Levels
+	)
+
+/*
+ Routine Description:
+
+	This routine shifts a new sample into the history of every button and
+	reports the state changes.
+
+ Parameters:
+
+ 	TimestampNs - Supplies when the levels were sampled.
+
+ 	Levels - Supplies the pin levels, bit n is GPIO n.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Bit;
+	uint32_t Down;
+	uint32_t History;
+	uint32_t Pressed = m_Pressed.load(std::memory_order_relaxed);
+
+	for (uint32_t Button = 0; Button < BUTTON_COUNT; Button++) {
+		Bit = 1u << Button;
+
+		//
+		// Pulled up, a pressed button reads low.
+		//
+
+		Down = ((Levels >> BUTTON_PINS[Button]) & 0x1) ^ 0x1;
+		History = ((m_History[Button] << 1) | Down) & m_HistoryMask;
+		m_History[Button] = History;
+
+		if ((0 == (Pressed & Bit)) && (m_HistoryMask == History)) {
+			Pressed |= Bit;
+			m_Held[Button] = false;
+			m_NextRepeatNs[Button] = TimestampNs + m_HoldNs;
+			Emit(TimestampNs, JOYSTICK_PRESS, Bit);
+
+		} else if ((0 != (Pressed & Bit)) && (0 == History)) {
+			Pressed &= ~Bit;
+			Emit(TimestampNs, JOYSTICK_RELEASE, Bit);
+
+		} else if ((0 != (Pressed & Bit)) && (TimestampNs >= m_NextRepeatNs[Button])) {
+			Emit(TimestampNs, m_Held[Button] ? JOYSTICK_REPEAT : JOYSTICK_HOLD, Bit);
+			m_Held[Button] = true;
+			m_NextRepeatNs[Button] = TimestampNs + m_RepeatNs;
+		}
+	}
+
+	m_Pressed.store(Pressed, std::memory_order_relaxed);
+
+	//
+	// Report a chord when two or more buttons are down and one joined since
+	// the last report, releasing some of them doesn't report it again.
+	//
+
+	m_LastChord &= Pressed;
+	if ((__builtin_popcount(Pressed) >= 2) && (0 != (Pressed & ~m_LastChord))) {
+		m_LastChord = Pressed;
+		Emit(TimestampNs, JOYSTICK_CHORD, Pressed);
+	}
+
+	return;
+}
+
+void
+JoyStick::PollThread (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine samples all buttons with one level read per period.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Deadline;
+
+	Deadline = RpiGetTimeNs();
+	while (0 == m_Stop.load()) {
+		Process(RpiGetTimeNs(), GpioIn::readLevels());
+
+		Deadline += m_PeriodNs;
+		RpiSleepUntilNs(Deadline);
+	}
+
+	return;
+}
+
+const char *
+JoyStick::GetButtonName (
+	_In_ uint32_t Button
+	)
+{
+	switch (Button) {
+		case BUTTON_CENTER:
+			return "Center";
+		case BUTTON_FRONT:
+			return "Front";
+		case BUTTON_RIGHT:
+			return "Right";
+		case BUTTON_LEFT:
+			return "Left";
+		case BUTTON_REVERSE:
+			return "Reverse";
+		default:
+			return "Unknown";
+	}
+}
+
+const char *
+JoyStick::GetEventName (
+	_In_ JOYSTICK_EVENT Type
+	)
+{
+	switch (Type) {
+		case JOYSTICK_PRESS:
+			return "pressed";
+		case JOYSTICK_RELEASE:
+			return "released";
+		case JOYSTICK_HOLD:
+			return "held";
+		case JOYSTICK_REPEAT:
+			return "repeat";
+		case JOYSTICK_CHORD:
+			return "chord";
+		default:
+			return "unknown";
+	}
+}
+
+void
+JoyStickDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine, it prints the joystick events.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	JoyStick Stick([](const JoyStickEvent &Event) {
+		if (JOYSTICK_CHORD == Event.Type) {
+			RPI_PRINT_EX(InfoLevelInfo, "Chord 0x%02x at %llu ms", Event.Buttons, Event.TimestampNs / 1000000);
+			return;
+		}
+
+		RPI_PRINT_EX(InfoLevelInfo,
+					 "%s %s at %llu ms",
+					 JoyStick::GetButtonName(__builtin_ctz(Event.Buttons)),
+					 JoyStick::GetEventName(Event.Type),
+					 Event.TimestampNs / 1000000);
+	});
+
+	Stick.Start();
+	while (1) {
+		sleep(1);
+	}
+
+	return;
+}
@@ -12,6 +12,8 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <bitset>
+#include <algorithm>
+#include <cmath>
 #include "MotorCtrl.h"
 
 
@@ -24,12 +26,18 @@ MotorCtrl::MotorCtrl()
 	m_pins.push_back(new GpioOut(GPIO_BIN2));
 	m_pins.push_back(new GpioOut(GPIO_PWMB));
 
-	GpioOut::Update(std::vector<uint32_t>{GPIO_PWMA, GPIO_PWMB}, std::vector<uint32_t>{GPIO_AIN1, GPIO_AIN2, GPIO_BIN1, GPIO_BIN2});
+	GpioOut::Write<PINS_PWM, PINS_IN>();
+
+	//The DMA driven PWM takes over PWMA/PWMB, full speed by default
+	m_pwm = new GpioDmaPwm(std::vector<uint32_t>{GPIO_PWMA, GPIO_PWMB});
+	SetSpeed(1.0f, 1.0f);
 }
 
 MotorCtrl::~MotorCtrl()
 {
 	Stop();
+	delete m_pwm;
+	m_pwm = NULL;
 	for (auto &pin : m_pins)
 		free(pin);
 }
@@ -39,7 +47,7 @@ void MotorCtrl::ShortBrake()
 	//Short Brake:
 	//IN1: High
 	//IN2: High
-	GpioOut::Update(std::vector<uint32_t> {GPIO_AIN1, GPIO_AIN2, GPIO_BIN1, GPIO_BIN2}, std::vector<uint32_t> {});
+	GpioOut::Write<PINS_IN>();
 }
 
 void MotorCtrl::CCW()
@@ -47,7 +55,7 @@ void MotorCtrl::CCW()
 	//CCW:
 	//IN1: Low
 	//IN2: High
-	GpioOut::Update(std::vector<uint32_t> {GPIO_AIN2, GPIO_BIN2}, std::vector<uint32_t> {GPIO_AIN1, GPIO_BIN1});
+	GpioOut::Write<PINS_IN2, PINS_IN1>();
 	printf("Counter clock-wise: AIN1 Low, AIN2 high, BIN1 Low, BIN2 high\n");
 }
 
@@ -56,7 +64,7 @@ void MotorCtrl::CW()
 	//CW:
 	//IN1: High
 	//IN2: Low
-	GpioOut::Update(std::vector<uint32_t> {GPIO_AIN1, GPIO_BIN1}, std::vector<uint32_t> {GPIO_AIN2, GPIO_BIN2});
+	GpioOut::Write<PINS_IN1, PINS_IN2>();
 	printf("Clock-wise: AIN1 high, AIN2 Low, BIN1 high, BIN2 Low\n");
 }
 
@@ -65,10 +73,47 @@ void MotorCtrl::Stop()
 	//Stop:
 	//IN1: Low
 	//IN2: Low
-	GpioOut::Update(std::vector<uint32_t> {}, std::vector<uint32_t> {GPIO_AIN1, GPIO_AIN2, GPIO_BIN1, GPIO_BIN2});
+	GpioOut::Write<PinSet<>, PINS_IN>();
 	printf("Stop Motor: AIN1 Low, AIN2 Low, BIN1 Low, BIN2 Low\n");
 }
 
+void MotorCtrl::SetSpeed(float SpeedA, float SpeedB)
+{
+	//Both duty cycles change at the same PWM period boundary
+	m_pwm->SetDutyCycles(std::vector<float>{SpeedA, SpeedB});
+}
+void MotorCtrl::AddDirection(float Speed, uint64_t In1, uint64_t In2,
+							 uint64_t &set_mask, uint64_t &clear_mask)
+{
+	//Forward on the AlphaBot2 wiring is the CCW setting: IN1 Low, IN2 High
+	if (Speed > 0)
+	{
+		clear_mask |= In1;
+		set_mask |= In2;
+	}
+	else if (Speed < 0)
+	{
+		set_mask |= In1;
+		clear_mask |= In2;
+	}
+	else
+	{
+		clear_mask |= In1 | In2;
+	}
+}
+
+void MotorCtrl::Drive(float SpeedA, float SpeedB)
+{
+	uint64_t set_mask = 0;
+	uint64_t clear_mask = 0;
+
+	SpeedA = std::max(-1.0f, std::min(1.0f, SpeedA));
+	SpeedB = std::max(-1.0f, std::min(1.0f, SpeedB));
+	AddDirection(SpeedA, MASK_AIN1, MASK_AIN2, set_mask, clear_mask);
+	AddDirection(SpeedB, MASK_BIN1, MASK_BIN2, set_mask, clear_mask);
+	GpioOut::Update(set_mask, clear_mask);
+	SetSpeed(std::fabs(SpeedA), std::fabs(SpeedB));
+}
 
 void MotorDemo()
 {
@@ -83,6 +128,12 @@ void MotorDemo()
 		motor.ShortBrake();
 		sleep(1);
 		motor.CCW();
-		sleep(5);
+		for (int i = 100; i >= 20; i -= 10)
+		{
+			motor.SetSpeed(i / 100.0f, i / 100.0f);
+			sleep(1);
+		}
+
+		motor.SetSpeed(1.0f, 1.0f);
 	}
 }
@@ -15,6 +15,7 @@
 #include <bitset>
 #include <assert.h>
 #include <exception>
+#include <string.h>
 #include "PCA9685Ctrl.h"
 
 const double PCA9685Ctrl::PCA9685_OSC_FREQ = 25000000.0f;
@@ -122,8 +123,12 @@ PCA9685Ctrl::GetLEDxOffHighAddr (
 PCA9685Ctrl::PCA9685Ctrl (
 	_In_ int32_t PinSda,
 	_In_ int32_t PinScl,
-	_In_ const int8_t I2CAddr
-	) : m_I2CSlaveAddr(I2CAddr)
+	_In_ const int8_t I2CAddr,
+	_In_ int32_t BurstMode
+	) : m_I2CSlaveAddr(I2CAddr),
+		m_OwnsI2CCtrl(1),
+		m_BurstMode(BurstMode),
+		m_AutoIncrement(0)
 
 /*
  Routine Description:
@@ -138,6 +143,9 @@ PCA9685Ctrl::PCA9685Ctrl (
 
  	I2CAddress - Supplies the I2C slave address of this module.
 
+ 	BurstMode - Supplies 1 to write all registers of a channel (or adjacent
+ 		channels) in one transaction with MODE1.AI.
+
  Return Value:
 
 	None.
@@ -147,6 +155,51 @@ PCA9685Ctrl::PCA9685Ctrl (
 {
 
 	m_I2CCtrl = new GpioI2C(PinSda, PinScl);
+
+	//
+	// Load the mirror, registers which can't be read are written the first
+	// time they are staged.
+	//
+
+	memset(m_Shadow, 0, sizeof(m_Shadow));
+	Sync();
+	return;
+}
+
+PCA9685Ctrl::PCA9685Ctrl (
+	_In_ GpioI2C &I2CCtrl,
+	_In_ const int8_t I2CAddr,
+	_In_ int32_t BurstMode
+	) : m_I2CSlaveAddr(I2CAddr),
+		m_I2CCtrl(&I2CCtrl),
+		m_OwnsI2CCtrl(0),
+		m_BurstMode(BurstMode),
+		m_AutoIncrement(0)
+
+/*
+ Routine Description:
+
+	This is the constructor of PCA9685Ctrl on a bus shared with other modules.
+
+ Parameters:
+
+ 	I2CCtrl - Supplies the I2C control instance of the bus.
+
+ 	I2CAddress - Supplies the I2C slave address of this module.
+
+ 	BurstMode - Supplies 1 to write all registers of a channel (or adjacent
+ 		channels) in one transaction with MODE1.AI.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	memset(m_Shadow, 0, sizeof(m_Shadow));
+	Sync();
 	return;
 }
 
@@ -158,7 +211,7 @@ PCA9685Ctrl::~PCA9685Ctrl (
  Routine Description:
 
 	This is the destructor of PCA9685Ctrl, it stops this module and free I2C control
-	instance.
+	instance if it isn't shared.
 
  Parameters:
 
@@ -173,11 +226,12 @@ PCA9685Ctrl::~PCA9685Ctrl (
 {
 
 	SetPWMDutyCycle(0.0);
-	if (m_I2CCtrl != NULL) {
+	if ((m_I2CCtrl != NULL) && m_OwnsI2CCtrl) {
 		delete m_I2CCtrl;
-		m_I2CCtrl = NULL;
 	}
 
+	m_I2CCtrl = NULL;
+
 	return;
 }
 
@@ -189,7 +243,8 @@ PCA9685Ctrl::GetMODE1Val (
 /*
  Routine Description:
 
-	This routine returns the current value of register MODE1.
+	This routine returns the current value of register MODE1. The module is
+	only read if the mirror doesn't know the value.
 
  Parameters:
 
@@ -205,8 +260,15 @@ PCA9685Ctrl::GetMODE1Val (
 
 	int8_t re = 0;
 	assert(m_I2CCtrl != NULL);
-	if (m_I2CCtrl != NULL) {
-		m_I2CCtrl->read(m_I2CSlaveAddr, REG_MODE1_ADDR, &re);
+	if (m_Valid[REG_MODE1_ADDR]) {
+		return static_cast<int8_t>(m_Shadow[REG_MODE1_ADDR]);
+	}
+
+	if ((m_I2CCtrl != NULL) &&
+		(1 == m_I2CCtrl->read(m_I2CSlaveAddr, REG_MODE1_ADDR, &re))) {
+
+		m_Shadow[REG_MODE1_ADDR] = static_cast<uint8_t>(re);
+		m_Valid[REG_MODE1_ADDR] = 1;
 	}
 
 	return re;
@@ -228,21 +290,25 @@ PCA9685Ctrl::SetMODE1Val (
 
  Return Value:
 
-	int8_t - Supplies the number of bytes written to MODE1.
+	int32_t - Supplies the number of writes sent to the module, -1 on failure.
 
 */
 
 {
 
-	int8_t re = 0;
+	MODE1Reg val;
+	val.word = Val;
 
-	assert(m_I2CCtrl != NULL);
-	if (m_I2CCtrl != NULL) {
-		re = m_I2CCtrl->write(m_I2CSlaveAddr,
-							  {REG_MODE1_ADDR, static_cast<int8_t>(Val)});
+	//
+	// Keep AI once enabled, Flush() relies on it.
+	//
+
+	if (m_AutoIncrement) {
+		val.AI = 1;
 	}
 
-	return re;
+	StageRegister(REG_MODE1_ADDR, val.word);
+	return Flush();
 }
 
 int32_t
@@ -261,7 +327,7 @@ PCA9685Ctrl::Sleep (
 
  Return Value:
 
-	int8_t - Supplies the number of bytes written to the module.
+	int32_t - Supplies the number of writes sent to the module, -1 on failure.
 
 */
 
@@ -289,7 +355,7 @@ PCA9685Ctrl::Wakeup (
 
  Return Value:
 
-	int8_t - Supplies the number of bytes written to the module.
+	int32_t - Supplies the number of writes sent to the module, -1 on failure.
 
 */
 
@@ -309,7 +375,8 @@ PCA9685Ctrl::Restart (
 /*
  Routine Description:
 
-	This routine resets the module.
+	This routine resets the module. RESTART is cleared by writing 1, so the
+	mirror keeps it 0 and the write is always sent.
 
  Parameters:
 
@@ -317,7 +384,7 @@ PCA9685Ctrl::Restart (
 
  Return Value:
 
-	int32_t - Supplies the number of bytes written to the module.
+	int32_t - Supplies the number of writes sent to the module, -1 on failure.
 
 */
 
@@ -326,6 +393,7 @@ PCA9685Ctrl::Restart (
 	MODE1Reg val;
 	val.word = GetMODE1Val();
 	val.RESTART = 1;
+	m_Valid[REG_MODE1_ADDR] = 0;
 	return SetMODE1Val(val.word);
 }
 
@@ -362,6 +430,16 @@ PCA9685Ctrl::UpdateFreq (
 	//
 
 	int8_t prescal = static_cast<int32_t>(PCA9685_OSC_FREQ / (4096 * Freq) + 0.5);
+	uint8_t prescale_reg = static_cast<uint8_t>(REG_PRE_SCALE_ADDR);
+
+	//
+	// Nothing to do if the module already runs at this frequency, e.g. all
+	// servos sharing the module set the same one.
+	//
+
+	if (m_Valid[prescale_reg] && (m_Shadow[prescale_reg] == static_cast<uint8_t>(prescal))) {
+		return 0;
+	}
 
 	//
 	// According to the foot note at page 13, "Writes to PRE_SCALE register are blocked when SLEEP bit is logic 0 (MODE1)"
@@ -369,9 +447,12 @@ PCA9685Ctrl::UpdateFreq (
 	// 2. Set the PRE_SCALE
 	// 3. Clear the sleep bit
 	//
+	// Each step is flushed on its own, the order matters.
+	//
 
 	Sleep();
-	m_I2CCtrl->write(m_I2CSlaveAddr, {REG_PRE_SCALE_ADDR, prescal});
+	StageRegister(prescale_reg, prescal);
+	Flush();
 	Wakeup();
 
 	//
@@ -389,29 +470,30 @@ PCA9685Ctrl::UpdateFreq (
 	return 0;
 }
 
-int32_t
-PCA9685Ctrl::SetPWMDutyCycle (
-	_In_ int32_t ChannelIdx,
+void
+PCA9685Ctrl::EncodeDutyCycle (
 	_In_ float DutyCycle,
-	_In_ int32_t RisingEdgeDelay
+	_In_ int32_t RisingEdgeDelay,
+	_Out_ int8_t *Regs
 	)
 
 /*
  Routine Description:
 
-	This routine sets the output PWM duty cycle to specific channel.
+	This routine converts a duty cycle to the values of LEDn_ON_L, LEDn_ON_H,
+	LEDn_OFF_L and LEDn_OFF_H, in register order.
 
  Parameters:
 
-	ChannelIdx - Supplies the channel to set the duty cycle.
-
 	DutyCycle - Supplies the duty cycle of the PWM output.
 
 	RisingEdgeDelay - Supplies the delay of the rising edge.
 
+	Regs - Supplies the buffer of BYTES_PER_CHANNEL bytes.
+
  Return Value:
 
-	int32_t - Not used.
+	None.
 
 */
 
@@ -419,27 +501,195 @@ PCA9685Ctrl::SetPWMDutyCycle (
 
 	assert(RisingEdgeDelay >= 0 && RisingEdgeDelay <= 4096);
 	assert(DutyCycle >= 0.0 && DutyCycle <= 100.0);
-	assert(ChannelIdx >= 0 && ChannelIdx <= 15);
 
 	uint16_t off = static_cast<uint16_t>(4096 * DutyCycle + RisingEdgeDelay) & 0xFFF;
-	int8_t on_low = static_cast<int8_t>(RisingEdgeDelay & 0xFF);
-	int8_t on_high = static_cast<int8_t>(RisingEdgeDelay >> 8);
-	int8_t off_low = static_cast<int8_t>(off & 0xFF);
-	int8_t off_high = static_cast<int8_t>(off >> 8);
+	Regs[0] = static_cast<int8_t>(RisingEdgeDelay & 0xFF);
+	Regs[1] = static_cast<int8_t>(RisingEdgeDelay >> 8);
+	Regs[2] = static_cast<int8_t>(off & 0xFF);
+	Regs[3] = static_cast<int8_t>(off >> 8);
+	return;
+}
+
+int32_t
+PCA9685Ctrl::EnableAutoIncrement (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine sets MODE1.AI, so the register pointer moves to the next
+	register after each byte of a write. It only talks to the module the
+	first time, later MODE1 updates keep AI since they start from the mirror.
+
+ Parameters:
+
+	None.
+
+ Return Value:
+
+	int32_t - 1 if auto-increment is enabled, 0 otherwise.
+
+*/
+
+{
+
+	MODE1Reg val;
+
+	if (m_AutoIncrement) {
+		return 1;
+	}
+
+	val.word = GetMODE1Val();
+	val.RESTART = 0;
+	val.AI = 1;
 
 	//
-	// Note: PCA9685's write format is <reg> <val>, don't put multiple sets in one packet
+	// Written directly, Flush() relies on AI for its bursts.
 	//
 
-	m_I2CCtrl->write(m_I2CSlaveAddr, {GetLEDxOnLowAddr(ChannelIdx), on_low});
-	m_I2CCtrl->write(m_I2CSlaveAddr, {GetLEDxOnHighAddr(ChannelIdx), on_high});
-	m_I2CCtrl->write(m_I2CSlaveAddr, {GetLEDxOffLowAddr(ChannelIdx), off_low});
-	m_I2CCtrl->write(m_I2CSlaveAddr, {GetLEDxOffHighAddr(ChannelIdx), off_high});
-	return 0;
+	if (2 == m_I2CCtrl->write(m_I2CSlaveAddr,
+							  {REG_MODE1_ADDR, static_cast<int8_t>(val.word)})) {
+
+		//
+		// A staged MODE1 update (e.g. RESTART) stays dirty.
+		//
+
+		val.word = m_Shadow[REG_MODE1_ADDR];
+		val.AI = 1;
+		m_Shadow[REG_MODE1_ADDR] = val.word;
+		m_Valid[REG_MODE1_ADDR] = 1;
+		m_AutoIncrement = 1;
+	}
+
+	return m_AutoIncrement;
 }
 
 int32_t
-PCA9685Ctrl::SetPWMDutyCycle (
+PCA9685Ctrl::IsCacheable (
+	_In_ uint8_t Reg
+	)
+
+/*
+ Routine Description:
+
+	This routine checks if a register can be mirrored. The ALL_LED registers
+	always read back 0 and writing them changes all LEDn registers, so they
+	are written through instead.
+
+ Parameters:
+
+	Reg - Supplies the address of the register.
+
+ Return Value:
+
+	int32_t - 1 if the register can be mirrored, 0 otherwise.
+
+*/
+
+{
+
+	return ((Reg <= static_cast<uint8_t>(REG_LED15_OFF_HIGH_ADDR)) ||
+			(Reg == static_cast<uint8_t>(REG_PRE_SCALE_ADDR))) ? 1 : 0;
+}
+
+int32_t
+PCA9685Ctrl::Sync (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine reloads the mirror from the module and drops staged values.
+	In burst mode MODE1 to LED15_OFF_H are read in one transaction, otherwise
+	only MODE1 is read and the other registers are written the first time
+	they are staged.
+
+ Parameters:
+
+	None.
+
+ Return Value:
+
+	int32_t - Supplies the number of registers read, -1 on failure.
+
+*/
+
+{
+
+	int8_t Regs[REG_LED15_OFF_HIGH_ADDR + 1];
+	int16_t Len;
+	MODE1Reg val;
+
+	m_Valid.reset();
+	m_Dirty.reset();
+	if (!m_BurstMode || !EnableAutoIncrement()) {
+		GetMODE1Val();
+		return m_Valid[REG_MODE1_ADDR] ? 1 : -1;
+	}
+
+	Len = m_I2CCtrl->read(m_I2CSlaveAddr, REG_MODE1_ADDR, Regs, sizeof(Regs));
+	if (Len != static_cast<int16_t>(sizeof(Regs))) {
+		return -1;
+	}
+
+	for (int32_t i = 0; i < Len; i++) {
+		m_Shadow[i] = static_cast<uint8_t>(Regs[i]);
+		m_Valid[i] = 1;
+	}
+
+	//
+	// RESTART reads back 1 when the PWM channels were stopped by SLEEP, keep
+	// it out of the mirror so it isn't written back by accident.
+	//
+
+	val.word = m_Shadow[REG_MODE1_ADDR];
+	val.RESTART = 0;
+	m_Shadow[REG_MODE1_ADDR] = val.word;
+	return Len;
+}
+
+int32_t
+PCA9685Ctrl::StageRegister (
+	_In_ uint8_t Reg,
+	_In_ uint8_t Val
+	)
+
+/*
+ Routine Description:
+
+	This routine updates a register in the mirror. It's marked dirty only if
+	the value changed, or if the current value isn't known.
+
+ Parameters:
+
+	Reg - Supplies the address of the register.
+
+	Val - Supplies the value.
+
+ Return Value:
+
+	int32_t - 1 if the register needs to be written, 0 otherwise.
+
+*/
+
+{
+
+	assert(IsCacheable(Reg));
+
+	if (m_Valid[Reg] && (m_Shadow[Reg] == Val)) {
+		return m_Dirty[Reg] ? 1 : 0;
+	}
+
+	m_Shadow[Reg] = Val;
+	m_Dirty[Reg] = 1;
+	return 1;
+}
+
+int32_t
+PCA9685Ctrl::StagePWMDutyCycle (
+	_In_ int32_t ChannelIdx,
 	_In_ float DutyCycle,
 	_In_ int32_t RisingEdgeDelay
 	)
@@ -447,38 +697,768 @@ PCA9685Ctrl::SetPWMDutyCycle (
 /*
  Routine Description:
 
-	This routine sets the output PWM duty cycle to all channels.
+	This routine updates the duty cycle of a channel in the mirror.
 
  Parameters:
 
+	ChannelIdx - Supplies the channel to set the duty cycle.
+
 	DutyCycle - Supplies the duty cycle of the PWM output.
 
 	RisingEdgeDelay - Supplies the delay of the rising edge.
 
  Return Value:
 
-	int32_t - Not used.
+	int32_t - Supplies the number of bytes which need to be written.
 
 */
 
 {
 
-	assert(RisingEdgeDelay >= 0 && RisingEdgeDelay <= 4096);
-	assert(DutyCycle >= 0.0 && DutyCycle <= 100.0);
+	int8_t regs[BYTES_PER_CHANNEL];
+	int32_t Changed = 0;
 
-	uint16_t off = static_cast<uint16_t>(4096 * DutyCycle + RisingEdgeDelay) & 0xFFF;
-	int8_t on_low = static_cast<int8_t>(RisingEdgeDelay & 0xFF);
-	int8_t on_high = static_cast<int8_t>(RisingEdgeDelay >> 8);
-	int8_t off_low = static_cast<int8_t>(off & 0xFF);
-	int8_t off_high = static_cast<int8_t>(off >> 8);
+	assert(ChannelIdx >= 0 && ChannelIdx < NUM_OF_CHANNELS);
+
+	EncodeDutyCycle(DutyCycle, RisingEdgeDelay, regs);
+	for (int32_t i = 0; i < BYTES_PER_CHANNEL; i++) {
+		Changed += StageRegister(GetLEDxOnLowAddr(ChannelIdx) + i,
+								 static_cast<uint8_t>(regs[i]));
+	}
+
+	return Changed;
+}
+
+void
+PCA9685Ctrl::UpdateMirror (
+	_In_ uint8_t FirstReg,
+	_In_ const int8_t *Vals,
+	_In_ uint32_t Len,
+	_In_ int32_t Written
+	)
+
+/*
+ Routine Description:
+
+	This routine records registers written without going through Flush(),
+	e.g. through the ALL_LED registers or a group address.
+
+ Parameters:
+
+	FirstReg - Supplies the first register.
+
+	Vals - Supplies the values of FirstReg, FirstReg + 1...
+
+	Len - Supplies the number of registers.
+
+	Written - Supplies 1 if the write succeeded, the registers are unknown
+		otherwise.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	for (uint32_t i = 0; i < Len; i++) {
+		assert(IsCacheable(FirstReg + i));
+		m_Shadow[FirstReg + i] = static_cast<uint8_t>(Vals[i]);
+		m_Valid[FirstReg + i] = Written ? 1 : 0;
+		m_Dirty[FirstReg + i] = 0;
+	}
+
+	return;
+}
+
+int32_t
+PCA9685Ctrl::WriteRun (
+	_In_ uint8_t First,
+	_In_ uint8_t Last
+	)
+
+/*
+ Routine Description:
+
+	This routine writes registers First to Last from the mirror in one
+	transaction and marks them clean.
+
+ Parameters:
+
+	First - Supplies the first register.
+
+	Last - Supplies the last register, First if AI isn't enabled.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 otherwise.
+
+*/
+
+{
+
+	MODE1Reg val;
+	std::vector<int8_t> Packet;
+
+	Packet.reserve(Last - First + 2);
+	Packet.push_back(static_cast<int8_t>(First));
+	for (uint32_t Reg = First; Reg <= Last; Reg++) {
+		Packet.push_back(static_cast<int8_t>(m_Shadow[Reg]));
+	}
+
+	if (m_I2CCtrl->write(m_I2CSlaveAddr, Packet) != static_cast<int16_t>(Packet.size())) {
+
+		//
+		// The module may have taken part of it, don't trust the mirror.
+		//
+
+		for (uint32_t Reg = First; Reg <= Last; Reg++) {
+			m_Valid[Reg] = 0;
+		}
+
+		return -1;
+	}
+
+	for (uint32_t Reg = First; Reg <= Last; Reg++) {
+		m_Valid[Reg] = 1;
+		m_Dirty[Reg] = 0;
+	}
 
 	//
-	// Note: PCA9685's write format is <reg> <val>, don't put multiple sets in one packet
+	// RESTART clears itself once written.
 	//
 
-	m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_ON_LOW_ADDR, on_low});
-	m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_ON_HIGH_ADDR, on_high});
-	m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_OFF_LOW_ADDR, off_low});
-	m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_OFF_HIGH_ADDR, off_high});
+	if (REG_MODE1_ADDR == First) {
+		val.word = m_Shadow[REG_MODE1_ADDR];
+		val.RESTART = 0;
+		m_Shadow[REG_MODE1_ADDR] = val.word;
+	}
+
 	return 0;
 }
+
+int32_t
+PCA9685Ctrl::Flush (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine writes the dirty registers to the module, in ascending
+	address order. With AI enabled, dirty registers separated by no more
+	than MAX_FLUSH_GAP clean (and known) registers are sent in one write.
+
+ Parameters:
+
+	None.
+
+ Return Value:
+
+	int32_t - Supplies the number of writes sent to the module, -1 if any
+		of them failed.
+
+*/
+
+{
+
+	int32_t Writes = 0;
+	int32_t Failed = 0;
+	int32_t Burst;
+	uint32_t Reg = 0;
+	uint32_t Last;
+	uint32_t Next;
+
+	if (m_Dirty.none()) {
+		return 0;
+	}
+
+	Burst = m_BurstMode && EnableAutoIncrement();
+	while (Reg < NUM_OF_REGS) {
+		if (!m_Dirty[Reg]) {
+			Reg += 1;
+			continue;
+		}
+
+		Last = Reg;
+		if (Burst) {
+			for (Next = Reg + 1;
+				 (Next < NUM_OF_REGS) && (Next - Last <= MAX_FLUSH_GAP + 1);
+				 Next++) {
+
+				if (m_Dirty[Next]) {
+					Last = Next;
+
+				} else if (!m_Valid[Next] || !IsCacheable(Next)) {
+					break;
+				}
+			}
+		}
+
+		if (0 != WriteRun(Reg, Last)) {
+			Failed = 1;
+		}
+
+		Writes += 1;
+		Reg = Last + 1;
+	}
+
+	return Failed ? -1 : Writes;
+}
+
+int32_t
+PCA9685Ctrl::SetPWMDutyCycle (
+	_In_ int32_t ChannelIdx,
+	_In_ float DutyCycle,
+	_In_ int32_t RisingEdgeDelay
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the output PWM duty cycle to specific channel.
+
+ Parameters:
+
+	ChannelIdx - Supplies the channel to set the duty cycle.
+
+	DutyCycle - Supplies the duty cycle of the PWM output.
+
+	RisingEdgeDelay - Supplies the delay of the rising edge.
+
+ Return Value:
+
+	int32_t - Not used.
+
+*/
+
+{
+
+	assert(ChannelIdx >= 0 && ChannelIdx <= 15);
+
+	StagePWMDutyCycle(ChannelIdx, DutyCycle, RisingEdgeDelay);
+	Flush();
+	return 0;
+}
+
+int32_t
+PCA9685Ctrl::SetPWMDutyCycle (
+	_In_ float DutyCycle,
+	_In_ int32_t RisingEdgeDelay
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the output PWM duty cycle to all channels. It's written
+	through the ALL_LED registers, the mirror of every channel is updated.
+
+ Parameters:
+
+	DutyCycle - Supplies the duty cycle of the PWM output.
+
+	RisingEdgeDelay - Supplies the delay of the rising edge.
+
+ Return Value:
+
+	int32_t - Not used.
+
+*/
+
+{
+
+	int8_t regs[BYTES_PER_CHANNEL];
+	int32_t Written = 0;
+	EncodeDutyCycle(DutyCycle, RisingEdgeDelay, regs);
+
+	//
+	// ALL_LED_ON_L..ALL_LED_OFF_H are adjacent as well.
+	//
+
+	if (m_BurstMode && EnableAutoIncrement()) {
+		Written = (5 == m_I2CCtrl->write(m_I2CSlaveAddr,
+										 {REG_LEDALL_ON_LOW_ADDR, regs[0], regs[1], regs[2], regs[3]}));
+
+	} else {
+
+		//
+		// Note: Without MODE1.AI, PCA9685's write format is <reg> <val>, don't put
+		// multiple sets in one packet
+		//
+
+		Written = (2 == m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_ON_LOW_ADDR, regs[0]}));
+		Written &= (2 == m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_ON_HIGH_ADDR, regs[1]}));
+		Written &= (2 == m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_OFF_LOW_ADDR, regs[2]}));
+		Written &= (2 == m_I2CCtrl->write(m_I2CSlaveAddr, {REG_LEDALL_OFF_HIGH_ADDR, regs[3]}));
+	}
+
+	for (int32_t i = 0; i < NUM_OF_CHANNELS; i++) {
+		UpdateMirror(GetLEDxOnLowAddr(i), regs, BYTES_PER_CHANNEL, Written);
+	}
+
+	return 0;
+}
+
+int32_t
+PCA9685Ctrl::SetPWMDutyCycles (
+	_In_ int32_t FirstChannelIdx,
+	_In_ const std::vector<float> &DutyCycles,
+	_In_ int32_t RisingEdgeDelay
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the duty cycles of adjacent channels. In burst mode the
+	changed registers of all of them are written in one transaction.
+
+ Parameters:
+
+	FirstChannelIdx - Supplies the first channel to set.
+
+	DutyCycles - Supplies the duty cycles of FirstChannelIdx, FirstChannelIdx + 1...
+
+	RisingEdgeDelay - Supplies the delay of the rising edge.
+
+ Return Value:
+
+	int32_t - Not used.
+
+*/
+
+{
+
+	int32_t Count = DutyCycles.size();
+
+	assert(FirstChannelIdx >= 0 && FirstChannelIdx + Count <= NUM_OF_CHANNELS);
+
+	for (int32_t i = 0; i < Count; i++) {
+		StagePWMDutyCycle(FirstChannelIdx + i, DutyCycles[i], RisingEdgeDelay);
+	}
+
+	Flush();
+	return 0;
+}
+
+int8_t
+PCA9685Ctrl::GetI2CAddr (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the I2C slave address of the module.
+
+ Parameters:
+
+	None.
+
+ Return Value:
+
+	int8_t - Supplies the 7 bits address.
+
+*/
+
+{
+
+	return m_I2CSlaveAddr;
+}
+
+int32_t
+PCA9685Ctrl::JoinGroup (
+	_In_ PCA9685GroupRegs Group,
+	_In_ int8_t GroupAddr
+	)
+
+/*
+ Routine Description:
+
+	This routine programs a group address and makes the module respond to it.
+	Both registers are written in one flush.
+
+ Parameters:
+
+	Group - Supplies the group register, SUBADR1-3 or ALLCALLADR.
+
+	GroupAddr - Supplies the 7 bits group address.
+
+ Return Value:
+
+	int32_t - Supplies the number of writes sent to the module, -1 on failure.
+
+*/
+
+{
+
+	MODE1Reg val;
+
+	assert(Group >= SUBADR1 && Group <= ALLCALLADR);
+
+	//
+	// Bit 0 of SUBADRx/ALLCALLADR is read only, the address is in bit 7:1.
+	//
+
+	StageRegister(REG_GROUP_ADDR[Group], static_cast<uint8_t>(GroupAddr << 1));
+
+	val.word = GetMODE1Val();
+	switch (Group) {
+	case SUBADR1:
+		val.SUB1 = 1;
+		break;
+
+	case SUBADR2:
+		val.SUB2 = 1;
+		break;
+
+	case SUBADR3:
+		val.SUB3 = 1;
+		break;
+
+	default:
+		val.ALLCALL = 1;
+		break;
+	}
+
+	return SetMODE1Val(val.word);
+}
+
+int32_t
+PCA9685Ctrl::LeaveGroup (
+	_In_ PCA9685GroupRegs Group
+	)
+
+/*
+ Routine Description:
+
+	This routine stops the module responding to a group address.
+
+ Parameters:
+
+	Group - Supplies the group register, SUBADR1-3 or ALLCALLADR.
+
+ Return Value:
+
+	int32_t - Supplies the number of writes sent to the module, -1 on failure.
+
+*/
+
+{
+
+	MODE1Reg val;
+
+	assert(Group >= SUBADR1 && Group <= ALLCALLADR);
+
+	val.word = GetMODE1Val();
+	switch (Group) {
+	case SUBADR1:
+		val.SUB1 = 0;
+		break;
+
+	case SUBADR2:
+		val.SUB2 = 0;
+		break;
+
+	case SUBADR3:
+		val.SUB3 = 0;
+		break;
+
+	default:
+		val.ALLCALL = 0;
+		break;
+	}
+
+	return SetMODE1Val(val.word);
+}
+
+PCA9685Group::PCA9685Group (
+	_In_ GpioI2C &I2CCtrl,
+	_In_ PCA9685Ctrl::PCA9685GroupRegs Group,
+	_In_ int8_t GroupAddr
+	) : m_I2CCtrl(&I2CCtrl),
+		m_Group(Group),
+		m_GroupAddr(GroupAddr)
+
+/*
+ Routine Description:
+
+	This is the constructor of PCA9685Group.
+
+ Parameters:
+
+	I2CCtrl - Supplies the I2C control instance of the bus.
+
+	Group - Supplies the group register the members use.
+
+	GroupAddr - Supplies the 7 bits group address.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	return;
+}
+
+PCA9685Group::~PCA9685Group (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is the destructor of PCA9685Group, the members leave the group.
+
+ Parameters:
+
+	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	for (auto Member : m_Members) {
+		Member->LeaveGroup(m_Group);
+	}
+
+	m_Members.clear();
+	return;
+}
+
+int32_t
+PCA9685Group::Add (
+	_In_ PCA9685Ctrl &Member
+	)
+
+/*
+ Routine Description:
+
+	This routine adds a module to the group, it's programmed to respond to
+	the group address.
+
+ Parameters:
+
+	Member - Supplies the module, it must be on the bus of the group.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 otherwise.
+
+*/
+
+{
+
+	assert(Member.m_I2CCtrl == m_I2CCtrl);
+
+	//
+	// Members must auto-increment the same way, a group write can't be
+	// split per member.
+	//
+
+	if (!Member.m_BurstMode || !Member.EnableAutoIncrement()) {
+		return -1;
+	}
+
+	if (Member.JoinGroup(m_Group, m_GroupAddr) < 0) {
+		return -1;
+	}
+
+	m_Members.push_back(&Member);
+	return 0;
+}
+
+int32_t
+PCA9685Group::Remove (
+	_In_ PCA9685Ctrl &Member
+	)
+
+/*
+ Routine Description:
+
+	This routine removes a module from the group.
+
+ Parameters:
+
+	Member - Supplies the module.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if it isn't a member.
+
+*/
+
+{
+
+	for (auto it = m_Members.begin(); it != m_Members.end(); it++) {
+		if (*it == &Member) {
+			m_Members.erase(it);
+			Member.LeaveGroup(m_Group);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int32_t
+PCA9685Group::Broadcast (
+	_In_ const std::vector<int8_t> &Packet,
+	_In_ uint8_t MirrorReg,
+	_In_ const std::vector<int8_t> &MirrorVals
+	)
+
+/*
+ Routine Description:
+
+	This routine writes a packet to the group address and records the
+	registers it changed in the mirror of every member.
+
+ Parameters:
+
+	Packet - Supplies the register address followed by the values.
+
+	MirrorReg - Supplies the first register changed.
+
+	MirrorVals - Supplies the values of the changed registers.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 otherwise.
+
+*/
+
+{
+
+	int32_t Written;
+
+	Written = (m_I2CCtrl->write(m_GroupAddr, Packet) == static_cast<int16_t>(Packet.size()));
+	for (auto Member : m_Members) {
+		Member->UpdateMirror(MirrorReg, MirrorVals.data(), MirrorVals.size(), Written);
+	}
+
+	return Written ? 0 : -1;
+}
+
+int32_t
+PCA9685Group::SetPWMDutyCycle (
+	_In_ int32_t ChannelIdx,
+	_In_ float DutyCycle,
+	_In_ int32_t RisingEdgeDelay
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the duty cycle of a channel of all members.
+
+ Parameters:
+
+	ChannelIdx - Supplies the channel to set the duty cycle.
+
+	DutyCycle - Supplies the duty cycle of the PWM output.
+
+	RisingEdgeDelay - Supplies the delay of the rising edge.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 otherwise.
+
+*/
+
+{
+
+	return SetPWMDutyCycles(ChannelIdx, {DutyCycle}, RisingEdgeDelay);
+}
+
+int32_t
+PCA9685Group::SetPWMDutyCycles (
+	_In_ int32_t FirstChannelIdx,
+	_In_ const std::vector<float> &DutyCycles,
+	_In_ int32_t RisingEdgeDelay
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the duty cycles of adjacent channels of all members in
+	one transaction.
+
+ Parameters:
+
+	FirstChannelIdx - Supplies the first channel to set.
+
+	DutyCycles - Supplies the duty cycles of FirstChannelIdx, FirstChannelIdx + 1...
+
+	RisingEdgeDelay - Supplies the delay of the rising edge.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 otherwise.
+
+*/
+
+{
+
+	int32_t Count = DutyCycles.size();
+	std::vector<int8_t> Vals(Count * PCA9685Ctrl::BYTES_PER_CHANNEL);
+	std::vector<int8_t> Packet;
+
+	assert(FirstChannelIdx >= 0 && FirstChannelIdx + Count <= PCA9685Ctrl::NUM_OF_CHANNELS);
+
+	for (int32_t i = 0; i < Count; i++) {
+		PCA9685Ctrl::EncodeDutyCycle(DutyCycles[i],
+									 RisingEdgeDelay,
+									 &Vals[i * PCA9685Ctrl::BYTES_PER_CHANNEL]);
+	}
+
+	Packet.push_back(PCA9685Ctrl::GetLEDxOnLowAddr(FirstChannelIdx));
+	Packet.insert(Packet.end(), Vals.begin(), Vals.end());
+	return Broadcast(Packet, PCA9685Ctrl::GetLEDxOnLowAddr(FirstChannelIdx), Vals);
+}
+
+int32_t
+PCA9685Group::SetPWMDutyCycle (
+	_In_ float DutyCycle,
+	_In_ int32_t RisingEdgeDelay
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the duty cycle of all channels of all members, through
+	the ALL_LED registers: 5 bytes on the bus for the whole group.
+
+ Parameters:
+
+	DutyCycle - Supplies the duty cycle of the PWM output.
+
+	RisingEdgeDelay - Supplies the delay of the rising edge.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 otherwise.
+
+*/
+
+{
+
+	int8_t regs[PCA9685Ctrl::BYTES_PER_CHANNEL];
+	std::vector<int8_t> Vals;
+
+	PCA9685Ctrl::EncodeDutyCycle(DutyCycle, RisingEdgeDelay, regs);
+	for (int32_t i = 0; i < PCA9685Ctrl::NUM_OF_CHANNELS; i++) {
+		Vals.insert(Vals.end(), regs, regs + PCA9685Ctrl::BYTES_PER_CHANNEL);
+	}
+
+	return Broadcast({PCA9685Ctrl::REG_LEDALL_ON_LOW_ADDR, regs[0], regs[1], regs[2], regs[3]},
+					 PCA9685Ctrl::REG_LED0_ON_LOW_ADDR,
+					 Vals);
+}
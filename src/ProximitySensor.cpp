@@ -22,6 +22,7 @@ void ProximitySensorTest()
 {
 	GpioIn left(16);
 	GpioIn right(19);
+	GpioIn::configurePulls({{left[0], PULL_UP}, {right[0], PULL_UP}});
 
 	std::vector<int32_t> rise_pins;
 	while (1)
@@ -5,6 +5,8 @@
  *      Author: Albert Guan
  */
 #include "WS2812BCtrl.h"
+#include "Diag.h"
+#include "DMA.h"
 
 #include <iostream>
 #include <iomanip>
@@ -15,21 +17,35 @@
 #include <fcntl.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <math.h>
 
 WS2812BCtrl::WS2812BCtrl (
-	_In_ float brightness
-	)
+	_In_ float brightness,
+	_In_ int32_t UseDMA,
+	_In_ uint32_t LedCount
+	) : m_DMA(NULL),
+		m_LedCount(LedCount),
+		m_Pixels(LedCount, LEDPixel{0, 0, 0}),
+		m_Frame(GetFrameWords(LedCount), 0)
 
 /*
  Routine Description:
 
 	This routine is the constructor of WS2812BCtrl. It inits the PWM control
-	module and sets LED brightness.
+	module and sets LED brightness. In streaming mode, it also inits the DMA
+	channel which feeds the PWM FIFO, its buffer takes a frame of the strip
+	and the latch words. If the channel is taken, it falls back to feeding
+	the FIFO without DMA.
 
  Parameters:
 
  	Brightness - Supplies the brightness of LEDs.
 
+ 	UseDMA - Supplies whether to feed the PWM FIFO through DMA.
+
+ 	LedCount - Supplies the number of LEDs of the strip.
+
  Return Value:
 
 	None.
@@ -44,6 +60,29 @@ WS2812BCtrl::WS2812BCtrl (
 						WS2812B_PWM_MODE,
 						WS2812B_PWM_FIFO);
 
+	//
+	// The PWM stays on in streaming mode, the output is silent (low) whenever
+	// the FIFO runs empty. Without the DMA channel, the frames are fed to the
+	// FIFO by the CPU.
+	//
+
+	if (UseDMA != 0) {
+		m_DMA = new DMACtrl(WS2812B_DMA_CHANNEL,
+							(m_Frame.size() + WS2812B_LATCH_WORDS) * sizeof(uint32_t));
+
+		if (!m_DMA->IsValid()) {
+			RPI_PRINT(InfoLevelWarning, "No DMA channel for the LEDs, feeding the PWM FIFO directly");
+			delete m_DMA;
+			m_DMA = NULL;
+		}
+	}
+
+	if (m_DMA != NULL) {
+		m_PWM->ClearFIFO();
+		m_PWM->SetDMA(ON);
+		m_PWM->PWMOnOff(ON);
+	}
+
 	//
 	// Init the brightness
 	//
@@ -73,6 +112,14 @@ WS2812BCtrl::~WS2812BCtrl (
 
 {
 
+	if (m_DMA != NULL) {
+		m_DMA->WaitForCompletion(WS2812B_STREAM_TIMEOUT_US);
+		m_DMA->Stop();
+		m_PWM->SetDMA(OFF);
+		delete m_DMA;
+		m_DMA = NULL;
+	}
+
 	if (m_PWM != NULL) {
 		delete m_PWM;
 	}
@@ -89,7 +136,10 @@ WS2812BCtrl::SetBrightness (
 /*
  Routine Description:
 
-	This routine updates the LED brightness.
+	This routine updates the LED brightness. It rebuilds the color table: the
+	channel value is scaled by the brightness in 1/256 steps, gamma corrected
+	so dimming looks linear, and its symbols are stored next to it. The frame
+	path only looks values up.
 
  Parameters:
 
@@ -102,15 +152,172 @@ WS2812BCtrl::SetBrightness (
 */
 
 {
+	uint32_t Scale;
+	uint32_t Level;
+
 	assert((Brightness < 1.0) && (Brightness > 0.0));
 
 	if ((Brightness <= 1.0) && (Brightness >= 0.0)) {
 		m_Brightness = Brightness;
+		Scale = static_cast<uint32_t>(Brightness * 256 + 0.5);
+		for (uint32_t Byte = 0; Byte < 256; ++Byte) {
+			Level = Byte * Scale;		//255 * 256 at full brightness
+			m_Lut[Byte] = static_cast<uint8_t>(255 * pow(Level / 65280.0, WS2812B_GAMMA) + 0.5);
+			m_Code[Byte] = GetSymbols(m_Lut[Byte]);
+		}
 	}
 
 	return;
 }
 
+uint32_t
+WS2812BCtrl::GetSymbols (
+	_In_ uint32_t Byte
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the symbols of a color byte, MSB first.
+
+ Parameters:
+
+ 	Byte - Supplies the color byte.
+
+ Return Value:
+
+	uint32_t - 24 bits of symbols, the first one in bits 23:21.
+
+*/
+
+{
+
+	uint32_t Code = 0;
+
+	for (int32_t Bit = BITS_PER_COLOR - 1; Bit >= 0; --Bit) {
+		Code <<= 3;
+		Code |= ((Byte >> Bit) & 0x1) ? WS2812B_SYMBOL_ONE : WS2812B_SYMBOL_ZERO;
+	}
+
+	return Code;
+}
+
+uint32_t
+WS2812BCtrl::GetLedCount (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the number of LEDs of the strip.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	uint32_t - Number of LEDs.
+
+*/
+
+{
+
+	return m_LedCount;
+}
+
+void
+WS2812BCtrl::SetPixel (
+	_In_ uint32_t Idx,
+	_In_ const LEDPixel &Color
+	)
+
+/*
+ Routine Description:
+
+	This routine sets the color of an LED, it's sent by the next Show().
+
+ Parameters:
+
+ 	Idx - Supplies the index of the LED.
+
+ 	Color - Supplies the color.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	if (Idx >= m_LedCount) {
+		RPI_PRINT_EX(InfoLevelError, "LED %u is out of the strip of %u", Idx, m_LedCount);
+		return;
+	}
+
+	m_Pixels[Idx] = Color;
+	return;
+}
+
+int32_t
+WS2812BCtrl::Show (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This routine encodes the pixels into the frame buffer and sends it. In
+	streaming mode the previous frame may still be going out while this one
+	is encoded.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	EncodeFrame(m_Frame.data(), m_Pixels.data(), m_LedCount);
+	if (m_DMA != NULL) {
+		return Stream(m_Frame.data(), m_Frame.size());
+	}
+
+	return OneShot(m_Frame.data(), m_Frame.size());
+}
+
+uint32_t
+WS2812BCtrl::ClampColor (
+	_In_ uint32_t Channel
+	)
+
+/*
+ Routine Description:
+
+	This routine saturates a color channel to a table index.
+
+ Parameters:
+
+ 	Channel - Supplies the channel value.
+
+ Return Value:
+
+	uint32_t - Channel value, 0 - 255.
+
+*/
+
+{
+
+	return (Channel > 0xFF) ? 0xFF : Channel;
+}
+
 void
 WS2812BCtrl::setSerializedRGB (
 	_Out_ uint32_t *arr,
@@ -121,12 +328,17 @@ WS2812BCtrl::setSerializedRGB (
 /*
  Routine Description:
 
-	This routine updates LED pixels based on user's input. Each led requires 24
-	pixels, each pixel contains 3 bits in "arr"(0b110 for "1" and 0b100 for "0")
+	This routine updates one LED in a serialized frame. The LED takes 72 bits
+	starting at bit led_idx * 72, which is always byte aligned, so its 3 words
+	of symbols are shifted into place and merged with the neighbours' bits.
 
  Parameters:
 
- 	Brightness - Supplies the brightness value.
+ 	arr - Supplies the frame, GetFrameWords(led_idx + 1) words at least.
+
+ 	led_idx - Supplies the index of the LED.
+
+ 	color - Supplies the color of the LED.
 
  Return Value:
 
@@ -136,67 +348,373 @@ WS2812BCtrl::setSerializedRGB (
 
 {
 
-	uint32_t R = color.R * m_Brightness;
-	uint32_t G = color.G * m_Brightness;
-	uint32_t B = color.B * m_Brightness;
-	uint32_t color_comp = (G << 16) | (R << 8) | B;
-	uint32_t mask = 0x1;
+	uint32_t Bit = static_cast<uint32_t>(led_idx) * 3 * 24;
+	uint32_t *Words = arr + (Bit >> 5);
+	uint32_t Shift = Bit & 0x1F;
+	uint32_t G = m_Code[ClampColor(color.G)];
+	uint32_t R = m_Code[ClampColor(color.R)];
+	uint32_t B = m_Code[ClampColor(color.B)];
+	uint32_t Code[3];
+	uint32_t Mask[3];
 
-	for (int pixel = 0; pixel < 24; ++pixel, mask <<= 1) {
-		int32_t word_off = (led_idx * 72 + pixel * 3) / 32;
-		int32_t bit_off = 29 - (led_idx * 72 + pixel * 3) % 32;
-		if (bit_off >= 0) {
-			arr[word_off] &= ~(0x7 << bit_off);
-			if (color_comp & mask) {
-				arr[word_off] |= 0x6 << bit_off;
+	//
+	// The 72 bits word aligned, then shifted right by 0, 8, 16 or 24. The
+	// carry is shifted in two steps as a shift by 32 is undefined.
+	//
 
-			} else {
-				arr[word_off] |= 0x4 << bit_off;
-			}
+	Code[0] = (G << 8) | (R >> 16);
+	Code[1] = (R << 16) | (B >> 8);
+	Code[2] = B << 24;
+	Mask[2] = (0xFF000000 >> Shift) | ((0xFFFFFFFF << (31 - Shift)) << 1);
+	Mask[1] = 0xFFFFFFFF;
+	Mask[0] = 0xFFFFFFFF >> Shift;
+	Code[2] = (Code[2] >> Shift) | ((Code[1] << (31 - Shift)) << 1);
+	Code[1] = (Code[1] >> Shift) | ((Code[0] << (31 - Shift)) << 1);
+	Code[0] = Code[0] >> Shift;
+	for (uint32_t i = 0; i < 3; ++i) {
+		Words[i] = (Words[i] & ~Mask[i]) | Code[i];
+	}
 
-		} else if (bit_off == -1) {
-			arr[word_off] &= ~(0x3);
-			arr[word_off + 1] &= ~(0x1 << (32 + bit_off));
-			if (color_comp & mask) {
-				arr[word_off] |= 0x3;
+	return;
+}
 
-			} else {
-				arr[word_off] |= 0x2;
-			}
+void
+WS2812BCtrl::EncodeFrame (
+	_Out_ uint32_t *arr,
+	_In_ const LEDPixel *pixels,
+	_In_ uint32_t count
+	)
 
-		} else if (bit_off == -2) {
-			arr[word_off] |= 0x1;
-			arr[word_off + 1] &= ~(0x3 << (32 + bit_off));
-			if (color_comp & mask) {
-				arr[word_off + 1] |= 0x2 << (32 + bit_off);
-			}
-		}
+/*
+ Routine Description:
+
+	This routine serializes a strip of LEDs, a group of 4 LEDs at a time.
+	The bits after the last LED in the last word are 0 (low).
+
+ Parameters:
+
+ 	arr - Supplies the frame, GetFrameWords(count) words.
+
+ 	pixels - Supplies the colors of the LEDs.
+
+ 	count - Supplies the number of LEDs.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Groups = count / WS2812B_GROUP_LEDS;
+	uint32_t Rest;
+	uint32_t Tail[WS2812B_GROUP_WORDS];
+
+	for (uint32_t Group = 0; Group < Groups; ++Group) {
+		EncodeGroup(arr + Group * WS2812B_GROUP_WORDS,
+					pixels + Group * WS2812B_GROUP_LEDS,
+					WS2812B_GROUP_LEDS);
+	}
+
+	Rest = count - Groups * WS2812B_GROUP_LEDS;
+	if (Rest != 0) {
+		EncodeGroup(Tail, pixels + Groups * WS2812B_GROUP_LEDS, Rest);
+		memcpy(arr + Groups * WS2812B_GROUP_WORDS,
+			   Tail,
+			   (GetFrameWords(count) - Groups * WS2812B_GROUP_WORDS) * sizeof(uint32_t));
+	}
+
+	return;
+}
+
+uint32_t
+WS2812BCtrl::GetFrameWords (
+	_In_ uint32_t count
+	)
+
+/*
+ Routine Description:
+
+	This routine returns the number of FIFO words taking count LEDs.
+
+ Parameters:
+
+ 	count - Supplies the number of LEDs.
+
+ Return Value:
+
+	uint32_t - Number of words.
+
+*/
+
+{
+
+	return (count * 3 * 24 + 31) / 32;
+}
+
+void
+WS2812BCtrl::EncodeGroup (
+	_Out_ uint32_t *Words,
+	_In_ const LEDPixel *Pixels,
+	_In_ uint32_t Count
+	)
+
+/*
+ Routine Description:
+
+	This routine serializes up to 4 LEDs through the symbol table. Missing
+	LEDs are sent as all-low symbols.
+
+ Parameters:
+
+ 	Words - Supplies the 9 words of the group.
+
+ 	Pixels - Supplies the colors of the LEDs.
+
+ 	Count - Supplies the number of LEDs, 1 - 4.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Codes[WS2812B_GROUP_LEDS * 3] = {0};
+
+	for (uint32_t i = 0; i < Count; ++i) {
+		Codes[i * 3] = m_Code[ClampColor(Pixels[i].G)];
+		Codes[i * 3 + 1] = m_Code[ClampColor(Pixels[i].R)];
+		Codes[i * 3 + 2] = m_Code[ClampColor(Pixels[i].B)];
 	}
+
+	PackGroup(Words, Codes);
+	return;
 }
 
 void
+WS2812BCtrl::PackGroup (
+	_Out_ uint32_t *Words,
+	_In_ const uint32_t *Codes
+	)
+
+/*
+ Routine Description:
+
+	This routine packs the 12 symbol codes of a group, in wire order, into 9
+	words. Every 4 codes of 24 bits fill 3 words exactly.
+
+ Parameters:
+
+ 	Words - Supplies the 9 words of the group.
+
+ 	Codes - Supplies the 12 codes.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	for (uint32_t i = 0; i < 3; ++i, Words += 3, Codes += 4) {
+		Words[0] = (Codes[0] << 8) | (Codes[1] >> 16);
+		Words[1] = (Codes[1] << 16) | (Codes[2] >> 8);
+		Words[2] = (Codes[2] << 24) | Codes[3];
+	}
+
+	return;
+}
+
+int32_t
 WS2812BCtrl::OneShot (
-	_In_ uint32_t *vals,
+	_In_ const uint32_t *vals,
 	_In_ uint32_t len
 	)
 
+/*
+ Routine Description:
+
+	This routine sends a frame through the PWM FIFO by the CPU. The FIFO is
+	filled before the PWM starts and topped up as it drains, then the latch
+	words keep the line low until the LEDs take the frame.
+
+ Parameters:
+
+ 	vals - Supplies the serialized frame (see EncodeFrame).
+
+ 	len - Supplies the number of words in vals.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
 {
-	m_PWM->UpdatePWMFIFO(vals, 9);
-			m_PWM->PWMOnOff(ON);
-			usleep(1000);
+
+	const uint32_t Latch[WS2812B_LATCH_WORDS] = {0};
+	uint32_t Sent;
+	int32_t Status = 0;
+	uint64_t Start;
+
+	if (m_DMA != NULL) {
+		RPI_PRINT(InfoLevelError, "The FIFO is fed by DMA in streaming mode");
+		return -1;
+	}
+
+	m_PWM->ClearFIFO();
+	Sent = m_PWM->FillPWMFIFO(vals, len);
+	m_PWM->PWMOnOff(ON);
+	if ((FeedFIFO(vals + Sent, len - Sent) != 0) ||
+		(FeedFIFO(Latch, WS2812B_LATCH_WORDS) != 0)) {
+
+		Status = -2;
+
+	} else {
+		Start = RpiGetTimeUs();
+		while (m_PWM->GetPWMSTA().EMPT1 == 0) {
+			if (RpiGetTimeUs() - Start > WS2812B_FIFO_TIMEOUT_US * WS2812B_LATCH_WORDS) {
+				RPI_PRINT(InfoLevelError, "PWM FIFO doesn't drain");
+				Status = -3;
+				break;
+			}
+		}
+	}
 
 	m_PWM->PWMOnOff(OFF);
 	m_PWM->ClearFIFO();
-	sleep(1);
-	return;
+	return Status;
+}
+
+int32_t
+WS2812BCtrl::FeedFIFO (
+	_In_ const uint32_t *Words,
+	_In_ uint32_t Len
+	)
+
+/*
+ Routine Description:
+
+	This routine spins writing words whenever the FIFO has room. A word takes
+	13.3us on the wire, far less than a sleep, so it doesn't sleep.
+
+ Parameters:
+
+ 	Words - Supplies the words.
+
+ 	Len - Supplies the number of words.
+
+ Return Value:
+
+	int32_t - 0 on success, -1 if the FIFO stops draining.
+
+*/
+
+{
+
+	uint64_t Last = RpiGetTimeUs();
+	uint32_t Sent;
+
+	while (Len != 0) {
+		Sent = m_PWM->FillPWMFIFO(Words, Len);
+		if (Sent != 0) {
+			Words += Sent;
+			Len -= Sent;
+			Last = RpiGetTimeUs();
+
+		} else if (RpiGetTimeUs() - Last > WS2812B_FIFO_TIMEOUT_US) {
+			RPI_PRINT(InfoLevelError, "PWM FIFO doesn't drain");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int32_t
+WS2812BCtrl::Stream (
+	_In_ const uint32_t *vals,
+	_In_ uint32_t len
+	)
+
+/*
+ Routine Description:
+
+	This routine hands a frame over to the DMA channel. It waits for the
+	previous frame to be consumed, copies the frame followed by the latch words
+	to the DMA buffer and restarts the channel. The DMA writes the PWM FIFO
+	whenever the PWM asserts DREQ, so no CPU time is spent per bit.
+
+ Parameters:
+
+ 	vals - Supplies the serialized frame (see setSerializedRGB).
+
+ 	len - Supplies the number of words in vals.
+
+ Return Value:
+
+	int32_t - 0 on success, negative value on failure.
+
+*/
+
+{
+
+	volatile uint32_t *Buffer;
+	uint32_t Words;
+
+	if (m_DMA == NULL) {
+		RPI_PRINT(InfoLevelError, "Streaming mode is not enabled");
+		return -1;
+	}
+
+	Words = len + WS2812B_LATCH_WORDS;
+	if (Words * sizeof(uint32_t) > m_DMA->getSrcLen()) {
+		RPI_PRINT_EX(InfoLevelError, "Frame of %u words is too large", len);
+		return -2;
+	}
+
+	//
+	// The previous frame must be out of the DMA buffer before it's overwritten.
+	//
+
+	if (m_DMA->WaitForCompletion(WS2812B_STREAM_TIMEOUT_US) != 0) {
+		m_DMA->Stop();
+	}
+
+	Buffer = static_cast<volatile uint32_t *>(m_DMA->getSrcVirtAddr());
+	for (uint32_t i = 0; i < len; ++i) {
+		Buffer[i] = vals[i];
+	}
+
+	for (uint32_t i = len; i < Words; ++i) {
+		Buffer[i] = 0;
+	}
+
+	if (m_DMA->SetupPeripheralTx(Words * sizeof(uint32_t),
+								 GpioPwm::GetFIFOBusAddr(),
+								 DMACtrl::PWM) < 0) {
+
+		return -3;
+	}
+
+	m_DMA->Start();
+	return 0;
 }
 
-void WaterLight()
+void WaterLight(int32_t UseDMA)
 {
 	float Brightness = 0.3;
-	WS2812BCtrl Ctrl(Brightness);
-	const uint32_t led_val = 255 * Brightness;
-	uint32_t vals[10];
+	WS2812BCtrl Ctrl(Brightness, UseDMA);
+
+	//
+	// Full scale, the brightness is applied by the encoding LUT.
+	//
+
+	const uint32_t led_val = 255;
 	LEDPixel leds[4] = {
 			{led_val, 0 ,0},
 			{0, led_val, 0},
@@ -204,21 +722,14 @@ void WaterLight()
 			{led_val, led_val, led_val}
 	};
 
-	for (int i = 0; i < 10; ++i)
-		vals[i] = 0;
-	Ctrl.setSerializedRGB(vals, 0, { 0, 0, 0 });
-	Ctrl.setSerializedRGB(vals, 1, { 0, 0, 0 });
-	Ctrl.setSerializedRGB(vals, 2, { 0, 0, 0 });
-	Ctrl.setSerializedRGB(vals, 3, { 0, 0, 0 });
-
 	int idx = 0;
 	while (1)
 	{
 		++idx;
-		Ctrl.setSerializedRGB(vals, 0, leds[idx % 4]);
-		Ctrl.setSerializedRGB(vals, 1, leds[(idx + 1) % 4]);
-		Ctrl.setSerializedRGB(vals, 2, leds[(idx + 2) % 4]);
-		Ctrl.setSerializedRGB(vals, 3, leds[(idx + 3) % 4]);
-		Ctrl.OneShot(vals, 9);
+		for (uint32_t i = 0; i < Ctrl.GetLedCount(); ++i)
+			Ctrl.SetPixel(i, leds[(idx + i) % 4]);
+
+		Ctrl.Show();
+		usleep(100000);
 	}
 }
@@ -0,0 +1,587 @@
+/*
+ * WheelEncoder.cpp
+ *
+ *  Created on: Apr 10, 2021
+ *      Author: Albert Guan
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include "Diag.h"
+#include "GpioConfigBatch.h"
+#include "GpioIn.h"
+#include "WheelEncoder.h"
+
+//
+// Quadrature steps indexed by (previous AB << 2) | current AB. Forward goes
+// 00 -> 01 -> 11 -> 10 -> 00. Both bits changing at once means a step was
+// missed, it's counted as an error.
+//
+
+static const int8_t QUADRATURE_STEPS[16] = {
+	0, 1, -1, 0,
+	-1, 0, 0, 1,
+	1, 0, 0, -1,
+	0, -1, 1, 0,
+};
+
+static const uint16_t QUADRATURE_INVALID = (1 << 3) | (1 << 6) | (1 << 9) | (1 << 12);
+
+WheelEncoder::WheelEncoder (
+	_In_ int32_t LeftA,
+	_In_ int32_t LeftB,
+	_In_ int32_t RightA,
+	_In_ int32_t RightB,
+	_In_ uint32_t PollUs
+	) : GpioBase(std::vector<int32_t>{}, FSEL_INPUT),
+		m_EventMask(0),
+		m_Stop(0)
+
+/*
+ Routine Description:
+
+	This routine is the constructor of WheelEncoder, it configures the
+	encoder pins as inputs with async edge detection in one batch. A wheel
+	without an A pin isn't counted, its state stays 0.
+
+ Parameters:
+
+ 	LeftA - Supplies the A channel of the left encoder, -1 for none.
+
+ 	LeftB - Supplies the B channel of the left encoder, -1 for single
+ 		channel.
+
+ 	RightA - Supplies the A channel of the right encoder, -1 for none.
+
+ 	RightB - Supplies the B channel of the right encoder, -1 for single
+ 		channel.
+
+ 	PollUs - Supplies the polling period of GPEDSn.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	GpioConfigBatch Batch;
+	uint64_t Levels;
+	const int32_t Pins[WHEEL_COUNT][2] = {{LeftA, LeftB}, {RightA, RightB}};
+
+	m_PollNs = static_cast<uint64_t>((0 != PollUs) ? PollUs : WHEEL_ENCODER_POLL_US) * 1000;
+	for (uint32_t i = 0; i < WHEEL_COUNT; i++) {
+		WheelCounter &W = m_Wheels[i];
+
+		W.PinA = Pins[i][0];
+		W.PinB = Pins[i][1];
+		W.Mask = 0;
+		W.Sign.store(1);
+		W.Levels = 0;
+		W.Direction = 0;
+		W.Ticks = 0;
+		W.LastEdgeNs = 0;
+		W.PeriodNs = 0;
+		W.Errors = 0;
+		W.Seq.store(0);
+		Publish(W);
+
+		if (W.PinA < 0) {
+			continue;
+		}
+
+		if ((W.PinA >= GPIO_PIN_COUNT) || (W.PinB >= GPIO_PIN_COUNT)) {
+			RPI_PRINT_EX(InfoLevelError, "Invalid encoder pins %d/%d", W.PinA, W.PinB);
+			continue;
+		}
+
+		//
+		// One rising edge per pulse is enough without a B channel, a
+		// quadrature encoder needs every edge of both.
+		//
+
+		Batch.SetFunction(W.PinA, FSEL_INPUT);
+		W.Mask |= 1ull << W.PinA;
+		if (W.PinB < 0) {
+			Batch.SetEvent(W.PinA, EVENT_ASYNC_RISING);
+
+		} else {
+			Batch.SetFunction(W.PinB, FSEL_INPUT);
+			Batch.SetEvent(W.PinA, EVENT_ASYNC_RISING);
+			Batch.AddEvent(W.PinA, EVENT_ASYNC_FALLING);
+			Batch.SetEvent(W.PinB, EVENT_ASYNC_RISING);
+			Batch.AddEvent(W.PinB, EVENT_ASYNC_FALLING);
+			W.Mask |= 1ull << W.PinB;
+		}
+
+		m_EventMask |= W.Mask;
+	}
+
+	Batch.Apply();
+
+	Levels = GpioIn::readLevels();
+	for (uint32_t i = 0; i < WHEEL_COUNT; i++) {
+		WheelCounter &W = m_Wheels[i];
+
+		if ((0 != W.Mask) && (W.PinB >= 0)) {
+			W.Levels = (((Levels >> W.PinA) & 0x1) << 1) | ((Levels >> W.PinB) & 0x1);
+		}
+	}
+
+	return;
+}
+
+WheelEncoder::~WheelEncoder (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the destructor of WheelEncoder, it stops the reader and
+	turns the edge detection off.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	GpioConfigBatch Batch;
+
+	Stop();
+	for (uint32_t i = 0; i < WHEEL_COUNT; i++) {
+		if (0 != m_Wheels[i].Mask) {
+			Batch.SetEvent(m_Wheels[i].PinA, EVENT_NONE);
+			if (m_Wheels[i].PinB >= 0) {
+				Batch.SetEvent(m_Wheels[i].PinB, EVENT_NONE);
+			}
+		}
+	}
+
+	Batch.Apply();
+	return;
+}
+
+int32_t
+WheelEncoder::Start (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine starts the reader thread.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	int32_t - 0 if started, -1 if it already runs or there's nothing to read.
+
+*/
+
+{
+
+	if (m_Thread.joinable() || (0 == m_EventMask)) {
+		return -1;
+	}
+
+	//
+	// Drop the edges latched before the counting starts.
+	//
+
+	GPIORegs->GPEDSn[0] = static_cast<uint32_t>(m_EventMask);
+	GPIORegs->GPEDSn[1] = static_cast<uint32_t>(m_EventMask >> 32);
+	m_Stop.store(0);
+	m_Thread = std::thread(&WheelEncoder::ReaderThread, this);
+	return 0;
+}
+
+void
+WheelEncoder::Stop (
+	void
+)
+{
+	if (m_Thread.joinable()) {
+		m_Stop.store(1);
+		m_Thread.join();
+	}
+
+	return;
+}
+
+void
+WheelEncoder::SetDirection (
+	_In_ WHEEL Wheel,
+	_In_ int32_t Sign
+	)
+{
+	if (Wheel < WHEEL_COUNT) {
+		m_Wheels[Wheel].Sign.store((Sign < 0) ? -1 : 1, std::memory_order_relaxed);
+	}
+
+	return;
+}
+
+void
+WheelEncoder::Publish (
+	_Inout_ WheelCounter &W
+	)
+
+/*
+ Routine Description:
+
+	This routine publishes the counts of a wheel. The sequence is odd while
+	the fields are written, so readers retry instead of mixing two updates.
+
+ Parameters:
+
+ 	W - Supplies the wheel.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Seq = W.Seq.load(std::memory_order_relaxed);
+
+	W.Seq.store(Seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	W.PubTicks.store(W.Ticks, std::memory_order_relaxed);
+	W.PubLastEdgeNs.store(W.LastEdgeNs, std::memory_order_relaxed);
+	W.PubPeriodNs.store(W.PeriodNs, std::memory_order_relaxed);
+	W.PubDirection.store(W.Direction, std::memory_order_relaxed);
+	W.PubErrors.store(W.Errors, std::memory_order_relaxed);
+	W.Seq.store(Seq + 2, std::memory_order_release);
+	return;
+}
+
+void
+WheelEncoder::GetState (
+	_In_ WHEEL Wheel,
+	_Out_ WheelState &State
+	)
+
+/*
+ Routine Description:
+
+	This routine takes a consistent snapshot of a wheel and derives its
+	speed. The speed is the inverse of the last edge period, or of the time
+	since the last edge once that's longer, so it decays to 0 when the wheel
+	stops.
+
+ Parameters:
+
+ 	Wheel - Supplies the wheel.
+
+ 	State - Supplies the snapshot.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	int32_t Direction;
+	uint64_t Now;
+	uint64_t PeriodNs;
+	uint32_t Seq;
+	WheelCounter *W;
+
+	memset(&State, 0, sizeof(State));
+	if (Wheel >= WHEEL_COUNT) {
+		return;
+	}
+
+	W = &m_Wheels[Wheel];
+	do {
+		Seq = W->Seq.load(std::memory_order_acquire);
+		State.Ticks = W->PubTicks.load(std::memory_order_relaxed);
+		State.LastEdgeNs = W->PubLastEdgeNs.load(std::memory_order_relaxed);
+		State.Errors = W->PubErrors.load(std::memory_order_relaxed);
+		PeriodNs = W->PubPeriodNs.load(std::memory_order_relaxed);
+		Direction = W->PubDirection.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((0 != (Seq & 0x1)) || (Seq != W->Seq.load(std::memory_order_relaxed)));
+
+	Now = RpiGetTimeNs();
+	if ((0 == PeriodNs) || (0 == State.LastEdgeNs) ||
+		(Now - State.LastEdgeNs > WHEEL_ENCODER_TIMEOUT_MS * 1000000ull)) {
+		State.TicksPerSec = 0;
+		return;
+	}
+
+	if (Now - State.LastEdgeNs > PeriodNs) {
+		PeriodNs = Now - State.LastEdgeNs;
+	}
+
+	State.TicksPerSec = Direction * 1e9f / PeriodNs;
+	return;
+}
+
+void
+WheelEncoder::Update (
+	_Inout_ WheelCounter &W,
+	_In_ uint64_t Events,
+	_In_ uint64_t Levels,
+	_In_ uint64_t NowNs
+	)
+
+/*
+ Routine Description:
+
+	This routine counts the edges of one wheel seen by a poll.
+
+ Parameters:
+
+ 	W - Supplies the wheel.
+
+ 	Events - Supplies the GPEDSn bits of the poll.
+
+ 	Levels - Supplies the levels read right after.
+
+ 	NowNs - Supplies the time of the poll.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint32_t Current;
+	uint32_t Index;
+	int32_t Step;
+
+	if (0 == (Events & W.Mask)) {
+		return;
+	}
+
+	if (W.PinB < 0) {
+		Step = W.Sign.load(std::memory_order_relaxed);
+
+	} else {
+		Current = (((Levels >> W.PinA) & 0x1) << 1) | ((Levels >> W.PinB) & 0x1);
+		Index = (W.Levels << 2) | Current;
+		Step = QUADRATURE_STEPS[Index];
+		if (0 != (QUADRATURE_INVALID & (1u << Index))) {
+			W.Errors += 1;
+		}
+
+		W.Levels = Current;
+
+		//
+		// A pin toggling back before the poll reads its level leaves no
+		// step, only the latched event.
+		//
+
+		if (0 == Step) {
+			Publish(W);
+			return;
+		}
+	}
+
+	W.Direction = Step;
+	W.Ticks += Step;
+	if (0 != W.LastEdgeNs) {
+		W.PeriodNs = NowNs - W.LastEdgeNs;
+	}
+
+	W.LastEdgeNs = NowNs;
+	Publish(W);
+	return;
+}
+
+void
+WheelEncoder::ReaderThread (
+	void
+)
+
+/*
+ Routine Description:
+
+	This routine is the reader thread. It polls GPEDSn of the encoder pins,
+	clears the bits it saw (write 1 to clear) and counts them.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	uint64_t Deadline;
+	uint64_t Events;
+	uint64_t Levels;
+	uint64_t Now;
+	struct sched_param Param;
+	uint32_t Word0Mask = static_cast<uint32_t>(m_EventMask);
+	uint32_t Word1Mask = static_cast<uint32_t>(m_EventMask >> 32);
+	uint32_t Word0;
+	uint32_t Word1;
+
+	memset(&Param, 0, sizeof(Param));
+	Param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+	if (0 != pthread_setschedparam(pthread_self(), SCHED_FIFO, &Param)) {
+		RPI_PRINT(InfoLevelWarning, "Wheel encoders without SCHED_FIFO, run as root to not miss edges");
+	}
+
+	Deadline = RpiGetTimeNs();
+	while (0 == m_Stop.load(std::memory_order_relaxed)) {
+		Word0 = (0 != Word0Mask) ? (GPIORegs->GPEDSn[0] & Word0Mask) : 0;
+		Word1 = (0 != Word1Mask) ? (GPIORegs->GPEDSn[1] & Word1Mask) : 0;
+		if ((0 != Word0) || (0 != Word1)) {
+			if (0 != Word0) {
+				GPIORegs->GPEDSn[0] = Word0;
+			}
+
+			if (0 != Word1) {
+				GPIORegs->GPEDSn[1] = Word1;
+			}
+
+			Levels = GpioIn::readLevels();
+			Now = RpiGetTimeNs();
+			Events = (static_cast<uint64_t>(Word1) << 32) | Word0;
+			for (uint32_t i = 0; i < WHEEL_COUNT; i++) {
+				Update(m_Wheels[i], Events, Levels, Now);
+			}
+		}
+
+		Deadline += m_PollNs;
+		Now = RpiGetTimeNs();
+		if (Deadline < Now) {
+			Deadline = Now;
+		}
+
+		RpiSleepUntilNs(Deadline);
+	}
+
+	return;
+}
+
+DiffDrive::DiffDriveFeedback
+WheelEncoder::MakeFeedback (
+	_In_ DiffDrive &Drive,
+	_In_ float MaxTicksPerSec
+	)
+
+/*
+ Routine Description:
+
+	This routine builds the feedback routine closing the DiffDrive loop.
+
+ Parameters:
+
+ 	Drive - Supplies the drive, its output gives the direction of single
+ 		channel encoders.
+
+ 	MaxTicksPerSec - Supplies the encoder rate at full duty cycle.
+
+ Return Value:
+
+	DiffDrive::DiffDriveFeedback - Routine to pass to DiffDrive::SetFeedback.
+
+*/
+
+{
+
+	return [this, &Drive, MaxTicksPerSec](float *Left, float *Right) -> int32_t {
+		float Output[WHEEL_COUNT];
+		WheelState State;
+		float *Measured[WHEEL_COUNT] = {Left, Right};
+
+		if (MaxTicksPerSec <= 0) {
+			return -1;
+		}
+
+		Drive.GetOutput(&Output[WHEEL_LEFT], &Output[WHEEL_RIGHT]);
+		for (uint32_t i = 0; i < WHEEL_COUNT; i++) {
+			if (0 != Output[i]) {
+				SetDirection(static_cast<WHEEL>(i), (Output[i] < 0) ? -1 : 1);
+			}
+
+			GetState(static_cast<WHEEL>(i), State);
+			*Measured[i] = State.TicksPerSec / MaxTicksPerSec;
+		}
+
+		return 0;
+	};
+}
+
+void
+WheelEncoderDemo (
+	void
+	)
+
+/*
+ Routine Description:
+
+	This is a sample routine, it closes the speed loop of the drive with the
+	encoders and prints the counts. The encoders are wired to the UART pins,
+	the serial console must be off.
+
+ Parameters:
+
+ 	None.
+
+ Return Value:
+
+	None.
+
+*/
+
+{
+
+	MotorCtrl Motors;
+	DiffDrive Drive(Motors);
+	WheelEncoder Encoders(14, -1, 15, -1);
+	WheelState Left;
+	WheelState Right;
+
+	//
+	// About 20 pulses per wheel turn at 600 rpm at full duty cycle, tune it for
+	// the encoders used.
+	//
+
+	Drive.SetFeedback(Encoders.MakeFeedback(Drive, 200.0f), 0.5f, 2.0f);
+	Encoders.Start();
+	Drive.SetVelocity(0.5f, 0.5f);
+	for (uint32_t i = 0; i < 50; i++) {
+		usleep(100000);
+		Encoders.GetState(WHEEL_LEFT, Left);
+		Encoders.GetState(WHEEL_RIGHT, Right);
+		RPI_PRINT_EX(InfoLevelInfo,
+					 "Left %lld ticks %.1f/s, right %lld ticks %.1f/s",
+					 Left.Ticks,
+					 Left.TicksPerSec,
+					 Right.Ticks,
+					 Right.TicksPerSec);
+	}
+
+	Drive.Stop();
+	sleep(1);
+	return;
+}
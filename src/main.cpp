@@ -22,6 +22,7 @@
 #include "MotorCtrl.h"
 #include "GpioClk.h"
 #include "GpioIn.h"
+#include "JoyStick.h"
 #include "bcm2835.h"
 #include "ProximitySensor.h"
 #include "Diag.h"